@@ -0,0 +1,167 @@
+//
+// Accuracy-versus-throughput evaluation against an exact baseline.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "accuracy_harness.h"
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+
+namespace {
+    // Items are fed to the sketch in batches of this size, which is what a real ingest path would do.
+    const size_t evaluation_batch = 4096 ;
+
+    double seconds_since(std::chrono::steady_clock::time_point begin){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() ;
+    }
+
+    std::string format_config(const std::vector<uint64_t> &config){
+        std::ostringstream out ;
+        for(size_t k=0; k < config.size(); k++){
+            out << (k == 0 ? "" : ",") << config[k] ;
+        }
+        return out.str() ;
+    }
+}
+
+uint64_t ExactBaseline::get_memory_bytes() const {
+    /*
+     * libstdc++ nodes hold a next pointer, the key-value pair and the cached hash.
+     */
+    return counts.bucket_count() * sizeof(void*) + counts.size() * (sizeof(void*) + sizeof(std::pair<const uint64_t, int64_t>) + sizeof(size_t)) ;
+}
+
+ExactBaseline build_exact_baseline(const uint64_t *items, const int64_t *weights, size_t n){
+    ExactBaseline baseline ;
+    auto begin = std::chrono::steady_clock::now() ;
+    for(size_t k=0; k < n; k++){
+        int64_t weight = (weights == nullptr) ? 1 : weights[k] ;
+        baseline.counts[items[k]] += weight ;
+        baseline.total_weight += weight ;
+    }
+    double seconds = seconds_since(begin) ;
+    baseline.updates_per_second = (seconds > 0.0) ? double(n) / seconds : 0.0 ;
+    return baseline ;
+}
+
+template <class Sketch>
+EvaluationResult evaluate_sketch(const std::string &name, Sketch &sketch, const uint64_t *items, const int64_t *weights,
+                                 size_t n, const ExactBaseline &baseline){
+    EvaluationResult result ;
+    result.name = name ;
+    result.config = sketch.get_config() ;
+    result.memory_bytes = sketch.get_memory_bytes() ;
+
+    auto begin = std::chrono::steady_clock::now() ;
+    for(size_t start=0; start < n; start += evaluation_batch){
+        size_t len = std::min(evaluation_batch, n - start) ;
+        sketch.update_batch(items + start, (weights == nullptr) ? nullptr : weights + start, len) ;
+    }
+    double seconds = seconds_since(begin) ;
+    result.updates_per_second = (seconds > 0.0) ? double(n) / seconds : 0.0 ;
+
+    std::vector<uint64_t> keys ;
+    std::vector<int64_t> truth ;
+    keys.reserve(baseline.counts.size()) ;
+    truth.reserve(baseline.counts.size()) ;
+    for(const auto &entry : baseline.counts){
+        keys.push_back(entry.first) ;
+        truth.push_back(entry.second) ;
+    }
+    std::vector<int64_t> estimates(keys.size()) ;
+    sketch.get_estimates(keys.data(), keys.size(), estimates.data()) ;
+
+    result.error_bound = double(sketch.get_epsilon()) * double(sketch.get_total_weight()) ;
+    std::vector<double> errors(keys.size()) ;
+    uint64_t within = 0 ;
+    for(size_t k=0; k < keys.size(); k++){
+        double error = double(estimates[k] - truth[k]) ;
+        within += (error <= result.error_bound) ;
+        errors[k] = (result.error_bound > 0.0) ? error / result.error_bound : 0.0 ;
+    }
+    if(!errors.empty()){
+        std::sort(errors.begin(), errors.end()) ;
+        for(size_t q=0; q < num_error_quantiles; q++){
+            size_t rank = size_t(std::ceil(error_quantiles[q] * double(errors.size()))) ;
+            result.relative_errors[q] = errors[std::min(errors.size() - 1, std::max<size_t>(rank, 1) - 1)] ;
+        }
+        result.within_bound = double(within) / double(errors.size()) ;
+    }
+    return result ;
+}
+
+void print_evaluation_header(std::ostream &os){
+    os << std::left << std::setw(28) << "sketch" << std::setw(24) << "config" << std::right
+       << std::setw(12) << "memory_KB" << std::setw(12) << "Mupd/s" << std::setw(12) << "eps*N" ;
+    for(double q : error_quantiles){
+        std::ostringstream label ;
+        if(q == 1.0){
+            label << "err_max" ;
+        } else {
+            label << "err_p" << q * 100 ;
+        }
+        os << std::setw(10) << label.str() ;
+    }
+    os << std::setw(10) << "in_bound" << "\n" ;
+}
+
+void print_evaluation(std::ostream &os, const EvaluationResult &result){
+    os << std::left << std::setw(28) << result.name << std::setw(24) << format_config(result.config) << std::right
+       << std::setw(12) << (result.memory_bytes >> 10)
+       << std::setw(12) << std::fixed << std::setprecision(1) << result.updates_per_second / 1e6
+       << std::setw(12) << std::setprecision(0) << result.error_bound << std::setprecision(3) ;
+    for(double e : result.relative_errors){
+        os << std::setw(10) << e ;
+    }
+    os << std::setw(10) << result.within_bound << "\n" ;
+    os.unsetf(std::ios::floatfield) ;
+}
+
+void print_baseline(std::ostream &os, const ExactBaseline &baseline){
+    os << std::left << std::setw(28) << "exact (unordered_map)" << std::setw(24) << (std::to_string(baseline.counts.size()) + " keys")
+       << std::right << std::setw(12) << (baseline.get_memory_bytes() >> 10)
+       << std::setw(12) << std::fixed << std::setprecision(1) << baseline.updates_per_second / 1e6 << "\n" ;
+    os.unsetf(std::ios::floatfield) ;
+}
+
+void read_text_trace(const std::string &path, std::vector<uint64_t> &items, std::vector<int64_t> &weights){
+    std::ifstream in(path) ;
+    if(!in){
+        throw std::runtime_error( "Cannot open trace " + path );
+    }
+    items.clear() ;
+    weights.clear() ;
+    bool weighted = false ;
+    std::string line ;
+    while(std::getline(in, line)){
+        std::istringstream fields(line) ;
+        uint64_t key ;
+        int64_t weight = 1 ;
+        if(!(fields >> key)){
+            continue ;
+        }
+        if(fields >> weight){
+            if(!weighted){
+                weights.assign(items.size(), 1) ;
+                weighted = true ;
+            }
+        }
+        items.push_back(key) ;
+        if(weighted){
+            weights.push_back(weight) ;
+        }
+    }
+}
+
+template EvaluationResult evaluate_sketch(const std::string&, CountMinSketch&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
+template EvaluationResult evaluate_sketch(const std::string&, MultiplyShiftCountMinSketch&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
+template EvaluationResult evaluate_sketch(const std::string&, TabulationCountMinSketch&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
+template EvaluationResult evaluate_sketch(const std::string&, DoubleHashCountMinSketch&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
+template EvaluationResult evaluate_sketch(const std::string&, BlockedCountMinSketch8&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
+template EvaluationResult evaluate_sketch(const std::string&, BlockedCountMinSketch16&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
+template EvaluationResult evaluate_sketch(const std::string&, BlockedCountMinSketch32&, const uint64_t*, const int64_t*, size_t, const ExactBaseline&) ;
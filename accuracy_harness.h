@@ -0,0 +1,54 @@
+//
+// Accuracy-versus-throughput evaluation against an exact baseline.
+// build_exact_baseline counts a stream exactly in a std::unordered_map; evaluate_sketch then feeds the same
+// stream to a sketch through update_batch, timing it, and compares every distinct item's estimate with its true
+// count. Errors are reported as quantiles of (estimate - count) / (epsilon * total weight), so a value of 1 is
+// exactly the sketch's guaranteed bound and within_bound should be at least the sketch's confidence.
+// Works with any sketch offering update_batch, get_estimates, get_epsilon, get_total_weight and get_memory_bytes.
+//
+
+#ifndef LINEARSKETCHES_ACCURACY_HARNESS_H
+#define LINEARSKETCHES_ACCURACY_HARNESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const size_t num_error_quantiles = 4 ;
+const double error_quantiles[num_error_quantiles] = {0.5, 0.9, 0.99, 1.0} ;
+
+struct ExactBaseline {
+    std::unordered_map<uint64_t, int64_t> counts ;
+    int64_t total_weight = 0 ;
+    double updates_per_second = 0.0 ;
+    uint64_t get_memory_bytes() const ; // estimate of the hash map's footprint: bucket array plus one node per key
+};
+
+struct EvaluationResult {
+    std::string name ;
+    std::vector<uint64_t> config ;
+    uint64_t memory_bytes = 0 ;
+    double updates_per_second = 0.0 ;
+    double error_bound = 0.0 ; // epsilon * total weight
+    double relative_errors[num_error_quantiles] = {} ; // at error_quantiles, as multiples of error_bound
+    double within_bound = 0.0 ; // fraction of distinct items whose error is at most error_bound
+};
+
+// weights may be nullptr for unit weights
+ExactBaseline build_exact_baseline(const uint64_t *items, const int64_t *weights, size_t n) ;
+
+template <class Sketch>
+EvaluationResult evaluate_sketch(const std::string &name, Sketch &sketch, const uint64_t *items, const int64_t *weights,
+                                 size_t n, const ExactBaseline &baseline) ;
+
+void print_evaluation_header(std::ostream &os) ;
+void print_evaluation(std::ostream &os, const EvaluationResult &result) ;
+void print_baseline(std::ostream &os, const ExactBaseline &baseline) ;
+
+// Reads a text trace with one "key" or "key weight" per line. weights is left empty if no line has a weight.
+void read_text_trace(const std::string &path, std::vector<uint64_t> &items, std::vector<int64_t> &weights) ;
+
+#endif //LINEARSKETCHES_ACCURACY_HARNESS_H
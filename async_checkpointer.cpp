@@ -0,0 +1,196 @@
+//
+// Background checkpointing of a snapshot CountMin sketch to disk.
+//
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "async_checkpointer.h"
+#include "snapshot_count_min_sketch.h"
+
+namespace {
+    const char checkpoint_suffix[] = ".lscm" ;
+
+    std::string checkpoint_name(const std::string &prefix, uint64_t epoch){
+        /*
+         * Zero padded so that names sort in epoch order.
+         */
+        char digits[32] ;
+        std::snprintf(digits, sizeof(digits), "%020llu", static_cast<unsigned long long>(epoch)) ;
+        return prefix + "-" + digits + checkpoint_suffix ;
+    }
+
+    bool is_checkpoint_name(const std::string &name, const std::string &prefix){
+        size_t suffix_len = std::strlen(checkpoint_suffix) ;
+        return name.size() == prefix.size() + 1 + 20 + suffix_len
+            && name.compare(0, prefix.size() + 1, prefix + "-") == 0
+            && name.compare(name.size() - suffix_len, suffix_len, checkpoint_suffix) == 0 ;
+    }
+
+    void write_file_durably(const std::string &directory, const std::string &name, const std::string &bytes){
+        /*
+         * write to a temporary file, fsync it, rename it into place and fsync the directory so that
+         * the checkpoint is either absent or complete after a crash.
+         */
+        std::string path = directory + "/" + name ;
+        std::string tmp_path = path + ".tmp" ;
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) ;
+        if(fd < 0){
+            throw std::runtime_error( "Cannot create " + tmp_path + ": " + std::strerror(errno) );
+        }
+        size_t written = 0 ;
+        while(written < bytes.size()){
+            ssize_t n = write(fd, bytes.data() + written, bytes.size() - written) ;
+            if(n < 0 && errno == EINTR){
+                continue ;
+            }
+            if(n < 0){
+                int err = errno ;
+                close(fd) ;
+                unlink(tmp_path.c_str()) ;
+                throw std::runtime_error( "Cannot write " + tmp_path + ": " + std::strerror(err) );
+            }
+            written += n ;
+        }
+        if(fsync(fd) != 0 || close(fd) != 0){
+            unlink(tmp_path.c_str()) ;
+            throw std::runtime_error( "Cannot sync " + tmp_path + ": " + std::strerror(errno) );
+        }
+        if(rename(tmp_path.c_str(), path.c_str()) != 0){
+            unlink(tmp_path.c_str()) ;
+            throw std::runtime_error( "Cannot rename " + tmp_path + ": " + std::strerror(errno) );
+        }
+        int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) ;
+        if(dir_fd >= 0){
+            fsync(dir_fd) ;
+            close(dir_fd) ;
+        }
+    }
+}
+
+template <class Sketch>
+AsyncCheckpointer<Sketch>::AsyncCheckpointer(Sketch &sketch, CheckpointConfig config):
+    sketch(sketch), config(std::move(config)), num_checkpoints(0), num_failures(0){
+    if(this->config.directory.empty() || this->config.retain == 0){
+        throw std::invalid_argument( "Checkpoints need a directory and must retain at least one file." );
+    }
+    worker = std::thread(&AsyncCheckpointer::run, this) ;
+}
+
+template <class Sketch>
+AsyncCheckpointer<Sketch>::~AsyncCheckpointer(){
+    stop() ;
+}
+
+template <class Sketch>
+void AsyncCheckpointer<Sketch>::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex) ;
+        stopping = true ;
+    }
+    wake.notify_all() ;
+    if(worker.joinable()){
+        worker.join() ;
+    }
+}
+
+template <class Sketch>
+void AsyncCheckpointer<Sketch>::run(){
+    /*
+     * Each tick writes the newest published snapshot and then asks the writer for a fresh one, which it
+     * publishes on its next update and which is picked up on the following tick.
+     */
+    sketch.request_snapshot() ;
+    std::unique_lock<std::mutex> lock(mutex) ;
+    while(!stopping){
+        wake.wait_for(lock, config.interval, [this](){ return stopping ; }) ;
+        if(stopping){
+            break ;
+        }
+        lock.unlock() ;
+        write_latest() ;
+        sketch.request_snapshot() ;
+        lock.lock() ;
+    }
+}
+
+template <class Sketch>
+bool AsyncCheckpointer<Sketch>::checkpoint_now(){
+    return write_latest() ;
+}
+
+template <class Sketch>
+bool AsyncCheckpointer<Sketch>::write_latest(){
+    /*
+     * Serialized by write_mutex: a caller's checkpoint_now and the worker's tick could otherwise both pass the
+     * epoch check and write the same temporary file, or one could prune while the other renames.
+     */
+    std::lock_guard<std::mutex> writing(write_mutex) ;
+    auto snapshot = sketch.latest_snapshot() ;
+    {
+        std::lock_guard<std::mutex> lock(mutex) ;
+        if(num_checkpoints.load() > 0 && snapshot->get_epoch() == last_epoch){
+            return false ;
+        }
+    }
+    try {
+        std::ostringstream image ;
+        snapshot->serialize(image) ;
+        write_file_durably(config.directory, checkpoint_name(config.prefix, snapshot->get_epoch()), image.str()) ;
+        prune() ;
+    } catch(const std::exception &e){
+        std::lock_guard<std::mutex> lock(mutex) ;
+        last_error = e.what() ;
+        num_failures++ ;
+        return false ;
+    }
+    std::lock_guard<std::mutex> lock(mutex) ;
+    last_epoch = snapshot->get_epoch() ;
+    num_checkpoints++ ;
+    return true ;
+}
+
+template <class Sketch>
+std::string AsyncCheckpointer<Sketch>::get_last_error() const {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    return last_error ;
+}
+
+template <class Sketch>
+std::vector<std::string> AsyncCheckpointer<Sketch>::list_checkpoints() const {
+    std::vector<std::string> names ;
+    DIR *dir = opendir(config.directory.c_str()) ;
+    if(dir == nullptr){
+        return names ;
+    }
+    while(dirent *entry = readdir(dir)){
+        std::string name = entry->d_name ;
+        if(is_checkpoint_name(name, config.prefix)){
+            names.push_back(name) ;
+        }
+    }
+    closedir(dir) ;
+    std::sort(names.begin(), names.end()) ;
+    for(std::string &name : names){
+        name = config.directory + "/" + name ;
+    }
+    return names ;
+}
+
+template <class Sketch>
+void AsyncCheckpointer<Sketch>::prune() const {
+    std::vector<std::string> paths = list_checkpoints() ;
+    for(size_t k=0; k + config.retain < paths.size(); k++){
+        unlink(paths[k].c_str()) ;
+    }
+}
+
+template class AsyncCheckpointer<BasicSnapshotCountMinSketch<MultiplyShiftHash> > ;
+template class AsyncCheckpointer<BasicSnapshotCountMinSketch<MersennePrimeHash> > ;
+template class AsyncCheckpointer<BasicSnapshotCountMinSketch<TabulationHash> > ;
+template class AsyncCheckpointer<BasicSnapshotCountMinSketch<DoubleHash> > ;
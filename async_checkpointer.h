@@ -0,0 +1,64 @@
+//
+// Background checkpointing of a snapshot CountMin sketch to disk.
+// A thread wakes every interval, takes the sketch's latest published snapshot (see snapshot_count_min_sketch.h)
+// and, if it is newer than the last checkpoint, serializes it to <directory>/<prefix>-<epoch>.lscm. The file is
+// written under a temporary name, fsync'd and renamed into place, so a checkpoint on disk is always complete.
+// Only the newest `retain` checkpoints are kept. The ingest thread never waits on I/O: it only publishes a
+// snapshot on its next update after the checkpointer asks for one.
+//
+
+#ifndef LINEARSKETCHES_ASYNC_CHECKPOINTER_H
+#define LINEARSKETCHES_ASYNC_CHECKPOINTER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CheckpointConfig {
+    std::string directory ;
+    std::string prefix = "sketch" ;
+    std::chrono::milliseconds interval = std::chrono::milliseconds(60 * 1000) ;
+    size_t retain = 3 ; // number of checkpoints kept on disk, at least 1
+};
+
+template <class Sketch>
+class AsyncCheckpointer {
+public:
+    AsyncCheckpointer(Sketch &sketch, CheckpointConfig config) ; // starts the background thread
+    ~AsyncCheckpointer() ; // stops the thread, see stop
+    AsyncCheckpointer(const AsyncCheckpointer&) = delete ;
+    AsyncCheckpointer& operator=(const AsyncCheckpointer&) = delete ;
+
+    void stop() ; // wakes the thread, lets it finish any checkpoint in progress and joins it
+    bool checkpoint_now() ; // writes the latest snapshot from the calling thread, false if it was already on disk
+
+    // Getters
+    uint64_t get_num_checkpoints() const { return num_checkpoints.load() ; }
+    uint64_t get_num_failures() const { return num_failures.load() ; }
+    std::string get_last_error() const ;
+    std::vector<std::string> list_checkpoints() const ; // full paths, oldest first
+
+private:
+    Sketch &sketch ;
+    CheckpointConfig config ;
+    std::thread worker ;
+    mutable std::mutex mutex ; // guards stopping, last_error and last_epoch
+    std::mutex write_mutex ; // held for a whole write_latest, so checkpoint_now and the worker never write or prune at once
+    std::condition_variable wake ;
+    bool stopping = false ;
+    uint64_t last_epoch = 0 ;
+    std::string last_error ;
+    std::atomic<uint64_t> num_checkpoints ;
+    std::atomic<uint64_t> num_failures ;
+
+    void run() ;
+    bool write_latest() ;
+    void prune() const ;
+};
+
+#endif //LINEARSKETCHES_ASYNC_CHECKPOINTER_H
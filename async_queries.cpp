@@ -0,0 +1,153 @@
+//
+// Asynchronous point queries answered in coalesced batches by a query thread pool.
+//
+#include <memory>
+#include <stdexcept>
+#include "async_queries.h"
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "ingest_queue.h"
+
+template <class Sketch>
+AsyncQueryService<Sketch>::AsyncQueryService(Sketch &sketch, const AsyncQueryOptions &options):
+    sketch(sketch), options(options), num_requests(0), num_batches(0){
+    if(options.threads == 0 || options.max_batch == 0){
+        throw std::invalid_argument( "Query threads and batch size must be positive." );
+    }
+    for(unsigned t=0; t < options.threads; t++){
+        workers.emplace_back(&AsyncQueryService::run, this) ;
+    }
+}
+
+template <class Sketch>
+AsyncQueryService<Sketch>::~AsyncQueryService(){
+    {
+        std::lock_guard<std::mutex> lock(mutex) ;
+        stopping = true ;
+    }
+    ready.notify_all() ;
+    for(std::thread &worker : workers){
+        worker.join() ;
+    }
+}
+
+template <class Sketch>
+void AsyncQueryService<Sketch>::get_estimates(const uint64_t *items, size_t n, QueryCallback callback){
+    Request request ;
+    request.items.assign(items, items + n) ;
+    request.callback = std::move(callback) ;
+    request.arrival = std::chrono::steady_clock::now() ;
+    {
+        std::lock_guard<std::mutex> lock(mutex) ;
+        if(stopping){
+            throw std::logic_error( "Query service is shutting down." );
+        }
+        pending_items += n ;
+        pending.push_back(std::move(request)) ;
+    }
+    num_requests.fetch_add(1) ;
+    ready.notify_one() ;
+}
+
+template <class Sketch>
+std::future<std::vector<int64_t> > AsyncQueryService<Sketch>::get_estimates(const uint64_t *items, size_t n){
+    std::shared_ptr<std::promise<std::vector<int64_t> > > promise(new std::promise<std::vector<int64_t> >()) ;
+    std::future<std::vector<int64_t> > future = promise->get_future() ;
+    get_estimates(items, n, [promise](const int64_t *estimates, size_t len, std::exception_ptr error){
+        if(estimates != nullptr){
+            promise->set_value(std::vector<int64_t>(estimates, estimates + len)) ;
+        } else {
+            promise->set_exception(error) ;
+        }
+    }) ;
+    return future ;
+}
+
+template <class Sketch>
+std::future<int64_t> AsyncQueryService<Sketch>::get_estimate(uint64_t item){
+    std::shared_ptr<std::promise<int64_t> > promise(new std::promise<int64_t>()) ;
+    std::future<int64_t> future = promise->get_future() ;
+    get_estimates(&item, 1, [promise](const int64_t *estimates, size_t, std::exception_ptr error){
+        if(estimates != nullptr){
+            promise->set_value(estimates[0]) ;
+        } else {
+            promise->set_exception(error) ;
+        }
+    }) ;
+    return future ;
+}
+
+template <class Sketch>
+void AsyncQueryService<Sketch>::run(){
+    /*
+     * A worker holding the lock either sleeps until the batch fills or the oldest request's deadline passes, or
+     * takes whole requests from the front of the queue up to max_batch keys. A single request larger than
+     * max_batch is taken on its own. Any leftover requests are passed to another worker before answering.
+     */
+    std::vector<uint64_t> keys ;
+    std::vector<int64_t> estimates ;
+    std::unique_lock<std::mutex> lock(mutex) ;
+    while(true){
+        if(pending.empty()){
+            if(stopping){
+                return ;
+            }
+            ready.wait(lock) ;
+            continue ;
+        }
+        const std::chrono::steady_clock::time_point due = pending.front().arrival + options.deadline ;
+        if(pending_items < options.max_batch && !stopping && std::chrono::steady_clock::now() < due){
+            ready.wait_until(lock, due) ;
+            continue ;
+        }
+        std::vector<Request> batch ;
+        size_t num_items = 0 ;
+        while(!pending.empty() && (batch.empty() || num_items + pending.front().items.size() <= options.max_batch)){
+            num_items += pending.front().items.size() ;
+            batch.push_back(std::move(pending.front())) ;
+            pending.pop_front() ;
+        }
+        pending_items -= num_items ;
+        if(!pending.empty()){
+            ready.notify_one() ;
+        }
+        lock.unlock() ;
+        answer(batch, num_items, keys, estimates) ;
+        lock.lock() ;
+    }
+}
+
+template <class Sketch>
+void AsyncQueryService<Sketch>::answer(std::vector<Request> &batch, size_t num_items, std::vector<uint64_t> &keys,
+                                       std::vector<int64_t> &estimates){
+    const uint64_t *batch_keys = batch[0].items.data() ;
+    if(batch.size() > 1){
+        keys.clear() ;
+        for(const Request &request : batch){
+            keys.insert(keys.end(), request.items.begin(), request.items.end()) ;
+        }
+        batch_keys = keys.data() ;
+    }
+    estimates.resize(num_items) ;
+    std::exception_ptr error ;
+    try {
+        sketch.get_estimates(batch_keys, num_items, estimates.data()) ;
+    } catch(...){
+        error = std::current_exception() ;
+    }
+    num_batches.fetch_add(1) ;
+    size_t offset = 0 ;
+    for(Request &request : batch){
+        request.callback(error ? nullptr : estimates.data() + offset, request.items.size(), error) ;
+        offset += request.items.size() ;
+    }
+}
+
+template class AsyncQueryService<CountMinSketch> ;
+template class AsyncQueryService<MultiplyShiftCountMinSketch> ;
+template class AsyncQueryService<TabulationCountMinSketch> ;
+template class AsyncQueryService<DoubleHashCountMinSketch> ;
+template class AsyncQueryService<BlockedCountMinSketch8> ;
+template class AsyncQueryService<BlockedCountMinSketch16> ;
+template class AsyncQueryService<BlockedCountMinSketch32> ;
+template class AsyncQueryService<IngestQueue<CountMinSketch> > ;
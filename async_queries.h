@@ -0,0 +1,117 @@
+//
+// Asynchronous point queries for callers that must not block, such as RPC handlers.
+// Requests are queued and answered by a small pool of query threads. A worker waits until the queued requests
+// add up to max_batch items or the oldest one has waited for the deadline, then takes whole requests up to
+// max_batch items, answers them with one get_estimates call over the combined keys (the batched path that hashes
+// a chunk of keys at a time before touching the table) and hands each request its slice of the results.
+// Many small concurrent requests are thereby coalesced into a few large batches.
+//
+// Results are delivered through a std::future or a completion callback, and with LINEARSKETCHES_COROUTINES
+// (which needs C++20) also as an awaitable. Callbacks and resumed coroutines run on a query thread and must not
+// throw.
+//
+// Workers only read the sketch, so it must not be updated concurrently unless it synchronises its own queries,
+// as IngestQueue does. Queries on a lazily reset sketch stay reads: stale blocks count as zero and are left
+// for the next update to clear.
+//
+
+#ifndef LINEARSKETCHES_ASYNC_QUERIES_H
+#define LINEARSKETCHES_ASYNC_QUERIES_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef LINEARSKETCHES_COROUTINES
+#include <coroutine>
+#endif
+
+struct AsyncQueryOptions {
+    unsigned threads = 1 ;
+    size_t max_batch = 4096 ; // most keys answered by one get_estimates call, unless a single request is larger
+    std::chrono::microseconds deadline = std::chrono::microseconds(200) ; // longest a request waits to be coalesced
+};
+
+// Called with the estimates for the request's keys, or with estimates == nullptr and the exception if it failed.
+typedef std::function<void(const int64_t *estimates, size_t n, std::exception_ptr error)> QueryCallback ;
+
+template <class Sketch>
+class AsyncQueryService {
+public:
+    AsyncQueryService(Sketch &sketch, const AsyncQueryOptions &options) ; // starts the query threads
+    ~AsyncQueryService() ; // answers every queued request, then joins the threads
+    AsyncQueryService(const AsyncQueryService&) = delete ;
+    AsyncQueryService& operator=(const AsyncQueryService&) = delete ;
+
+    // The keys are copied, so the caller's array may be reused as soon as these return.
+    std::future<int64_t> get_estimate(uint64_t item) ;
+    std::future<std::vector<int64_t> > get_estimates(const uint64_t *items, size_t n) ;
+    void get_estimates(const uint64_t *items, size_t n, QueryCallback callback) ;
+
+    uint64_t get_num_requests() const { return num_requests.load() ; }
+    uint64_t get_num_batches() const { return num_batches.load() ; } // get_estimates calls made on the sketch
+
+#ifdef LINEARSKETCHES_COROUTINES
+    class EstimateAwaitable {
+    public:
+        EstimateAwaitable(AsyncQueryService &service, uint64_t item) : service(service), item(item) {}
+        bool await_ready() const noexcept { return false ; }
+        void await_suspend(std::coroutine_handle<> handle){
+            // Nothing may touch this object once the request is queued, since the coroutine can resume at once.
+            service.get_estimates(&item, 1, [this, handle](const int64_t *estimates, size_t, std::exception_ptr failure){
+                if(estimates != nullptr){
+                    result = estimates[0] ;
+                } else {
+                    error = failure ;
+                }
+                handle.resume() ;
+            }) ;
+        }
+        int64_t await_resume(){
+            if(error){
+                std::rethrow_exception(error) ;
+            }
+            return result ;
+        }
+
+    private:
+        AsyncQueryService &service ;
+        uint64_t item ;
+        int64_t result = 0 ;
+        std::exception_ptr error ;
+    };
+
+    EstimateAwaitable co_get_estimate(uint64_t item){ return EstimateAwaitable(*this, item) ; } // resumes on a query thread
+#endif
+
+private:
+    struct Request {
+        std::vector<uint64_t> items ;
+        QueryCallback callback ;
+        std::chrono::steady_clock::time_point arrival ;
+    };
+
+    Sketch &sketch ;
+    AsyncQueryOptions options ;
+    std::mutex mutex ; // guards pending, pending_items and stopping
+    std::condition_variable ready ;
+    std::deque<Request> pending ;
+    size_t pending_items = 0 ;
+    bool stopping = false ;
+    std::atomic<uint64_t> num_requests ;
+    std::atomic<uint64_t> num_batches ;
+    std::vector<std::thread> workers ;
+
+    void run() ;
+    void answer(std::vector<Request> &batch, size_t num_items, std::vector<uint64_t> &keys, std::vector<int64_t> &estimates) ;
+};
+
+#endif //LINEARSKETCHES_ASYNC_QUERIES_H
@@ -0,0 +1,167 @@
+//
+// Benchmark harness for the sketch kernels.
+// Runs update, get_estimate and merge on CountMin tables sized to fit in L1, L2 and the last level cache and
+// to spill well into DRAM, and reports wall time together with hardware counters (see perf_counters.h) per
+// operation. For merge an operation is one counter of the table, for the others one item.
+// The parallel ingest strategies (see parallel_update.h) are compared on the same keys: a serial update_batch,
+// per-thread replicas merged at the end, and rows partitioned among the threads. Hardware counters only cover
+// the calling thread, so those rows report time alone. The hashed row is update_batch_hashed on the same keys
+// treated as pre-computed hashes, i.e. the batch path without the item hash.
+//
+// Usage: LinearSketchesBenchmark [num_ops]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "count_min_sketch.h"
+#include "parallel_update.h"
+#include "perf_counters.h"
+#include "stream_generators.h"
+
+namespace {
+    const uint64_t bench_num_hashes = 4 ;
+
+    struct TableSize {
+        std::string level ;
+        uint64_t bytes ;
+    };
+
+    uint64_t cache_bytes(int name, uint64_t fallback){
+        long bytes = sysconf(name) ;
+        return (bytes > 0) ? uint64_t(bytes) : fallback ;
+    }
+
+    std::vector<TableSize> table_sizes(){
+        /*
+         * Half of each cache level so the table stays resident alongside the keys being streamed through,
+         * and four times the last level cache (at least 256MB) for DRAM.
+         */
+        uint64_t l1 = cache_bytes(_SC_LEVEL1_DCACHE_SIZE, 32 << 10) ;
+        uint64_t l2 = cache_bytes(_SC_LEVEL2_CACHE_SIZE, 1 << 20) ;
+        uint64_t llc = cache_bytes(_SC_LEVEL3_CACHE_SIZE, l2 * 16) ;
+        return {{"L1", l1 / 2}, {"L2", l2 / 2}, {"LLC", llc / 2}, {"DRAM", std::max<uint64_t>(4 * llc, uint64_t(256) << 20)}} ;
+    }
+
+    struct Measurement {
+        double seconds ;
+        PerfReading counters ;
+    };
+
+    template <class Body>
+    Measurement measure(PerfCounters &perf, Body body){
+        auto begin = std::chrono::steady_clock::now() ;
+        perf.start() ;
+        body() ;
+        PerfReading counters = perf.stop() ;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() ;
+        return {seconds, counters} ;
+    }
+
+    void print_header(){
+        std::printf("%-5s %10s %-8s %10s", "level", "table_KB", "op", "ns/op") ;
+        std::printf(" %8s %8s %6s", "cyc/op", "ins/op", "IPC") ;
+        for(int e=PERF_BRANCH_MISSES; e < num_perf_events; e++){
+            std::printf(" %12s", PerfCounters::event_name(PerfEvent(e))) ;
+        }
+        std::printf("\n") ;
+    }
+
+    void print_row(const TableSize &size, const char *op, const Measurement &m, double num_ops){
+        std::printf("%-5s %10llu %-8s %10.2f", size.level.c_str(), (unsigned long long)(size.bytes >> 10), op, 1e9 * m.seconds / num_ops) ;
+        const PerfReading &c = m.counters ;
+        if(c.available[PERF_CYCLES]) std::printf(" %8.2f", c.values[PERF_CYCLES] / num_ops) ; else std::printf(" %8s", "n/a") ;
+        if(c.available[PERF_INSTRUCTIONS]) std::printf(" %8.2f", c.values[PERF_INSTRUCTIONS] / num_ops) ; else std::printf(" %8s", "n/a") ;
+        if(c.available[PERF_CYCLES] && c.available[PERF_INSTRUCTIONS] && c.values[PERF_CYCLES] > 0){
+            std::printf(" %6.2f", c.values[PERF_INSTRUCTIONS] / c.values[PERF_CYCLES]) ;
+        } else {
+            std::printf(" %6s", "n/a") ;
+        }
+        for(int e=PERF_BRANCH_MISSES; e < num_perf_events; e++){
+            if(c.available[e]) std::printf(" %12.4f", c.values[e] / num_ops) ; else std::printf(" %12s", "n/a") ;
+        }
+        std::printf("\n") ;
+    }
+
+    void run_size(PerfCounters &perf, const TableSize &size, const std::vector<uint64_t> &keys){
+        /*
+         * The first pass of updates touches every page of the table so the measured passes see no page faults.
+         */
+        uint64_t num_buckets = std::max<uint64_t>(16, size.bytes / (bench_num_hashes * sizeof(int64_t))) ;
+        CountMinSketch sketch(bench_num_hashes, num_buckets, 1) ;
+        CountMinSketch other(bench_num_hashes, num_buckets, 1) ;
+        for(uint64_t key : keys){
+            sketch.update(key) ;
+        }
+        other.update(1) ;
+
+        Measurement update = measure(perf, [&](){
+            for(uint64_t key : keys){
+                sketch.update(key) ;
+            }
+        }) ;
+        print_row(size, "update", update, double(keys.size())) ;
+
+        int64_t sink = 0 ;
+        Measurement query = measure(perf, [&](){
+            for(uint64_t key : keys){
+                sink += sketch.get_estimate(key) ;
+            }
+        }) ;
+        print_row(size, "query", query, double(keys.size())) ;
+
+        uint64_t counters = bench_num_hashes * num_buckets ;
+        uint64_t reps = std::max<uint64_t>(1, (uint64_t(1) << 28) / counters) ;
+        Measurement merge = measure(perf, [&](){
+            for(uint64_t r=0; r < reps; r++){
+                sketch.merge(other) ;
+            }
+        }) ;
+        print_row(size, "merge", merge, double(counters * reps)) ;
+
+        const unsigned threads = std::max(1u, std::thread::hardware_concurrency()) ;
+        const struct { const char *op ; ParallelStrategy strategy ; } strategies[] = {
+            {"batch", PARALLEL_SERIAL}, {"sharded", PARALLEL_SHARDED}, {"rows", PARALLEL_ROWS}} ;
+        for(const auto &s : strategies){
+            Measurement parallel = measure(perf, [&](){
+                parallel_update(sketch, keys.data(), nullptr, keys.size(), threads, s.strategy) ;
+            }) ;
+            parallel.counters = PerfReading() ;
+            print_row(size, s.op, parallel, double(keys.size())) ;
+        }
+
+        {
+            CountMinSketch prehashed(bench_num_hashes, num_buckets, 1) ;
+            prehashed.enable_prehashed_keys() ;
+            prehashed.update_batch_hashed(keys.data(), nullptr, keys.size()) ;
+            Measurement hashed = measure(perf, [&](){
+                prehashed.update_batch_hashed(keys.data(), nullptr, keys.size()) ;
+            }) ;
+            print_row(size, "hashed", hashed, double(keys.size())) ;
+        }
+        if(sink == 42){
+            std::printf("\n") ; // keeps the queries from being optimised away
+        }
+    }
+}
+
+int main(int argc, char **argv){
+    uint64_t num_ops = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : uint64_t(1) << 22 ;
+    std::vector<uint64_t> keys(num_ops) ;
+    UniformGenerator(uint64_t(1) << 62, 2022).fill(keys.data(), keys.size()) ;
+
+    PerfCounters perf ;
+    if(!perf.any_available()){
+        std::printf("# hardware counters unavailable (check /proc/sys/kernel/perf_event_paranoid), reporting time only\n") ;
+    }
+    print_header() ;
+    for(const TableSize &size : table_sizes()){
+        run_size(perf, size, keys) ;
+    }
+    return 0 ;
+}
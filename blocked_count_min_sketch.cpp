@@ -0,0 +1,239 @@
+//
+// Cache-line-blocked CountMin sketch.
+//
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "blocked_count_min_sketch.h"
+
+template <class Counter>
+const uint64_t BlockedCountMinSketch<Counter>::block_bytes ;
+template <class Counter>
+const uint64_t BlockedCountMinSketch<Counter>::counters_per_block ;
+template <class Counter>
+const int64_t BlockedCountMinSketch<Counter>::counter_max = int64_t(std::numeric_limits<Counter>::max()) ;
+
+template <class Counter>
+BlockedCountMinSketch<Counter>::BlockedCountMinSketch(uint64_t num_hashes, uint64_t num_blocks, uint64_t seed):
+    num_hashes(num_hashes), num_blocks(num_blocks), seed(seed),
+    segment_width(segment_width_for(num_hashes)), hashes(num_hashes, num_blocks, seed),
+    storage(num_blocks * sizeof(Block)), blocks(static_cast<Block*>(storage.data())){
+    /*
+     * Error analysis for the blocked layout. Write N for the total weight, B = num_blocks, w = segment_width
+     * and d = num_hashes. Let L be the weight of the other items that land in the item's block, so E[L] <= N/B.
+     * Given L the d counters of the item are independent and each has expected error at most L/w, hence
+     *      P(every counter exceeds eps*N) <= P(L > k*N/B) + (k / (B*w*eps))^d <= 1/k + (k / (B*w*eps))^d
+     * by Markov's inequality applied twice. Taking eps = e*k/(B*w) and k = e^(d/2) gives
+     *      epsilon = e^(1 + d/2) / (B*w),    delta = e^(-d/2) + e^(-d).
+     * The bound is distribution free and so pessimistic; on non-adversarial streams L concentrates around N/B
+     * and the observed error is close to that of an unblocked sketch with rows of B*w buckets.
+     */
+    if(num_blocks == 0){
+        throw std::invalid_argument( "Number of blocks must be positive." );
+    }
+    segment_bits = 0 ;
+    while((uint64_t(1) << segment_bits) < segment_width){
+        segment_bits++ ;
+    }
+    float d = float(num_hashes) ;
+    epsilon = exp(1.0 + d / 2.0) / (float(num_blocks) * float(segment_width)) ;
+    delta = exp(-d / 2.0) + exp(-d) ;
+    confidence = 1.0 - delta ;
+}
+
+template <class Counter>
+BlockedCountMinSketch<Counter>::BlockedCountMinSketch(const BlockedCountMinSketch &sketch):
+    num_hashes(sketch.num_hashes), num_blocks(sketch.num_blocks), seed(sketch.seed),
+    segment_width(sketch.segment_width), segment_bits(sketch.segment_bits), hashes(sketch.hashes),
+    storage(sketch.storage), blocks(static_cast<Block*>(storage.data())), total_weight(sketch.total_weight),
+    epsilon(sketch.epsilon), delta(sketch.delta), confidence(sketch.confidence){
+}
+
+template <class Counter>
+std::unique_ptr<BlockedCountMinSketch<Counter> > BlockedCountMinSketch<Counter>::make_empty() const {
+    return std::unique_ptr<BlockedCountMinSketch>(new BlockedCountMinSketch(num_hashes, num_blocks, seed)) ;
+}
+
+template <class Counter>
+void BlockedCountMinSketch<Counter>::reset(){
+    storage.zero() ;
+    total_weight = 0 ;
+}
+
+template <class Counter>
+uint64_t BlockedCountMinSketch<Counter>::segment_width_for(uint64_t num_hashes){
+    /*
+     * Each row owns a power-of-two segment of the block so that its counter can be chosen by a bit slice of
+     * the hash. Counters left over when counters_per_block / num_hashes is not a power of two are unused.
+     */
+    if(num_hashes == 0 || num_hashes > counters_per_block){
+        throw std::invalid_argument( "Number of hashes must be between 1 and the number of counters per block." );
+    }
+    uint64_t width = 1 ;
+    while(2 * width * num_hashes <= counters_per_block){
+        width *= 2 ;
+    }
+    return width ;
+}
+
+template <class Counter>
+std::vector<uint64_t> BlockedCountMinSketch<Counter>::get_config() const {
+    /*
+     * {num_hashes, num_blocks, seed, counter bytes}
+     */
+    return {num_hashes, num_blocks, seed, sizeof(Counter)} ;
+}
+
+template <class Counter>
+void BlockedCountMinSketch<Counter>::update(uint64_t item, int64_t weight){
+    /*
+     * One block is touched per update: the segment of row i starts at i * segment_width and the
+     * i-th slice of the hash picks the counter within it.
+     */
+    if(weight < 0){
+        throw std::invalid_argument( "Weight must be nonnegative." );
+    }
+    uint64_t b, slices ;
+    locate(item, b, slices) ;
+    Counter *counters = blocks[b].counters ;
+    const uint64_t mask = segment_width - 1 ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        saturating_add(counters[i * segment_width + ((slices >> (i * segment_bits)) & mask)], weight) ;
+    }
+    total_weight += weight ;
+}
+
+template <class Counter>
+void BlockedCountMinSketch<Counter>::update_batch(const uint64_t *items, const int64_t *weights, size_t n){
+    /*
+     * Hashes a short window ahead and prefetches the blocks so the misses of neighbouring items overlap.
+     */
+    const size_t window = 16 ;
+    uint64_t block_of[window], slices_of[window] ;
+    const uint64_t mask = segment_width - 1 ;
+    for(size_t start=0; start < n; start += window){
+        size_t len = std::min(window, n - start) ;
+        for(size_t k=0; k < len; k++){
+            if(weights != nullptr && weights[start + k] < 0){
+                throw std::invalid_argument( "Weight must be nonnegative." );
+            }
+            locate(items[start + k], block_of[k], slices_of[k]) ;
+            __builtin_prefetch(&blocks[block_of[k]], 1) ;
+        }
+        for(size_t k=0; k < len; k++){
+            int64_t weight = (weights == nullptr) ? 1 : weights[start + k] ;
+            Counter *counters = blocks[block_of[k]].counters ;
+            for(uint64_t i=0; i < num_hashes; i++){
+                saturating_add(counters[i * segment_width + ((slices_of[k] >> (i * segment_bits)) & mask)], weight) ;
+            }
+            total_weight += weight ;
+        }
+    }
+}
+
+template <class Counter>
+int64_t BlockedCountMinSketch<Counter>::get_estimate(uint64_t item) const {
+    /*
+     * Minimum over the item's counters in its block.
+     * If that minimum is saturated the true frequency may be larger, see is_saturated.
+     */
+    uint64_t b, slices ;
+    locate(item, b, slices) ;
+    const Counter *counters = blocks[b].counters ;
+    const uint64_t mask = segment_width - 1 ;
+    int64_t estimate = counter_max ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        estimate = std::min(estimate, int64_t(counters[i * segment_width + ((slices >> (i * segment_bits)) & mask)])) ;
+    }
+    return estimate ;
+}
+
+template <class Counter>
+void BlockedCountMinSketch<Counter>::get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const {
+    const size_t window = 16 ;
+    uint64_t block_of[window], slices_of[window] ;
+    const uint64_t mask = segment_width - 1 ;
+    for(size_t start=0; start < n; start += window){
+        size_t len = std::min(window, n - start) ;
+        for(size_t k=0; k < len; k++){
+            locate(items[start + k], block_of[k], slices_of[k]) ;
+            __builtin_prefetch(&blocks[block_of[k]], 0) ;
+        }
+        for(size_t k=0; k < len; k++){
+            const Counter *counters = blocks[block_of[k]].counters ;
+            int64_t estimate = counter_max ;
+            for(uint64_t i=0; i < num_hashes; i++){
+                estimate = std::min(estimate, int64_t(counters[i * segment_width + ((slices_of[k] >> (i * segment_bits)) & mask)])) ;
+            }
+            estimates[start + k] = estimate ;
+        }
+    }
+}
+
+template <class Counter>
+int64_t BlockedCountMinSketch<Counter>::get_upper_bound(uint64_t item) const {
+    /*
+     * f_i <= est(f_i) unless the counters saturated, in which case nothing is known above.
+     */
+    int64_t estimate = get_estimate(item) ;
+    return (estimate == counter_max) ? std::numeric_limits<int64_t>::max() : estimate ;
+}
+
+template <class Counter>
+int64_t BlockedCountMinSketch<Counter>::get_lower_bound(uint64_t item) const {
+    /*
+     * f_i >= est(f_i) - epsilon*||f||_1 with probability at least 1 - delta (blocked analysis above).
+     */
+    return get_estimate(item) - epsilon*total_weight ;
+}
+
+template <class Counter>
+uint64_t BlockedCountMinSketch<Counter>::suggest_num_blocks(float relative_error, uint64_t num_hashes){
+    /*
+     * Inverts epsilon = e^(1 + d/2) / (B*w) for the number of blocks B.
+     */
+    if(relative_error <= 0.){
+        throw std::invalid_argument( "Relative error must be positive." );
+    }
+    float d = float(num_hashes) ;
+    return ceil(exp(1.0 + d / 2.0) / (relative_error * float(segment_width_for(num_hashes)))) ;
+}
+
+template <class Counter>
+uint64_t BlockedCountMinSketch<Counter>::suggest_num_hashes(float confidence){
+    /*
+     * delta = e^(-d/2) + e^(-d) <= 2e^(-d/2) so d = 2 ln(2 / (1 - confidence)) hashes suffice.
+     */
+    if(confidence < 0. || confidence >= 1.0){
+        throw std::invalid_argument( "Confidence must be between 0 and 1.0 (exclusive)." );
+    }
+    uint64_t d = ceil(2.0 * log(2.0 / (1.0 - confidence))) ;
+    if(d > counters_per_block){
+        throw std::invalid_argument( "Confidence needs more counters than fit in a block." );
+    }
+    return std::max<uint64_t>(d, 1) ;
+}
+
+template <class Counter>
+void BlockedCountMinSketch<Counter>::merge(const BlockedCountMinSketch &sketch){
+    /*
+     * Merges that sketch into this one by saturating elementwise sums of counters.
+     */
+    if(this == &sketch){
+        throw std::invalid_argument( "Cannot merge a sketch with itself." );
+    }
+    if(get_config() != sketch.get_config()){
+        throw std::invalid_argument( "Incompatible sketch config." );
+    }
+    for(uint64_t b=0; b < num_blocks; b++){
+        for(uint64_t c=0; c < counters_per_block; c++){
+            saturating_add(blocks[b].counters[c], sketch.blocks[b].counters[c]) ;
+        }
+    }
+    total_weight += sketch.total_weight ;
+}
+
+template class BlockedCountMinSketch<uint8_t> ;
+template class BlockedCountMinSketch<uint16_t> ;
+template class BlockedCountMinSketch<uint32_t> ;
@@ -0,0 +1,96 @@
+//
+// Cache-line-blocked CountMin sketch.
+// The table is an array of 64-byte blocks. The first half of an item's 128-bit hash picks one block and
+// every one of the item's num_hashes counters sits inside that block, so an update or a query costs a single
+// cache miss instead of one per row. Each block is split into num_hashes segments (one per row) of
+// segment_width counters and slices of the second half of the hash pick the counter in each segment.
+//
+// Counters are small unsigned integers (8, 16 or 32 bits) which saturate instead of wrapping, so this
+// variant is strictly cash register: weights must be nonnegative.
+//
+
+#ifndef LINEARSKETCHES_BLOCKED_COUNT_MIN_SKETCH_H
+#define LINEARSKETCHES_BLOCKED_COUNT_MIN_SKETCH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "hash_families.h"
+#include "sketch_metrics.h"
+#include "sketch_table.h"
+
+template <class Counter>
+class BlockedCountMinSketch {
+public:
+    static const uint64_t block_bytes = 64 ;
+    static const uint64_t counters_per_block = block_bytes / sizeof(Counter) ;
+
+    BlockedCountMinSketch(uint64_t num_hashes, uint64_t num_blocks, uint64_t seed) ;
+    BlockedCountMinSketch(const BlockedCountMinSketch &sketch) ;
+    BlockedCountMinSketch& operator=(const BlockedCountMinSketch &sketch) = delete ;
+    std::unique_ptr<BlockedCountMinSketch> make_empty() const ; // zeroed sketch with the same config, for shards
+    void update(uint64_t item, int64_t weight=1) ;
+    void update_batch(const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr for unit weights
+
+    // Getters
+    uint64_t get_num_hashes() const { return num_hashes ; }
+    uint64_t get_num_blocks() const { return num_blocks ; }
+    uint64_t get_seed() const { return seed ; }
+    uint64_t get_segment_width() const { return segment_width ; }
+    std::vector<uint64_t> get_config() const ;
+    int64_t get_total_weight() const { return total_weight ; }
+    float get_epsilon() const { return epsilon ; }
+    float get_delta() const { return delta ; }
+    float get_confidence() const { return confidence ; }
+    uint64_t get_memory_bytes() const { return num_blocks * block_bytes ; }
+    TableOccupancy get_occupancy() const { return measure_occupancy(blocks[0].counters, num_blocks * counters_per_block) ; }
+    void reset() ; // Zeroes every counter and the total weight
+    bool use_huge_pages() { return storage.advise_huge_pages() ; }
+    int64_t get_estimate(uint64_t item) const ;
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const ;
+    int64_t get_upper_bound(uint64_t item) const ;
+    int64_t get_lower_bound(uint64_t item) const ;
+    bool is_saturated(uint64_t item) const { return get_estimate(item) == counter_max ; }
+
+    static uint64_t segment_width_for(uint64_t num_hashes) ;
+    static uint64_t suggest_num_blocks(float relative_error, uint64_t num_hashes) ;
+    static uint64_t suggest_num_hashes(float confidence) ;
+
+    // Merge operations
+    void merge(const BlockedCountMinSketch &sketch) ;
+
+private:
+    struct Block {
+        Counter counters[counters_per_block] ;
+    };
+    static const int64_t counter_max ;
+
+    uint64_t num_hashes, num_blocks, seed ;
+    uint64_t segment_width, segment_bits ;
+    DoubleHash hashes ;
+    ZeroedBuffer storage ; // num_blocks cache-line-aligned blocks, lazily zeroed when large
+    Block *blocks ;
+    int64_t total_weight = 0 ;
+
+    // Parameters
+    float epsilon ; // Error parameter
+    float delta ; // failure probability parameter
+    float confidence ;
+
+    void locate(uint64_t item, uint64_t &block, uint64_t &slices) const {
+        uint64_t h1, h2 ;
+        hashes.hash128(item, h1, h2) ;
+        block = reduce_to_range(h1, num_blocks) ;
+        slices = h2 >> 1 ; // hash128 forces the low bit of h2 to one, which would leave row 0 on odd offsets only
+    }
+    static void saturating_add(Counter &c, int64_t weight){
+        uint64_t sum = uint64_t(c) + uint64_t(weight) ;
+        c = (weight >= counter_max || sum > uint64_t(counter_max)) ? Counter(counter_max) : Counter(sum) ;
+    }
+};
+
+typedef BlockedCountMinSketch<uint8_t> BlockedCountMinSketch8 ;
+typedef BlockedCountMinSketch<uint16_t> BlockedCountMinSketch16 ;
+typedef BlockedCountMinSketch<uint32_t> BlockedCountMinSketch32 ;
+
+#endif //LINEARSKETCHES_BLOCKED_COUNT_MIN_SKETCH_H
@@ -5,127 +5,231 @@
 #include <cmath>
 #include <random>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 #include "count_min_sketch.h"
+#include "sketch_io.h"
+#include "sketch_metrics.h"
+
+namespace {
+    // Items are hashed in chunks of this size by the batched paths so the bucket scratch space stays in L1.
+    const size_t batch_chunk = 64 ;
+    // Items each thread of update_batch_by_rows takes through all of its rows before moving on, small enough
+    // that the slice of input stays in L1 while being read once per row.
+    const size_t row_pass_chunk = 2048 ;
+}
 
 // Constructor
-CountMinSketch::CountMinSketch(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed )
-        : CountingSketch(num_hashes, num_buckets, seed){
+template <class HashFamily>
+BasicCountMinSketch<HashFamily>::BasicCountMinSketch(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed )
+        : CountingSketch(num_hashes, num_buckets, seed), hashes(num_hashes, num_buckets, seed),
+          prehashed(num_hashes, num_buckets, seed){
     /*
      * A key assumption of the CountMinSketch is that the underlying frequency vector is always
      * at least zero as outlined in page 2 of http://dimacs.rutgers.edu/~graham/pubs/papers/cmencyc.pdf
      * This is known as the "cash register" version of data streaming algorithms.
      */
-    CountMinSketch::set_hash_parameters() ;
+    hash_family = HashFamily::family_id() ;
     epsilon = exp(1.0) / float(num_buckets) ;
     delta = 1.0 / exp(float(num_hashes)) ;
     confidence = 1.0 - delta ;
 } ;
 
-std::vector<uint64_t> CountMinSketch::get_config(){
-//std::tuple<uint64_t, uint64_t, uint64_t> CountMinSketch::get_config(){
-//    std::tuple<uint64_t, uint64_t, uint64_t> config = {
-//            get_num_hashes(),
-//            get_num_buckets(),
-//            get_seed()
-//    } ;
-    std::vector<uint64_t> config(3) ;
-    config = {get_num_hashes(), get_num_buckets(), get_seed() } ;
-    return config ;
-} ;
 
-void CountMinSketch::set_hash_parameters(){
-    /* Sets the array containing a and b parameters for hashing.
-     * a_hash_params contains all values of a for the hashing (see ::get_bucket_hash)
-     * a_hash_params contains all values of b
-     * We generate 2*num_hashes from CountingSketch::init_hash_parameters and then iterate through to get
-     * the values of a and b for the respective arrays.
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::update_batch(const uint64_t *items, const int64_t *weights, size_t n){
+    /*
+     * Updates the sketch with n items at once.
+     * Items are hashed a chunk at a time through the batched hash entry point and then applied one row
+     * at a time, so each row of the table is walked once per chunk rather than once per item.
+     * If weights is nullptr every item has weight 1.
      */
-    default_random_engine rng(seed);
-    uniform_int_distribution<uint64_t> uniform_random_ints(0, large_prime - 1);
-    a_hash_params.reserve(num_hashes) ;
-    b_hash_params.reserve(num_hashes) ;
+    check_key_mode(ITEM_KEYS) ;
+    apply_batch(hashes, items, weights, n) ;
+}
 
-    for(int i=0 ; i < num_hashes ; ++i){
-        //cout << uniform_random_ints(rng) << std::endl ;
-        a_hash_params[i] = uniform_random_ints(rng);
-        b_hash_params[i] = uniform_random_ints(rng);
+template <class HashFamily>
+template <class Buckets>
+void BasicCountMinSketch<HashFamily>::apply_batch(const Buckets &mapper, const uint64_t *keys, const int64_t *weights, size_t n){
+    SKETCH_METRICS_SCOPE(METRIC_UPDATE, n) ;
+    std::vector<uint64_t> buckets(num_hashes * batch_chunk) ;
+    for(size_t start=0; start < n; start += batch_chunk){
+        size_t len = std::min(batch_chunk, n - start) ;
+        mapper.buckets(keys + start, len, buckets.data()) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            const uint64_t *row_buckets = buckets.data() + i * len ;
+            int64_t *row = &table[i][0] ;
+            if(track_deltas || table.is_lazy_clear()){
+                for(size_t k=0; k < len; k++){
+                    note_write(i, row_buckets[k]) ;
+                }
+            }
+            for(size_t k=0; k < len; k++){
+                row[row_buckets[k]] += (weights == nullptr) ? 1 : weights[start + k] ;
+            }
+        }
+        if(weights == nullptr){
+            total_weight += len ;
+        } else {
+            for(size_t k=0; k < len; k++){
+                total_weight += weights[start + k] ;
+            }
+        }
     }
-
 }
 
-uint64_t CountMinSketch::get_bucket_hash(uint64_t item, uint64_t a, uint64_t b){
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::update_batch_by_rows(const uint64_t *items, const int64_t *weights, size_t n, unsigned threads){
     /*
-     * Performs bucket hashing, that is, for a given item and a given row in the sketch,
-     * this function selects the bucket, meaning the column index of the sketch table.
-     *
-     * h = (a * x + b) % large_prime
-     * h = h % nbuckets
-     * This is executed once for each of the hash functions
+     * Every thread scans the whole batch but updates only the rows it owns, so no counter is shared and there
+     * are no atomics and no replicas to merge. Families that compute each row separately are evaluated per row
+     * with bucket(row, item), reading only the owned rows' parameters. Families whose rows all come from one
+     * hash of the item compute it once per item and thread, so DoubleHash keeps its O(1) hashing per item.
+     * With lazy clearing or delta tracking each thread prepares and marks the blocks of its own rows as it goes;
+     * only the blocks shared by two rows are handled up front.
      */
-    return uint64_t ((a * item + b) % large_prime) % num_buckets ;
+    check_key_mode(ITEM_KEYS) ;
+    SKETCH_METRICS_SCOPE(METRIC_UPDATE, n) ;
+    threads = unsigned(std::max<uint64_t>(1, std::min<uint64_t>(threads, num_hashes))) ;
+    const bool noting = track_deltas || table.is_lazy_clear() ;
+    if(noting){
+        note_row_boundaries() ;
+    }
+    std::vector<WriteLog> logs(threads) ;
+    auto work = [&](unsigned t){
+        WriteLog &log = logs[t] ;
+        RowBuckets buckets(num_hashes) ;
+        for(size_t start=0; start < n; start += row_pass_chunk){
+            size_t len = std::min(row_pass_chunk, n - start) ;
+            const uint64_t *chunk_items = items + start ;
+            if(HashFamily::rows_share_hash()){
+                for(size_t k=0; k < len; k++){
+                    hashes.buckets(chunk_items[k], buckets.get()) ;
+                    int64_t weight = (weights == nullptr) ? 1 : weights[start + k] ;
+                    for(uint64_t i=t; i < num_hashes; i += threads){
+                        if(noting){
+                            note_owned_write(i, buckets[i], log) ;
+                        }
+                        table[i][buckets[i]] += weight ;
+                    }
+                }
+                continue ;
+            }
+            for(uint64_t i=t; i < num_hashes; i += threads){
+                int64_t *row = &table[i][0] ;
+                for(size_t k=0; k < len; k++){
+                    uint64_t bucket = hashes.bucket(i, chunk_items[k]) ;
+                    if(noting){
+                        note_owned_write(i, bucket, log) ;
+                    }
+                    row[bucket] += (weights == nullptr) ? 1 : weights[start + k] ;
+                }
+            }
+        }
+    } ;
+    std::vector<std::thread> workers ;
+    for(unsigned t=1; t < threads; t++){
+        workers.emplace_back(work, t) ;
+    }
+    work(0) ;
+    for(std::thread &worker : workers){
+        worker.join() ;
+    }
+    for(const WriteLog &log : logs){
+        absorb_write_log(log) ;
+    }
+    if(weights == nullptr){
+        total_weight += n ;
+    } else {
+        for(size_t k=0; k < n; k++){
+            total_weight += weights[k] ;
+        }
+    }
 }
 
-void CountMinSketch::update(int64_t item, int64_t weight){
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::get_estimates(const uint64_t *items, size_t n, int64_t *estimates) {
     /*
-     * Updates the sketch with the item
-     * iterates through the number of hash functions and gets the bucket index.
-     * Then increment the sketch table at index (row, column) where row is one of the the hash
-     * functions that are iterated over, and column is the corresponding bucket index.
-     * Finally, increment the sketch table with the weight associated to the item.
-     *
-     * TODO: We can improve the update time by removing the modulus operations as described in
-     * Section 3: http://dimacs.rutgers.edu/~graham/pubs/papers/cmsoft.pdf
+     * Batched form of get_estimate: estimates[k] is the estimate for items[k].
      */
-    if(item < 0){
-        throw std::invalid_argument( "Item must be nonnegative." );
-    }
+    check_key_mode(ITEM_KEYS) ;
+    estimate_batch(hashes, items, n, estimates) ;
+}
 
-    for(uint64_t i=0; i < num_hashes; i++){
-        uint64_t a = a_hash_params[i] ;
-        uint64_t b = b_hash_params[i] ;
-        uint64_t h = get_bucket_hash(item, a, b) ;
-        table[i][h] += weight ;
+template <class HashFamily>
+template <class Buckets>
+void BasicCountMinSketch<HashFamily>::estimate_batch(const Buckets &mapper, const uint64_t *keys, size_t n, int64_t *estimates){
+    SKETCH_METRICS_SCOPE(METRIC_QUERY, n) ;
+    std::vector<uint64_t> buckets(num_hashes * batch_chunk) ;
+    for(size_t start=0; start < n; start += batch_chunk){
+        size_t len = std::min(batch_chunk, n - start) ;
+        mapper.buckets(keys + start, len, buckets.data()) ;
+        int64_t *chunk_estimates = estimates + start ;
+        for(size_t k=0; k < len; k++){
+            chunk_estimates[k] = std::numeric_limits<int64_t>::max() ;
+        }
+        for(uint64_t i=0; i < num_hashes; i++){
+            const uint64_t *row_buckets = buckets.data() + i * len ;
+            const int64_t *row = &table[i][0] ;
+            if(table.is_lazy_clear()){
+                for(size_t k=0; k < len; k++){
+                    chunk_estimates[k] = std::min(chunk_estimates[k], read_counter(i, row_buckets[k])) ;
+                }
+                continue ;
+            }
+            for(size_t k=0; k < len; k++){
+                chunk_estimates[k] = std::min(chunk_estimates[k], row[row_buckets[k]]) ;
+            }
+        }
     }
-    total_weight += weight ;
 }
 
-int64_t CountMinSketch::get_estimate(uint64_t item) {
+template <class HashFamily>
+std::unique_ptr<BasicCountMinSketch<HashFamily> > BasicCountMinSketch<HashFamily>::make_empty() const {
     /*
-     * Returns the estimate from the sketch for the given item.
-     * TODO:  Can we explore the estimator from this paper?
-     * https://dl.acm.org/doi/10.1145/3219819.3219975
+     * Built from the config rather than copied and reset, so the table, delta baselines and epoch tags of this
+     * sketch are never copied. The key mode is set directly since the new table is known to be empty.
      */
-    int64_t estimate = std::numeric_limits<int64_t>::max() ; // start arbitrarily large
-    for(uint64_t i=0; i < num_hashes; i++){
-        uint64_t a = a_hash_params[i] ;
-        uint64_t b = b_hash_params[i] ;
-        uint64_t h = get_bucket_hash(item, a, b) ;
-        estimate = std::min(estimate, table[i][h]) ;
-    }
-    return estimate ;
+    std::unique_ptr<BasicCountMinSketch> sketch(new BasicCountMinSketch(num_hashes, num_buckets, seed)) ;
+    sketch->key_mode = key_mode ;
+    return sketch ;
 }
 
-int64_t CountMinSketch::get_upper_bound(uint64_t item) {
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::enable_prehashed_keys(){
     /*
-     * Returns the upper bound of the estimate as:
-     * f_i - true frequency
-     * est(f_i) - estimate frequency
-     * f_i <= est(f_i)
+     * Only an empty sketch may change how its keys are read, otherwise counters from both mappings would mix.
      */
-    return get_estimate(item) ;
+    if(total_weight != 0 || get_occupancy().nonzero != 0){
+        throw std::logic_error( "Key mode can only be changed on an empty sketch." );
+    }
+    key_mode = PREHASHED_KEYS ;
 }
 
-int64_t CountMinSketch::get_lower_bound(uint64_t item) {
-    /*
-     * Returns the lower bound of the estimate as:
-     * f_i - true frequency
-     * est(f_i) - estimate frequency
-     * f_i >= est(f_i) - epsilon*||f||_1 with ||f||_1 being the total weight in the sketch.
-     */
-    return get_estimate(item) - epsilon*total_weight ;
+
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::key_mode_mismatch() const {
+    throw std::invalid_argument( (key_mode == PREHASHED_KEYS) ?
+                                 "Sketch takes pre-hashed keys, use the hashed paths." :
+                                 "Sketch takes items, enable pre-hashed keys to use the hashed paths." );
+}
+
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::update_batch_hashed(const uint64_t *key_hashes, const int64_t *weights, size_t n){
+    check_key_mode(PREHASHED_KEYS) ;
+    apply_batch(prehashed, key_hashes, weights, n) ;
+}
+
+
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::get_estimates_hashed(const uint64_t *key_hashes, size_t n, int64_t *estimates){
+    check_key_mode(PREHASHED_KEYS) ;
+    estimate_batch(prehashed, key_hashes, n, estimates) ;
 }
 
-uint64_t CountMinSketch::suggest_num_buckets(float relative_error){
+
+template <class HashFamily>
+uint64_t BasicCountMinSketch<HashFamily>::suggest_num_buckets(float relative_error){
     /*
      * Function to help users select a number of buckets for a given error.
      * TODO: Change this when update is improved
@@ -136,7 +240,8 @@ uint64_t CountMinSketch::suggest_num_buckets(float relative_error){
     return ceil(exp(1.0) / relative_error) ;
 }
 
-uint64_t CountMinSketch::suggest_num_hashes(float confidence){
+template <class HashFamily>
+uint64_t BasicCountMinSketch<HashFamily>::suggest_num_hashes(float confidence){
     /*
      * Function to help users select a number of hashes for a given confidence
      * eg confidence is 1 - failure probability
@@ -149,9 +254,11 @@ uint64_t CountMinSketch::suggest_num_hashes(float confidence){
     return ceil(log(1.0/(1.0 - confidence))) ;
 }
 
-void CountMinSketch::merge(CountMinSketch &sketch){
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::merge(BasicCountMinSketch &sketch){
     /*
      * Merges this sketch into that sketch by elementwise summing of buckets
+     * The config includes the hash family so the sketches must agree on how buckets were selected.
      */
     if(this == &sketch){
         throw std::invalid_argument( "Cannot merge a sketch with itself." );
@@ -162,11 +269,66 @@ void CountMinSketch::merge(CountMinSketch &sketch){
         throw std::invalid_argument( "Incompatible sketch config." );
     }
 
-    // Iterate through the table and increment
-    for(int i=0 ; i < num_hashes; i++){
-        for(int j = -0; j < num_buckets; j++){
-            table[i][j] += sketch.table[i][j] ;
+    // The tables are flat so this is a single elementwise sum.
+    SKETCH_METRICS_SCOPE(METRIC_MERGE, 1) ;
+    // Stale blocks of the other sketch are zero and are skipped rather than cleared, so it is only read.
+    note_write_all() ;
+    int64_t *counters = table.data() ;
+    const int64_t *other = sketch.table.data() ;
+    for(uint64_t start=0 ; start < table.size(); start += SketchTable::clear_block_counters){
+        if(sketch.table.is_stale(start >> SketchTable::clear_block_shift)){
+            continue ;
+        }
+        uint64_t end = std::min(table.size(), start + SketchTable::clear_block_counters) ;
+        for(uint64_t k=start ; k < end; k++){
+            counters[k] += other[k] ;
         }
     }
     total_weight += sketch.total_weight ;
-}
\ No newline at end of file
+}
+
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::serialize(std::ostream &os){
+    /*
+     * Writes the sketch in the format described in sketch_io.h.
+     */
+    write_sketch_header(os, get_config(), total_weight) ;
+    if(!table.is_lazy_clear()){
+        write_counters(os, table.data(), table.size()) ;
+        return ;
+    }
+    std::vector<int64_t> counters(table.size()) ; // stale blocks read as zero without clearing them
+    table.read_range(0, table.size(), counters.data()) ;
+    write_counters(os, counters.data(), counters.size()) ;
+}
+
+template <class HashFamily>
+BasicCountMinSketch<HashFamily> BasicCountMinSketch<HashFamily>::deserialize(std::istream &is){
+    /*
+     * Reads a sketch written by serialize.
+     * Throws if the stream holds a sketch built with a different hash family.
+     * A fifth config entry is the key mode of a sketch that takes pre-hashed keys.
+     */
+    int64_t total_weight = 0 ;
+    std::vector<uint64_t> config = read_sketch_header(is, total_weight) ;
+    if(config.size() != 4 && !(config.size() == 5 && config[4] == PREHASHED_KEYS)){
+        throw std::invalid_argument( "Not a serialized CountMin sketch." );
+    }
+    if(config[3] != HashFamily::family_id()){
+        throw std::invalid_argument( "Incompatible hash family." );
+    }
+
+    BasicCountMinSketch sketch(config[0], config[1], config[2]) ;
+    if(config.size() == 5){
+        sketch.enable_prehashed_keys() ;
+    }
+    sketch.total_weight = total_weight ;
+    read_counters(is, sketch.table.data(), sketch.table.size()) ;
+    return sketch ;
+}
+
+// The sketch is only ever used with the families in hash_families.h.
+template class BasicCountMinSketch<MultiplyShiftHash> ;
+template class BasicCountMinSketch<MersennePrimeHash> ;
+template class BasicCountMinSketch<TabulationHash> ;
+template class BasicCountMinSketch<DoubleHash> ;
@@ -3,37 +3,178 @@
 // CountMin sketch inherits from the counting_sketch class.
 // An overview can be found at http://dimacs.rutgers.edu/~graham/pubs/papers/cmencyc.pdf
 //
+// The hash family used for bucket selection is a policy parameter (see hash_families.h).
+// CountMinSketch is the sketch with the 2-universal Mersenne prime family from the paper above.
+//
+// The single-item update and query paths are defined in this header so that code instantiated on a sketch type
+// (SampledSketch, IngestQueue, ...) can inline them; everything else lives in count_min_sketch.cpp.
+//
 
 #ifndef LINEARSKETCHES_COUNTMINSKETCH_H
 #define LINEARSKETCHES_COUNTMINSKETCH_H
 
+#include <algorithm>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
 #include "counting_sketches.h"
+#include "hash_families.h"
 
 using namespace std ;
 
-class CountMinSketch : public CountingSketch {
+template <class HashFamily>
+class BasicCountMinSketch : public CountingSketch {
     public:
-        CountMinSketch(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed)  ;
-        void update(int64_t item, int64_t weight=1) ;
+        typedef HashFamily hash_family_type ;
+
+        BasicCountMinSketch(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed)  ;
+        std::unique_ptr<BasicCountMinSketch> make_empty() const ; // zeroed sketch with the same config, for shards
+        void update(uint64_t item, int64_t weight=1) ;
+        void update_batch(const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr for unit weights
+        // Cooperative update on threads threads, thread t owning rows t, t + threads, ... (see parallel_update.h)
+        void update_batch_by_rows(const uint64_t *items, const int64_t *weights, size_t n, unsigned threads) ;
 
         // Getters
-//        std::vector<uint64_t, uint64_t, uint64_t> get_config() ;
-        std::vector<uint64_t> get_config() ;
         int64_t get_estimate(uint64_t item) ;
+        void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) ;
         int64_t get_upper_bound(uint64_t item) ;
         int64_t get_lower_bound(uint64_t item) ;
+        const HashFamily& get_hash_family() const { return hashes ; }
         static uint64_t suggest_num_buckets(float relative_error) ;
         static uint64_t suggest_num_hashes(float confidence) ;
 
+        // Pre-hashed keys, for callers that already hold a 64-bit hash of every key (see PrehashedKeys).
+        // A sketch takes either items or pre-hashed keys, never both: enable_prehashed_keys switches an empty
+        // sketch over, after which the item paths throw, as the hashed paths do on an ordinary sketch.
+        // The key mode is part of the config, so the two kinds never merge or deserialize into one another.
+        void enable_prehashed_keys() ;
+        void update_hashed(uint64_t hash, int64_t weight=1) ;
+        void update_batch_hashed(const uint64_t *key_hashes, const int64_t *weights, size_t n) ; // weights may be nullptr for unit weights
+        int64_t get_estimate_hashed(uint64_t hash) ;
+        void get_estimates_hashed(const uint64_t *key_hashes, size_t n, int64_t *estimates) ;
+
         // Merge operations
-        void merge(CountMinSketch &sketch) ;
+        void merge(BasicCountMinSketch &sketch) ;
+
+        // Serialization
+        void serialize(std::ostream &os) ;
+        static BasicCountMinSketch deserialize(std::istream &is) ;
 
 private:
-        void set_hash_parameters() ;
-        uint64_t get_bucket_hash(uint64_t item, uint64_t a, uint64_t b) ;
-        vector<uint64_t> a_hash_params, b_hash_params ;
+        HashFamily hashes ;
+        PrehashedKeys prehashed ;
+
+        void check_key_mode(KeyMode mode) const ;
+        [[noreturn]] void key_mode_mismatch() const ;
+        // Shared bodies of the item and pre-hashed paths, Buckets being HashFamily or PrehashedKeys.
+        template <class Buckets> void apply_one(const Buckets &mapper, uint64_t key, int64_t weight) ;
+        template <class Buckets> void apply_batch(const Buckets &mapper, const uint64_t *keys, const int64_t *weights, size_t n) ;
+        template <class Buckets> int64_t estimate_one(const Buckets &mapper, uint64_t key) ;
+        template <class Buckets> void estimate_batch(const Buckets &mapper, const uint64_t *keys, size_t n, int64_t *estimates) ;
 
 };
 
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::update(uint64_t item, int64_t weight){
+    /*
+     * Updates the sketch with the item
+     * iterates through the number of hash functions and gets the bucket index.
+     * Then increment the sketch table at index (row, column) where row is one of the the hash
+     * functions that are iterated over, and column is the corresponding bucket index.
+     * Finally, increment the sketch table with the weight associated to the item.
+     *
+     * The bucket indices come from the HashFamily policy, which computes all rows at once.
+     * Items are any 64-bit value, as on every other entry point.
+     */
+    check_key_mode(ITEM_KEYS) ;
+    apply_one(hashes, item, weight) ;
+}
+
+template <class HashFamily>
+template <class Buckets>
+void BasicCountMinSketch<HashFamily>::apply_one(const Buckets &mapper, uint64_t key, int64_t weight){
+    SKETCH_METRICS_SCOPE(METRIC_UPDATE, 1) ;
+    RowBuckets buckets(num_hashes) ;
+    mapper.buckets(key, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        note_write(i, buckets[i]) ;
+        table[i][buckets[i]] += weight ;
+    }
+    total_weight += weight ;
+}
+
+template <class HashFamily>
+int64_t BasicCountMinSketch<HashFamily>::get_estimate(uint64_t item) {
+    /*
+     * Returns the estimate from the sketch for the given item.
+     * TODO:  Can we explore the estimator from this paper?
+     * https://dl.acm.org/doi/10.1145/3219819.3219975
+     */
+    check_key_mode(ITEM_KEYS) ;
+    return estimate_one(hashes, item) ;
+}
+
+template <class HashFamily>
+template <class Buckets>
+int64_t BasicCountMinSketch<HashFamily>::estimate_one(const Buckets &mapper, uint64_t key){
+    SKETCH_METRICS_SCOPE(METRIC_QUERY, 1) ;
+    int64_t estimate = std::numeric_limits<int64_t>::max() ; // start arbitrarily large
+    RowBuckets buckets(num_hashes) ;
+    mapper.buckets(key, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        estimate = std::min(estimate, read_counter(i, buckets[i])) ;
+    }
+    return estimate ;
+}
+
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::check_key_mode(KeyMode mode) const {
+    if(key_mode != mode){
+        key_mode_mismatch() ;
+    }
+}
+
+template <class HashFamily>
+void BasicCountMinSketch<HashFamily>::update_hashed(uint64_t hash, int64_t weight){
+    /*
+     * Same as update, with the row buckets mixed out of hash instead of computed by the hash family.
+     */
+    check_key_mode(PREHASHED_KEYS) ;
+    apply_one(prehashed, hash, weight) ;
+}
+
+template <class HashFamily>
+int64_t BasicCountMinSketch<HashFamily>::get_estimate_hashed(uint64_t hash){
+    check_key_mode(PREHASHED_KEYS) ;
+    return estimate_one(prehashed, hash) ;
+}
+
+template <class HashFamily>
+int64_t BasicCountMinSketch<HashFamily>::get_upper_bound(uint64_t item) {
+    /*
+     * Returns the upper bound of the estimate as:
+     * f_i - true frequency
+     * est(f_i) - estimate frequency
+     * f_i <= est(f_i)
+     */
+    return get_estimate(item) ;
+}
+
+template <class HashFamily>
+int64_t BasicCountMinSketch<HashFamily>::get_lower_bound(uint64_t item) {
+    /*
+     * Returns the lower bound of the estimate as:
+     * f_i - true frequency
+     * est(f_i) - estimate frequency
+     * f_i >= est(f_i) - epsilon*||f||_1 with ||f||_1 being the total weight in the sketch.
+     */
+    return get_estimate(item) - epsilon*total_weight ;
+}
+
+typedef BasicCountMinSketch<MersennePrimeHash> CountMinSketch ;
+typedef BasicCountMinSketch<MultiplyShiftHash> MultiplyShiftCountMinSketch ;
+typedef BasicCountMinSketch<TabulationHash> TabulationCountMinSketch ;
+typedef BasicCountMinSketch<DoubleHash> DoubleHashCountMinSketch ; // O(1) hashing per item regardless of depth
 
 #endif //LINEARSKETCHES_COUNTMINSKETCH_H
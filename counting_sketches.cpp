@@ -5,35 +5,77 @@
 #include "counting_sketches.h"
 #include <vector>
 #include <random>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std ;
 
 CountingSketch::CountingSketch(const uint64_t num_hashes, const uint64_t num_buckets, const uint64_t seed):
-    num_hashes(num_hashes), num_buckets(num_buckets), seed(seed) {
+    num_hashes(num_hashes), num_buckets(num_buckets), seed(seed), table(num_hashes, num_buckets) {
     /*
      * Class wrappers for CountMin and Count sketches.
      * The CountMin operates in the "cash register" data stream model, meaning that the
      * underlying frequency vector is at least zero in every coordinate.
      * The Count sketch operates in the "turnstile" model where the underlying frequency
      * vector can have arbitrary positive or negative weight.
+     * The table is allocated zeroed; large tables are only paged in as buckets are first written.
      */
-    table.resize(num_hashes, std::vector<int64_t>(num_buckets));
     };
 
-std::vector<std::vector<int64_t>> CountingSketch::get_table(){
+std::vector<std::vector<int64_t>> CountingSketch::get_table() const {
     /*
      * Returns a copy of the sketch.
      */
     std::vector<std::vector<int64_t>> sketch(num_hashes, std::vector<int64_t>(num_buckets));
     for(int i=0; i<num_hashes; i++){
-        for(int j=0; j<num_buckets; j++){
-            sketch[i][j] = table[i][j] ;
-        }
+        table.read_range(i * num_buckets, (i + 1) * num_buckets, sketch[i].data()) ;
     }
     return sketch;
 }
 
-void CountingSketch::print_sketch(){
+std::vector<uint64_t> CountingSketch::get_config() const {
+    /*
+     * The config identifies which sketches are compatible: {num_hashes, num_buckets, seed, hash family}, followed
+     * by the key mode for sketches that take pre-hashed keys.
+     */
+    if(key_mode != ITEM_KEYS){
+        return {num_hashes, num_buckets, seed, hash_family, key_mode} ;
+    }
+    return {num_hashes, num_buckets, seed, hash_family} ;
+}
+
+void CountingSketch::reset(){
+    /*
+     * Clears the sketch so it can be reused, e.g. when rotating windows, without reallocating the table.
+     * With lazy reset this is O(1) unless delta tracking has to save every block first.
+     */
+    if(track_deltas){
+        note_write_all() ;
+    }
+    table.clear_lazily() ;
+    total_weight = 0 ;
+}
+
+TableOccupancy CountingSketch::get_occupancy() const {
+    /*
+     * Stale blocks read as zero without being cleared, so that this can stay const.
+     */
+    if(!table.is_lazy_clear()){
+        return measure_occupancy(table.data(), table.size()) ;
+    }
+    TableOccupancy occupancy ;
+    occupancy.counters = table.size() ;
+    for(uint64_t start=0; start < table.size(); start += SketchTable::clear_block_counters){
+        if(!table.is_stale(start >> SketchTable::clear_block_shift)){
+            TableOccupancy block = measure_occupancy(table.data() + start, std::min<uint64_t>(SketchTable::clear_block_counters, table.size() - start)) ;
+            occupancy.nonzero += block.nonzero ;
+            occupancy.saturated += block.saturated ;
+        }
+    }
+    return occupancy ;
+}
+
+void CountingSketch::print_sketch() const {
     /*
      * Prints the sketch to std output.
      */
@@ -47,9 +89,154 @@ void CountingSketch::print_sketch(){
 //            else{
 //                eol = ' ' ;
 //            }
-            std::cout << table[i][j] << eol ;
+            std::cout << read_counter(i, j) << eol ;
+        }
+    }
+}
+
+uint64_t CountingSketch::enable_delta_tracking(){
+    if(!track_deltas){
+        track_deltas = true ;
+        block_dirty.assign((table.size() + SketchDelta::block_counters - 1) >> SketchDelta::block_shift, 0) ;
+        delta_base_weight = total_weight ;
+    }
+    return delta_epoch ;
+}
+
+void CountingSketch::mark_block_dirty(uint64_t block){
+    /*
+     * Saves the block as it was at the start of the epoch. The last block may be short so it is padded with zeros.
+     */
+    uint64_t start = block << SketchDelta::block_shift ;
+    uint64_t len = std::min<uint64_t>(SketchDelta::block_counters, table.size() - start) ;
+    table.prepare_range(start, start + len) ;
+    block_dirty[block] = 1 ;
+    dirty_blocks.push_back(block) ;
+    block_baselines.insert(block_baselines.end(), table.data() + start, table.data() + start + len) ;
+    block_baselines.resize(dirty_blocks.size() * SketchDelta::block_counters, 0) ;
+}
+
+void CountingSketch::note_write_all(){
+    table.prepare_all() ;
+    if(track_deltas){
+        for(uint64_t block=0; block < block_dirty.size(); block++){
+            if(!block_dirty[block]){
+                mark_block_dirty(block) ;
+            }
+        }
+    }
+}
+
+void CountingSketch::note_row_boundaries(){
+    /*
+     * A block shared by two rows contains the last counter of one and the first of the next, so noting the
+     * first and last counter of every row covers them all, for both clear blocks and delta blocks.
+     */
+    for(uint64_t row=0; row < num_hashes; row++){
+        note_write(row, 0) ;
+        note_write(row, num_buckets - 1) ;
+    }
+}
+
+void CountingSketch::log_dirty_block(uint64_t block, WriteLog &log){
+    /*
+     * mark_block_dirty for a block inside the calling thread's own row, recorded in its log.
+     */
+    uint64_t start = block << SketchDelta::block_shift ;
+    uint64_t len = std::min<uint64_t>(SketchDelta::block_counters, table.size() - start) ;
+    table.prepare_range(start, start + len) ;
+    block_dirty[block] = 1 ;
+    log.blocks.push_back(block) ;
+    log.baselines.insert(log.baselines.end(), table.data() + start, table.data() + start + len) ;
+    log.baselines.resize(log.blocks.size() * SketchDelta::block_counters, 0) ;
+}
+
+void CountingSketch::absorb_write_log(const WriteLog &log){
+    dirty_blocks.insert(dirty_blocks.end(), log.blocks.begin(), log.blocks.end()) ;
+    block_baselines.insert(block_baselines.end(), log.baselines.begin(), log.baselines.end()) ;
+}
+
+SketchDelta CountingSketch::export_delta(uint64_t since_epoch){
+    /*
+     * Compares each dirty block with its saved contents and keeps the blocks that really changed.
+     * Only the current epoch's baseline is kept, so since_epoch must be the epoch returned by the previous
+     * export_delta (or by enable_delta_tracking for the first delta).
+     */
+    if(!track_deltas){
+        throw std::invalid_argument( "Delta tracking is not enabled." );
+    }
+    if(since_epoch != delta_epoch){
+        throw std::invalid_argument( "Delta base epoch is not retained." );
+    }
+    SketchDelta delta ;
+    delta.config = get_config() ;
+    delta.from_epoch = delta_epoch ;
+    delta.to_epoch = delta_epoch + 1 ;
+    delta.total_weight = total_weight - delta_base_weight ;
+
+    std::vector<uint64_t> order(dirty_blocks.size()) ;
+    for(uint64_t k=0; k < order.size(); k++){
+        order[k] = k ;
+    }
+    std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b){ return dirty_blocks[a] < dirty_blocks[b] ; }) ;
+    std::vector<int64_t> diff(SketchDelta::block_counters) ;
+    for(uint64_t k : order){
+        uint64_t block = dirty_blocks[k] ;
+        uint64_t start = block << SketchDelta::block_shift ;
+        uint64_t len = std::min<uint64_t>(SketchDelta::block_counters, table.size() - start) ;
+        const int64_t *baseline = block_baselines.data() + k * SketchDelta::block_counters ;
+        table.prepare_range(start, start + len) ;
+        bool changed = false ;
+        std::fill(diff.begin(), diff.end(), 0) ;
+        for(uint64_t c=0; c < len; c++){
+            diff[c] = table.data()[start + c] - baseline[c] ;
+            changed = changed || (diff[c] != 0) ;
+        }
+        if(changed){
+            delta.block_ids.push_back(block) ;
+            delta.counters.insert(delta.counters.end(), diff.begin(), diff.end()) ;
+        }
+        block_dirty[block] = 0 ;
+    }
+    dirty_blocks.clear() ;
+    block_baselines.clear() ;
+    delta_base_weight = total_weight ;
+    delta_epoch++ ;
+    return delta ;
+}
+
+void CountingSketch::apply_delta(const SketchDelta &delta){
+    /*
+     * Only the blocks in the delta are touched. Writes are tracked like any other so deltas can be relayed.
+     * Block ids are checked against the table before any is shifted, which could wrap a huge id into range, and
+     * before anything is applied, so a malformed delta leaves the sketch untouched.
+     */
+    if(delta.config != get_config()){
+        throw std::invalid_argument( "Incompatible sketch config." );
+    }
+    if(delta.counters.size() != delta.block_ids.size() * SketchDelta::block_counters){
+        throw std::invalid_argument( "Malformed sketch delta." );
+    }
+    const uint64_t num_blocks = (table.size() + SketchDelta::block_counters - 1) >> SketchDelta::block_shift ;
+    for(uint64_t block : delta.block_ids){
+        if(block >= num_blocks){
+            throw std::invalid_argument( "Malformed sketch delta." );
+        }
+    }
+    for(uint64_t k=0; k < delta.block_ids.size(); k++){
+        uint64_t start = delta.block_ids[k] << SketchDelta::block_shift ;
+        uint64_t len = std::min<uint64_t>(SketchDelta::block_counters, table.size() - start) ;
+        table.prepare_range(start, start + len) ;
+        if(track_deltas && !block_dirty[delta.block_ids[k]]){
+            mark_block_dirty(delta.block_ids[k]) ;
+        }
+        const int64_t *diff = delta.counters.data() + k * SketchDelta::block_counters ;
+        int64_t *counters = table.data() + start ;
+        for(uint64_t c=0; c < len; c++){
+            counters[c] += diff[c] ;
         }
     }
+    total_weight += delta.total_weight ;
 }
 
 //std::vector<uint64_t> CountingSketch::init_hash_parameters(uint64_t num_random_ints, uint64_t lower, uint64_t upper) {
@@ -2,6 +2,11 @@
 // Created by Charlie Dickens on 04/05/2022.
 // This is a base class that will be used for both CountMin and Count sketch classes and contains functionality that
 // will be common to both sketches.
+// The base holds the table and the state around it only. update and the queries are defined by each sketch
+// without virtual dispatch, so templates taking a sketch type (SampledSketch, IngestQueue, ...) call them
+// statically. The single-item paths are defined in the sketch's header so those calls inline; the batched paths
+// stay out of line, one call per batch. SketchRef (sketch_ref.h) wraps any sketch for callers that pick one at
+// run time.
 //
 
 #ifndef LINEARSKETCHES_COUNTING_SKETCHES_H
@@ -11,43 +16,105 @@
 #include <cstdio>
 #include <cmath>
 #include <vector>
+#include "hash_families.h"
+#include "sketch_delta.h"
+#include "sketch_metrics.h"
+#include "sketch_table.h"
 
 class CountingSketch{
 public:
     CountingSketch(const uint64_t num_hashes, const uint64_t num_buckets, const uint64_t seed) ;
-    virtual ~CountingSketch(){} ;
 
     // Getters
     const uint64_t get_num_hashes() const { return num_hashes; }
     const uint64_t get_num_buckets() const { return num_buckets; }
     const uint64_t get_seed() const { return seed; } // nb will need this for merging.
     std::pair<uint64_t, uint64_t> get_table_shape() const {return {get_num_hashes(), get_num_buckets()} ; } ;
-    std::vector<std::vector<int64_t>> get_table() ;
-    void print_sketch() ;
-
-    // Virtual functions needed by subclasses.
-    virtual int64_t get_total_weight() {return total_weight ; }
-    virtual const float get_epsilon() const {return epsilon ;}
-    virtual const float get_delta() const {return delta ;}
-    virtual const float get_confidence() const {return confidence ;}
-    virtual void update(uint64_t item, int64_t weight=1){} ; // Inserts item into the sketch with default weight 1
-    virtual int64_t get_estimate(uint64_t item){return 0 ;} ; // Returns the estimate from the sketch
-    //virtual int64_t get_upper_bound(uint64_t item){ return 0 ;} ;
-    //virtual int64_t get_lower_bound(uint64_t item){ return 0 ;} ;
-    //virtual uint64_t suggest_num_buckets(float relative_error){return 0 ; } ;
-    //virtual static uint64_t suggest_num_hashes(float confidence){return 0 ; } ;
+    std::vector<uint64_t> get_config() const ; // {num_hashes, num_buckets, seed, hash family[, key mode]}, sketches merge only with equal configs
+    KeyMode get_key_mode() const { return key_mode ; }
+    std::vector<std::vector<int64_t>> get_table() const ;
+    uint64_t get_memory_bytes() const { return table.get_memory_bytes() ; }
+    TableOccupancy get_occupancy() const ; // scans the whole table
+    void print_sketch() const ;
+    void reset() ; // Zeroes every counter and the total weight
+    bool use_huge_pages() { return table.advise_huge_pages() ; } // Only honoured for large (mmap'd) tables
+    // NUMA placement, best called straight after construction before the table is touched.
+    // Interleaving spreads the rows' pages over every node so no socket pays remote latency on every update.
+    bool interleave_across_nodes() { return table.interleave_across_nodes() ; }
+    bool bind_to_node(unsigned node) { return table.bind_to_node(node) ; }
+
+    // Lazy reset for rotating windows: once enabled, reset only starts a new table epoch and each 512-byte block
+    // of counters is zeroed on its first read or write afterwards (see sketch_table.h).
+    void enable_lazy_reset() { table.enable_lazy_clear() ; }
+    bool is_lazy_reset() const { return table.is_lazy_clear() ; }
+
+    // Delta checkpoints. Once tracking is enabled every 4KB block of counters that is written is remembered
+    // with its contents at the start of the epoch, so export_delta only visits the blocks that changed.
+    uint64_t enable_delta_tracking() ; // returns the epoch the first delta will start from
+    uint64_t get_delta_epoch() const { return delta_epoch ; }
+    SketchDelta export_delta(uint64_t since_epoch) ; // changes since since_epoch, which must be the current delta epoch; starts a new epoch
+    void apply_delta(const SketchDelta &delta) ; // adds a delta exported from a sketch with the same config
+
+    int64_t get_total_weight() const {return total_weight ; }
+    float get_epsilon() const {return epsilon ;}
+    float get_delta() const {return delta ;}
+    float get_confidence() const {return confidence ;}
     static uint64_t suggest_num_buckets(float relative_error){return 0 ; } ;
     static uint64_t suggest_num_hashes(float confidence){return 0 ; } ;
 
 
 protected:
     uint64_t num_hashes, num_buckets, seed ;
-    uint64_t mersenne_exponent = 5 ;
-    uint64_t large_prime = (1 << mersenne_exponent) - 1 ; // nb change this to a mersenne prime
-    std::vector<std::vector<int64_t>> table;
+    SketchTable table; // table[i][j] is bucket j of hash i, stored row-major in one flat allocation
     // std::vector<uint64_t> init_hash_parameters(uint64_t num_random_ints, uint64_t lower, uint64_t upper) ;
     int64_t total_weight = 0 ; // This tracks how much weight has been added to the stream.
     // Would like to put epsilon and delta in here as they are common to both CountMin and Count sketches.
+    uint64_t hash_family = 0 ; // HashFamilyId of the subclass, recorded in the config
+    KeyMode key_mode = ITEM_KEYS ; // recorded in the config when not ITEM_KEYS
+
+    // Delta tracking state, see enable_delta_tracking.
+    bool track_deltas = false ;
+    uint64_t delta_epoch = 0 ;
+    int64_t delta_base_weight = 0 ; // total weight at the start of the delta epoch
+    std::vector<char> block_dirty ;
+    std::vector<uint64_t> dirty_blocks ;
+    std::vector<int64_t> block_baselines ; // contents of each dirty block at the start of the epoch, in dirty_blocks order
+
+    void mark_block_dirty(uint64_t block) ;
+    int64_t read_counter(uint64_t row, uint64_t bucket) const {
+        // Stale counters of a lazily reset table read as zero, and reading never clears them.
+        return table.read(row * num_buckets + bucket) ;
+    }
+    void note_write(uint64_t row, uint64_t bucket){
+        // Must be called before the counter is modified.
+        table.prepare(row * num_buckets + bucket) ;
+        if(track_deltas){
+            uint64_t block = (row * num_buckets + bucket) >> SketchDelta::block_shift ;
+            if(!block_dirty[block]){
+                mark_block_dirty(block) ;
+            }
+        }
+    }
+    void note_write_all() ; // every block is about to change, also prepares the whole table
+
+    // Row-partitioned writers (BasicCountMinSketch::update_batch_by_rows). A block holding counters of two rows
+    // is prepared and marked up front by note_row_boundaries. Every other block lies within one row, so the
+    // thread owning that row handles it through note_owned_write, logging newly dirty blocks in its own
+    // WriteLog, and absorb_write_log folds the logs in once the threads are done.
+    struct WriteLog {
+        std::vector<uint64_t> blocks ;
+        std::vector<int64_t> baselines ;
+    };
+    void note_row_boundaries() ;
+    void note_owned_write(uint64_t row, uint64_t bucket, WriteLog &log){
+        uint64_t index = row * num_buckets + bucket ;
+        table.prepare(index) ;
+        if(track_deltas && !block_dirty[index >> SketchDelta::block_shift]){
+            log_dirty_block(index >> SketchDelta::block_shift, log) ;
+        }
+    }
+    void log_dirty_block(uint64_t block, WriteLog &log) ;
+    void absorb_write_log(const WriteLog &log) ;
 
     // Parameters
     float epsilon ; // Error parameter
@@ -0,0 +1,41 @@
+//
+// Serves named CountMin sketches over a Unix domain socket (see sketch_daemon.h) until SIGINT or SIGTERM.
+//
+// Usage: LinearSketchesDaemon SOCKET [MAX_SKETCH_MB]       largest table a client may create, default 4096
+//
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include "sketch_daemon.h"
+
+namespace {
+    SketchDaemon *running = nullptr ;
+
+    void handle_signal(int){
+        if(running != nullptr){
+            running->stop() ;
+        }
+    }
+}
+
+int main(int argc, char **argv){
+    if(argc != 2 && argc != 3){
+        std::cerr << "usage: LinearSketchesDaemon SOCKET [MAX_SKETCH_MB]\n" ;
+        return 2 ;
+    }
+    uint64_t max_sketch_bytes = (argc == 3) ? (std::strtoull(argv[2], nullptr, 10) << 20) : default_max_sketch_bytes ;
+    try {
+        SketchDaemon daemon(argv[1], max_sketch_bytes) ;
+        running = &daemon ;
+        std::signal(SIGINT, handle_signal) ;
+        std::signal(SIGTERM, handle_signal) ;
+        daemon.run() ;
+        running = nullptr ;
+        std::cout << "served " << daemon.get_num_sketches() << " sketches\n" ;
+    } catch(const std::exception &e){
+        std::cerr << e.what() << "\n" ;
+        return 1 ;
+    }
+    return 0 ;
+}
@@ -0,0 +1,58 @@
+//
+// Accuracy-versus-throughput sweep over sketch shapes (see accuracy_harness.h).
+// Every shape is run with each hash family and with a 16-bit blocked sketch of the same memory, next to the
+// exact baseline, so speed, memory and observed error can be compared on one stream.
+//
+// Usage: LinearSketchesEvaluate [trace.txt]        one "key" or "key weight" per line
+//        LinearSketchesEvaluate --zipf N SKEW       N synthetic Zipf items (defaults 4000000 and 1.1)
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "accuracy_harness.h"
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "stream_generators.h"
+
+namespace {
+    const uint64_t sweep_num_hashes[] = {2, 3, 4, 5} ;
+    const uint64_t sweep_num_buckets[] = {1 << 10, 1 << 12, 1 << 14, 1 << 16} ;
+
+    template <class Sketch>
+    void run(const std::string &name, Sketch sketch, const std::vector<uint64_t> &items, const std::vector<int64_t> &weights,
+             const ExactBaseline &baseline){
+        const int64_t *w = weights.empty() ? nullptr : weights.data() ;
+        print_evaluation(std::cout, evaluate_sketch(name, sketch, items.data(), w, items.size(), baseline)) ;
+    }
+}
+
+int main(int argc, char **argv){
+    std::vector<uint64_t> items ;
+    std::vector<int64_t> weights ;
+    if(argc > 1 && std::strcmp(argv[1], "--zipf") != 0){
+        read_text_trace(argv[1], items, weights) ;
+    } else {
+        uint64_t n = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 4000000 ;
+        double skew = (argc > 3) ? std::atof(argv[3]) : 1.1 ;
+        items.resize(n) ;
+        ZipfGenerator(1 << 20, skew, 1).fill(items.data(), n) ;
+    }
+    ExactBaseline baseline = build_exact_baseline(items.data(), weights.empty() ? nullptr : weights.data(), items.size()) ;
+    std::cout << items.size() << " items, " << baseline.counts.size() << " distinct, total weight " << baseline.total_weight << "\n" ;
+    print_evaluation_header(std::cout) ;
+    print_baseline(std::cout, baseline) ;
+    for(uint64_t h : sweep_num_hashes){
+        for(uint64_t b : sweep_num_buckets){
+            run("CountMin/mersenne", CountMinSketch(h, b, 1), items, weights, baseline) ;
+            run("CountMin/multiply-shift", MultiplyShiftCountMinSketch(h, b, 1), items, weights, baseline) ;
+            run("CountMin/tabulation", TabulationCountMinSketch(h, b, 1), items, weights, baseline) ;
+            run("CountMin/double-hash", DoubleHashCountMinSketch(h, b, 1), items, weights, baseline) ;
+            uint64_t blocks = h * b * sizeof(int64_t) / BlockedCountMinSketch16::block_bytes ;
+            run("Blocked16", BlockedCountMinSketch16(h, blocks, 1), items, weights, baseline) ;
+        }
+    }
+    return 0 ;
+}
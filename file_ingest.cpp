@@ -0,0 +1,252 @@
+//
+// Parallel ingestion of large on-disk key files.
+//
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "file_ingest.h"
+
+namespace {
+    const uint64_t ascii_zeros = 0x3030303030303030ULL ;
+
+    inline bool is_separator(char c){
+        return c == '\n' || c == '\r' || c == ' ' || c == '\t' || c == ',' ;
+    }
+
+    inline bool eight_digits(uint64_t chunk){
+        /*
+         * True when all 8 bytes are '0'..'9': subtracting '0' must not borrow and adding 0x46 must not carry
+         * into the top bit of any byte.
+         */
+        return (((chunk + 0x4646464646464646ULL) | (chunk - ascii_zeros)) & 0x8080808080808080ULL) == 0 ;
+    }
+
+    inline uint64_t parse_eight_digits(uint64_t chunk){
+        /*
+         * SWAR conversion of 8 little-endian ASCII digits in three multiplies: pairs, then quads, then all eight.
+         */
+        chunk -= ascii_zeros ;
+        chunk = (chunk * 10) + (chunk >> 8) ;
+        return (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+                + (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32 ;
+    }
+
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string &path){
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC) ;
+            struct stat st ;
+            if(fd < 0 || fstat(fd, &st) != 0){
+                if(fd >= 0){
+                    close(fd) ;
+                }
+                throw std::runtime_error( "Cannot open key file " + path );
+            }
+            length = size_t(st.st_size) ;
+            if(length > 0){
+                void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) ;
+                if(p == MAP_FAILED){
+                    close(fd) ;
+                    throw std::runtime_error( "Cannot map key file " + path );
+                }
+                base = static_cast<const char*>(p) ;
+                madvise(const_cast<char*>(base), length, MADV_SEQUENTIAL) ;
+            }
+        }
+        ~MappedFile(){
+            if(base != nullptr){
+                munmap(const_cast<char*>(base), length) ;
+            }
+            close(fd) ;
+        }
+        MappedFile(const MappedFile&) = delete ;
+        MappedFile& operator=(const MappedFile&) = delete ;
+
+        void advise(size_t begin, size_t end, int advice, bool round_outward) const {
+            // Releasing rounds inward so pages shared with a neighbouring chunk stay mapped.
+            const size_t page = size_t(sysconf(_SC_PAGESIZE)) ;
+            begin = round_outward ? begin / page * page : (begin + page - 1) / page * page ;
+            end = round_outward ? end : end / page * page ;
+            if(begin < end){
+                madvise(const_cast<char*>(base) + begin, end - begin, advice) ;
+            }
+        }
+
+        int fd = -1 ;
+        const char *base = nullptr ;
+        size_t length = 0 ;
+    };
+
+    size_t text_record_start(const MappedFile &file, size_t offset){
+        /*
+         * First line starting at or after offset: offset itself if it follows a newline, else just past the next one.
+         */
+        if(offset == 0 || offset >= file.length){
+            return std::min(offset, file.length) ;
+        }
+        const void *newline = std::memchr(file.base + offset - 1, '\n', file.length - (offset - 1)) ;
+        return (newline == nullptr) ? file.length : size_t(static_cast<const char*>(newline) - file.base) + 1 ;
+    }
+
+    template <class Sketch>
+    void ingest_chunk(const MappedFile &file, const IngestOptions &options, size_t begin, size_t end, Sketch &sketch,
+                      std::vector<uint64_t> &keys, uint64_t &num_keys){
+        if(options.format == KEY_FILE_BINARY){
+            // Chunks start on 8-byte offsets of a page-aligned mapping, so the keys are read in place.
+            const uint64_t *in = reinterpret_cast<const uint64_t*>(file.base + begin) ;
+            size_t n = (end - begin) / sizeof(uint64_t) ;
+            for(size_t start=0; start < n; start += options.batch){
+                sketch.update_batch(in + start, nullptr, std::min(options.batch, n - start)) ;
+            }
+            num_keys += n ;
+            return ;
+        }
+        const char *p = file.base + begin ;
+        const char *stop = file.base + end ;
+        while(p < stop){
+            size_t n = parse_decimal_keys(p, stop, keys.data(), keys.size(), &p) ;
+            sketch.update_batch(keys.data(), nullptr, n) ;
+            num_keys += n ;
+        }
+    }
+}
+
+size_t parse_decimal_keys(const char *begin, const char *end, uint64_t *out, size_t max_keys, const char **stop){
+    /*
+     * Whole groups of 8 digits go through the SWAR path while at least 8 bytes remain; the tail of a key and
+     * keys at the very end of the buffer are parsed a digit at a time.
+     */
+    const char *p = begin ;
+    size_t n = 0 ;
+    while(n < max_keys){
+        while(p < end && is_separator(*p)){
+            p++ ;
+        }
+        if(p == end){
+            break ;
+        }
+        const char *key_start = p ;
+        uint64_t value = 0 ;
+        uint64_t chunk ;
+        while(end - p >= 8 && (std::memcpy(&chunk, p, 8), eight_digits(chunk))){
+            if(p - key_start >= 16){
+                throw std::invalid_argument( "Key does not fit in 64 bits." );
+            }
+            value = value * 100000000ULL + parse_eight_digits(chunk) ;
+            p += 8 ;
+        }
+        while(p < end && unsigned(*p - '0') < 10){
+            if(__builtin_mul_overflow(value, uint64_t(10), &value) || __builtin_add_overflow(value, uint64_t(*p - '0'), &value)){
+                throw std::invalid_argument( "Key does not fit in 64 bits." );
+            }
+            p++ ;
+        }
+        if(p == key_start || (p < end && !is_separator(*p))){
+            throw std::invalid_argument( "Malformed key file." );
+        }
+        out[n++] = value ;
+    }
+    *stop = p ;
+    return n ;
+}
+
+template <class Sketch>
+IngestStats ingest_key_file(const std::string &path, Sketch &sketch, const IngestOptions &options){
+    /*
+     * Workers claim chunks with a fetch_add so a slow chunk never holds up the others, and release each chunk's
+     * pages once parsed so the file can be far larger than memory. Parse errors are rethrown after every worker has
+     * stopped, leaving sketch unchanged.
+     */
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "binary keys are read in place as little-endian") ;
+    if(options.batch == 0 || options.chunk_bytes == 0){
+        throw std::invalid_argument( "Batch and chunk sizes must be positive." );
+    }
+    auto begin_time = std::chrono::steady_clock::now() ;
+    MappedFile file(path) ;
+    if(options.format == KEY_FILE_BINARY && file.length % sizeof(uint64_t) != 0){
+        throw std::invalid_argument( "Binary key file is not a whole number of 64-bit keys." );
+    }
+    size_t chunk_bytes = options.chunk_bytes ;
+    if(options.format == KEY_FILE_BINARY){
+        chunk_bytes = std::max(sizeof(uint64_t), chunk_bytes / sizeof(uint64_t) * sizeof(uint64_t)) ;
+    }
+    const uint64_t num_chunks = (file.length + chunk_bytes - 1) / chunk_bytes ;
+    unsigned threads = (options.threads == 0) ? std::max(1u, std::thread::hardware_concurrency()) : options.threads ;
+    threads = unsigned(std::max<uint64_t>(1, std::min<uint64_t>(threads, num_chunks))) ;
+
+    std::atomic<uint64_t> next_chunk(0) ;
+    std::vector<uint64_t> keys_per_thread(threads, 0) ;
+    std::vector<std::unique_ptr<Sketch> > shards ;
+    std::vector<std::exception_ptr> errors(threads) ;
+    for(unsigned t=0; t < threads; t++){
+        shards.push_back(sketch.make_empty()) ;
+    }
+    auto work = [&](unsigned t){
+        std::vector<uint64_t> keys(options.batch) ;
+        try {
+            for(uint64_t c = next_chunk.fetch_add(1); c < num_chunks; c = next_chunk.fetch_add(1)){
+                size_t nominal_begin = c * chunk_bytes ;
+                size_t nominal_end = std::min(file.length, nominal_begin + chunk_bytes) ;
+                size_t begin = nominal_begin, end = nominal_end ;
+                if(options.format == KEY_FILE_TEXT){
+                    begin = text_record_start(file, nominal_begin) ;
+                    end = text_record_start(file, nominal_end) ;
+                }
+                if(begin >= end){
+                    continue ;
+                }
+                file.advise(begin, end, MADV_WILLNEED, true) ;
+                ingest_chunk(file, options, begin, end, *shards[t], keys, keys_per_thread[t]) ;
+                file.advise(begin, end, MADV_DONTNEED, false) ;
+            }
+        } catch(...){
+            errors[t] = std::current_exception() ;
+            next_chunk.store(num_chunks) ; // the other workers stop after their current chunk
+        }
+    } ;
+    std::vector<std::thread> workers ;
+    for(unsigned t=1; t < threads; t++){
+        workers.emplace_back(work, t) ;
+    }
+    work(0) ;
+    for(std::thread &worker : workers){
+        worker.join() ;
+    }
+
+    for(const std::exception_ptr &error : errors){
+        if(error){
+            std::rethrow_exception(error) ;
+        }
+    }
+
+    IngestStats stats ;
+    for(unsigned t=0; t < threads; t++){
+        sketch.merge(*shards[t]) ;
+        stats.keys += keys_per_thread[t] ;
+    }
+    stats.bytes = file.length ;
+    stats.chunks = num_chunks ;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_time).count() ;
+    stats.bytes_per_second = (stats.seconds > 0.0) ? double(stats.bytes) / stats.seconds : 0.0 ;
+    return stats ;
+}
+
+template IngestStats ingest_key_file(const std::string&, CountMinSketch&, const IngestOptions&) ;
+template IngestStats ingest_key_file(const std::string&, MultiplyShiftCountMinSketch&, const IngestOptions&) ;
+template IngestStats ingest_key_file(const std::string&, TabulationCountMinSketch&, const IngestOptions&) ;
+template IngestStats ingest_key_file(const std::string&, DoubleHashCountMinSketch&, const IngestOptions&) ;
+template IngestStats ingest_key_file(const std::string&, BlockedCountMinSketch8&, const IngestOptions&) ;
+template IngestStats ingest_key_file(const std::string&, BlockedCountMinSketch16&, const IngestOptions&) ;
+template IngestStats ingest_key_file(const std::string&, BlockedCountMinSketch32&, const IngestOptions&) ;
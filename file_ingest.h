@@ -0,0 +1,46 @@
+//
+// Parallel ingestion of large on-disk key files.
+// The file is mapped read-only and cut into chunks of roughly chunk_bytes at record boundaries: a text chunk owns
+// every line that starts inside it, a binary chunk is a whole number of 8-byte keys. A pool of worker threads
+// takes chunks in file order from a shared counter, parses them into batches and feeds each batch to the worker's
+// own empty sketch with the same config; these are merged into the caller's sketch once the file is done.
+// Text files hold one unsigned decimal key per line ('\r', spaces, tabs and commas are also accepted as
+// separators). Binary files hold raw little-endian uint64_t keys.
+//
+
+#ifndef LINEARSKETCHES_FILE_INGEST_H
+#define LINEARSKETCHES_FILE_INGEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum KeyFileFormat {
+    KEY_FILE_TEXT,
+    KEY_FILE_BINARY
+};
+
+struct IngestOptions {
+    KeyFileFormat format = KEY_FILE_TEXT ;
+    unsigned threads = 0 ; // 0 uses every hardware thread
+    size_t chunk_bytes = size_t(16) << 20 ;
+    size_t batch = 4096 ; // keys per update_batch call
+};
+
+struct IngestStats {
+    uint64_t keys = 0 ;
+    uint64_t bytes = 0 ;
+    uint64_t chunks = 0 ;
+    double seconds = 0.0 ;
+    double bytes_per_second = 0.0 ;
+};
+
+// Parses decimal keys from [begin, end) into out until max_keys are parsed or the text runs out, and returns the
+// number parsed. *stop is set to where parsing stopped; a key is never split, so callers pass whole records.
+// Throws on characters other than digits and separators or on keys that do not fit in 64 bits.
+size_t parse_decimal_keys(const char *begin, const char *end, uint64_t *out, size_t max_keys, const char **stop) ;
+
+template <class Sketch>
+IngestStats ingest_key_file(const std::string &path, Sketch &sketch, const IngestOptions &options) ;
+
+#endif //LINEARSKETCHES_FILE_INGEST_H
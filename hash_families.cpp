@@ -0,0 +1,136 @@
+//
+// Parameter generation and batched entry points for the hash family policies.
+//
+#include <random>
+#include <stdexcept>
+#include "hash_families.h"
+
+const uint64_t RowBuckets::max_stack_rows ;
+const uint64_t MersennePrimeHash::mersenne_exponent ;
+const uint64_t MersennePrimeHash::large_prime ;
+const uint64_t TabulationHash::num_chars ;
+const uint64_t TabulationHash::char_range ;
+
+MultiplyShiftHash::MultiplyShiftHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed):
+    num_hashes(num_hashes), num_buckets(num_buckets), a_hash_params(num_hashes), b_hash_params(num_hashes){
+    /*
+     * a and b are drawn uniformly from all 64-bit words.
+     */
+    if(num_buckets >= (uint64_t(1) << 32)){
+        throw std::invalid_argument( "Multiply-shift hashing supports fewer than 2^32 buckets." );
+    }
+    std::mt19937_64 rng(seed) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        a_hash_params[i] = rng() ;
+        b_hash_params[i] = rng() ;
+    }
+}
+
+void MultiplyShiftHash::buckets(const uint64_t *items, size_t n, uint64_t *out) const {
+    /*
+     * Row at a time so that the inner loop is a straight multiply-add-shift over the batch
+     * and can be vectorised by the compiler.
+     */
+    for(uint64_t i=0; i < num_hashes; i++){
+        const uint64_t a = a_hash_params[i] ;
+        const uint64_t b = b_hash_params[i] ;
+        uint64_t *row_out = out + i * n ;
+        for(size_t k=0; k < n; k++){
+            row_out[k] = (((a * items[k] + b) >> 32) * num_buckets) >> 32 ;
+        }
+    }
+}
+
+MersennePrimeHash::MersennePrimeHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed):
+    num_hashes(num_hashes), num_buckets(num_buckets), a_hash_params(num_hashes), b_hash_params(num_hashes){
+    /*
+     * a is drawn from [1, p) and b from [0, p) so that every row is a proper 2-universal function.
+     */
+    std::mt19937_64 rng(seed) ;
+    std::uniform_int_distribution<uint64_t> uniform_a(1, large_prime - 1) ;
+    std::uniform_int_distribution<uint64_t> uniform_b(0, large_prime - 1) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        a_hash_params[i] = uniform_a(rng) ;
+        b_hash_params[i] = uniform_b(rng) ;
+    }
+}
+
+MersennePrimeHash::MersennePrimeHash(uint64_t num_hashes, uint64_t num_buckets, const uint64_t *a, const uint64_t *b):
+    num_hashes(num_hashes), num_buckets(num_buckets), a_hash_params(a, a + num_hashes), b_hash_params(b, b + num_hashes){
+    /*
+     * Rebuilds a family from parameters stored elsewhere, e.g. in a shared memory segment.
+     */
+    for(uint64_t i=0; i < num_hashes; i++){
+        if(a[i] == 0 || a[i] >= large_prime || b[i] >= large_prime){
+            throw std::invalid_argument( "Hash parameters must lie in [1, p) and [0, p)." );
+        }
+    }
+}
+
+void MersennePrimeHash::buckets(const uint64_t *items, size_t n, uint64_t *out) const {
+    for(uint64_t i=0; i < num_hashes; i++){
+        const uint64_t a = a_hash_params[i] ;
+        const uint64_t b = b_hash_params[i] ;
+        uint64_t *row_out = out + i * n ;
+        for(size_t k=0; k < n; k++){
+            row_out[k] = mod_mersenne(__uint128_t(a) * mod_mersenne(items[k]) + b) % num_buckets ;
+        }
+    }
+}
+
+TabulationHash::TabulationHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed):
+    num_hashes(num_hashes), num_buckets(num_buckets), tables(num_hashes * num_chars * char_range){
+    std::mt19937_64 rng(seed) ;
+    for(uint64_t &t : tables){
+        t = rng() ;
+    }
+}
+
+void TabulationHash::buckets(const uint64_t *items, size_t n, uint64_t *out) const {
+    for(uint64_t i=0; i < num_hashes; i++){
+        uint64_t *row_out = out + i * n ;
+        for(size_t k=0; k < n; k++){
+            row_out[k] = bucket(i, items[k]) ;
+        }
+    }
+}
+
+DoubleHash::DoubleHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed):
+    num_hashes(num_hashes), num_buckets(num_buckets){
+    std::mt19937_64 rng(seed) ;
+    key = rng() ;
+}
+
+void DoubleHash::buckets(const uint64_t *items, size_t n, uint64_t *out) const {
+    /*
+     * Each item is hashed once and its row indices are written down the column out[i * n + k].
+     */
+    for(size_t k=0; k < n; k++){
+        uint64_t h1, h2 ;
+        hash128(items[k], h1, h2) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i * n + k] = reduce_to_range(h1, num_buckets) ;
+            h1 += h2 ;
+        }
+    }
+}
+
+PrehashedKeys::PrehashedKeys(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed):
+    num_hashes(num_hashes), num_buckets(num_buckets){
+    std::mt19937_64 rng(seed) ;
+    key1 = rng() ;
+    key2 = rng() ;
+    mult1 = rng() | 1 ;
+    mult2 = rng() | 1 ;
+}
+
+void PrehashedKeys::buckets(const uint64_t *hashes, size_t n, uint64_t *out) const {
+    for(size_t k=0; k < n; k++){
+        uint64_t h1, h2 ;
+        mix(hashes[k], h1, h2) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i * n + k] = reduce_to_range(h1, num_buckets) ;
+            h1 += h2 ;
+        }
+    }
+}
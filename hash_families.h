@@ -0,0 +1,271 @@
+//
+// Hash family policies used for bucket selection in the linear sketches.
+// Each policy is constructed from (num_hashes, num_buckets, seed) and maps an item to one bucket per row.
+// Every policy exposes the same entry points:
+//     bucket(row, item)          -- the bucket of item in a single row
+//     buckets(item, out)         -- the buckets of item in every row, out[row]
+//     buckets(items, n, out)     -- batched form, out is row-major so out[row * n + k] is the bucket of items[k]
+// and a family_id() that is recorded in the sketch config so that sketches built with different families
+// are never merged or deserialized into one another. rows_share_hash() says whether every row comes from one hash
+// of the item, in which case buckets(item, out) costs about as much as a single bucket(row, item).
+//
+// PrehashedKeys has the same entry points but maps keys that are already uniform 64-bit hashes, as computed
+// upstream for routing, so the sketch does not hash them a second time.
+//
+
+#ifndef LINEARSKETCHES_HASH_FAMILIES_H
+#define LINEARSKETCHES_HASH_FAMILIES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Identifiers recorded in the sketch config. Never reorder: they are written into serialized sketches.
+enum HashFamilyId : uint64_t {
+    MULTIPLY_SHIFT_HASH_ID = 1,
+    MERSENNE_PRIME_HASH_ID = 2,
+    TABULATION_HASH_ID = 3,
+    DOUBLE_HASH_ID = 4,
+};
+
+// How the keys handed to a sketch are turned into buckets. Recorded in the config only when not ITEM_KEYS, so
+// the configs and serialized form of ordinary sketches are unchanged. Never reorder.
+enum KeyMode : uint64_t {
+    ITEM_KEYS = 0, // keys are hashed by the sketch's hash family
+    PREHASHED_KEYS = 1, // keys are 64-bit hashes and only mixed into row buckets (see PrehashedKeys)
+};
+
+inline uint64_t reduce_to_range(uint64_t h, uint64_t range){
+    /*
+     * Maps a uniform 64-bit value into [0, range) with a multiply and a shift rather than a modulus.
+     * See Lemire, "Fast Random Integer Generation in an Interval".
+     */
+    return uint64_t((__uint128_t(h) * range) >> 64) ;
+}
+
+class RowBuckets {
+    /*
+     * Scratch space for one item's bucket in every row, for the single-item update and query paths.
+     * Up to max_stack_rows rows (failure probability e^-32 for CountMin) it lives on the stack, so those paths
+     * do not allocate; deeper sketches fall back to the heap.
+     */
+public:
+    static const uint64_t max_stack_rows = 32 ;
+
+    explicit RowBuckets(uint64_t num_rows) : data(on_stack){
+        if(num_rows > max_stack_rows){
+            on_heap.resize(num_rows) ;
+            data = on_heap.data() ;
+        }
+    }
+    RowBuckets(const RowBuckets&) = delete ;
+    RowBuckets& operator=(const RowBuckets&) = delete ;
+
+    uint64_t* get() { return data ; }
+    uint64_t operator[](uint64_t row) const { return data[row] ; }
+
+private:
+    uint64_t on_stack[max_stack_rows] ;
+    std::vector<uint64_t> on_heap ;
+    uint64_t *data ;
+};
+
+class MultiplyShiftHash {
+    /*
+     * Dietzfelbinger's multiply-add-shift scheme h(x) = (a*x + b) >> 32 followed by a range reduction.
+     * The cheapest family here: one multiply, one add and one shift per row.
+     * Requires num_buckets < 2^32.
+     */
+public:
+    MultiplyShiftHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    static uint64_t family_id() { return MULTIPLY_SHIFT_HASH_ID ; }
+    static bool rows_share_hash() { return false ; }
+    static const char* name() { return "multiply-shift" ; }
+
+    uint64_t bucket(uint64_t row, uint64_t item) const {
+        uint64_t h = (a_hash_params[row] * item + b_hash_params[row]) >> 32 ;
+        return (h * num_buckets) >> 32 ;
+    }
+    void buckets(uint64_t item, uint64_t *out) const {
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i] = bucket(i, item) ;
+        }
+    }
+    void buckets(const uint64_t *items, size_t n, uint64_t *out) const ;
+    const std::vector<uint64_t>& get_a_params() const { return a_hash_params ; }
+    const std::vector<uint64_t>& get_b_params() const { return b_hash_params ; }
+
+private:
+    uint64_t num_hashes, num_buckets ;
+    std::vector<uint64_t> a_hash_params, b_hash_params ;
+};
+
+class MersennePrimeHash {
+    /*
+     * The 2-universal polynomial family h(x) = ((a*x + b) mod p) mod num_buckets with p = 2^61 - 1.
+     * Working modulo a Mersenne prime lets the reduction be done with shifts and adds instead of a division.
+     * This is the family described in http://dimacs.rutgers.edu/~graham/pubs/papers/cmencyc.pdf
+     */
+public:
+    static const uint64_t mersenne_exponent = 61 ;
+    static const uint64_t large_prime = (uint64_t(1) << mersenne_exponent) - 1 ;
+
+    MersennePrimeHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    MersennePrimeHash(uint64_t num_hashes, uint64_t num_buckets, const uint64_t *a, const uint64_t *b) ; // explicit parameters
+    static uint64_t family_id() { return MERSENNE_PRIME_HASH_ID ; }
+    static bool rows_share_hash() { return false ; }
+    static const char* name() { return "mersenne-prime" ; }
+
+    static uint64_t mod_mersenne(__uint128_t x){
+        uint64_t r = uint64_t(x & large_prime) + uint64_t(x >> mersenne_exponent) ;
+        r = (r & large_prime) + (r >> mersenne_exponent) ;
+        return r >= large_prime ? r - large_prime : r ;
+    }
+    uint64_t bucket(uint64_t row, uint64_t item) const {
+        return mod_mersenne(__uint128_t(a_hash_params[row]) * mod_mersenne(item) + b_hash_params[row]) % num_buckets ;
+    }
+    void buckets(uint64_t item, uint64_t *out) const {
+        uint64_t x = mod_mersenne(item) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i] = mod_mersenne(__uint128_t(a_hash_params[i]) * x + b_hash_params[i]) % num_buckets ;
+        }
+    }
+    void buckets(const uint64_t *items, size_t n, uint64_t *out) const ;
+    const std::vector<uint64_t>& get_a_params() const { return a_hash_params ; }
+    const std::vector<uint64_t>& get_b_params() const { return b_hash_params ; }
+
+private:
+    uint64_t num_hashes, num_buckets ;
+    std::vector<uint64_t> a_hash_params, b_hash_params ;
+};
+
+class TabulationHash {
+    /*
+     * Simple tabulation hashing: the item is split into 8 bytes and each byte indexes its own table of
+     * random 64-bit words which are XORed together. 3-independent and behaves like a truly random function
+     * for CountMin (Patrascu & Thorup, "The Power of Simple Tabulation Hashing").
+     * Uses 16KB of tables per row, so it is the most cache hungry of the families.
+     */
+public:
+    static const uint64_t num_chars = 8 ;
+    static const uint64_t char_range = 256 ;
+
+    TabulationHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    static uint64_t family_id() { return TABULATION_HASH_ID ; }
+    static bool rows_share_hash() { return false ; }
+    static const char* name() { return "tabulation" ; }
+
+    uint64_t bucket(uint64_t row, uint64_t item) const {
+        const uint64_t *t = &tables[row * num_chars * char_range] ;
+        uint64_t h = 0 ;
+        for(uint64_t c=0; c < num_chars; c++){
+            h ^= t[c * char_range + ((item >> (8 * c)) & 0xFF)] ;
+        }
+        return reduce_to_range(h, num_buckets) ;
+    }
+    void buckets(uint64_t item, uint64_t *out) const {
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i] = bucket(i, item) ;
+        }
+    }
+    void buckets(const uint64_t *items, size_t n, uint64_t *out) const ;
+
+private:
+    uint64_t num_hashes, num_buckets ;
+    std::vector<uint64_t> tables ; // num_hashes * num_chars * char_range random words
+};
+
+class DoubleHash {
+    /*
+     * Computes one 128-bit hash (h1, h2) per item and derives every row from it as
+     * g_i(x) = h1 + i * h2 (Kirsch & Mitzenmacher, "Less Hashing, Same Performance").
+     * Hashing an item is O(1) rather than O(num_hashes), which is where most of the update time goes
+     * for deep sketches. The 128-bit hash is MurmurHash3_x64_128 specialised to 8-byte keys, keyed by the seed.
+     */
+public:
+    DoubleHash(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    static uint64_t family_id() { return DOUBLE_HASH_ID ; }
+    static bool rows_share_hash() { return true ; }
+    static const char* name() { return "double-hashing" ; }
+
+    static uint64_t fmix64(uint64_t k){
+        k ^= k >> 33 ;
+        k *= 0xff51afd7ed558ccdULL ;
+        k ^= k >> 33 ;
+        k *= 0xc4ceb9fe1a85ec53ULL ;
+        k ^= k >> 33 ;
+        return k ;
+    }
+    void hash128(uint64_t item, uint64_t &h1, uint64_t &h2) const {
+        uint64_t k = item * 0x87c37b91114253d5ULL ;
+        k = (k << 31) | (k >> 33) ;
+        k *= 0x4cf5ad432745937fULL ;
+        h1 = key ^ k ;
+        h2 = key ;
+        h1 ^= 8 ;
+        h2 ^= 8 ;
+        h1 += h2 ;
+        h2 += h1 ;
+        h1 = fmix64(h1) ;
+        h2 = fmix64(h2) ;
+        h1 += h2 ;
+        h2 += h1 ;
+        h2 |= 1 ; // an odd step visits distinct values of g_i for every row
+    }
+    uint64_t bucket(uint64_t row, uint64_t item) const {
+        uint64_t h1, h2 ;
+        hash128(item, h1, h2) ;
+        return reduce_to_range(h1 + row * h2, num_buckets) ;
+    }
+    void buckets(uint64_t item, uint64_t *out) const {
+        uint64_t h1, h2 ;
+        hash128(item, h1, h2) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i] = reduce_to_range(h1, num_buckets) ;
+            h1 += h2 ;
+        }
+    }
+    void buckets(const uint64_t *items, size_t n, uint64_t *out) const ;
+
+private:
+    uint64_t num_hashes, num_buckets ;
+    uint64_t key ;
+};
+
+class PrehashedKeys {
+    /*
+     * Bucket selection for keys that are already 64-bit hashes. Two seeded multiply-xor mixes of the key give
+     * (h1, h2) and the rows are g_i = h1 + i * h2 as in DoubleHash, so a key costs two multiplies however deep
+     * the sketch is. The multiplies carry every bit of the key into the high bits that reduce_to_range keeps,
+     * so sketches with different seeds still collide on different keys. The keys must already be well mixed:
+     * a structured key such as a small integer belongs on the item paths.
+     */
+public:
+    PrehashedKeys(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    static bool rows_share_hash() { return true ; }
+
+    void mix(uint64_t h, uint64_t &h1, uint64_t &h2) const {
+        h1 = (h ^ key1) * mult1 ;
+        h2 = ((h ^ key2) * mult2) | 1 ; // odd, as for DoubleHash
+    }
+    uint64_t bucket(uint64_t row, uint64_t h) const {
+        uint64_t h1, h2 ;
+        mix(h, h1, h2) ;
+        return reduce_to_range(h1 + row * h2, num_buckets) ;
+    }
+    void buckets(uint64_t h, uint64_t *out) const {
+        uint64_t h1, h2 ;
+        mix(h, h1, h2) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            out[i] = reduce_to_range(h1, num_buckets) ;
+            h1 += h2 ;
+        }
+    }
+    void buckets(const uint64_t *hashes, size_t n, uint64_t *out) const ;
+
+private:
+    uint64_t num_hashes, num_buckets ;
+    uint64_t key1, key2, mult1, mult2 ; // the multipliers are odd
+};
+
+#endif //LINEARSKETCHES_HASH_FAMILIES_H
@@ -0,0 +1,57 @@
+//
+// Builds a CountMin sketch from a key file in parallel (see file_ingest.h) and writes it with serialize.
+//
+// Usage: LinearSketchesIngest KEYS [--binary] [--threads T] [--chunk-mb M] [--hashes H] [--buckets W] [--output OUT]
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "count_min_sketch.h"
+#include "file_ingest.h"
+
+int main(int argc, char **argv){
+    if(argc < 2){
+        std::cerr << "usage: LinearSketchesIngest KEYS [--binary] [--threads T] [--chunk-mb M] [--hashes H] [--buckets W] [--output OUT]\n" ;
+        return 2 ;
+    }
+    IngestOptions options ;
+    uint64_t num_hashes = 4, num_buckets = 1 << 20 ;
+    std::string output ;
+    for(int k=2; k < argc; k++){
+        bool has_value = (k + 1 < argc) ;
+        if(std::strcmp(argv[k], "--binary") == 0){
+            options.format = KEY_FILE_BINARY ;
+        } else if(has_value && std::strcmp(argv[k], "--threads") == 0){
+            options.threads = unsigned(std::atoi(argv[++k])) ;
+        } else if(has_value && std::strcmp(argv[k], "--chunk-mb") == 0){
+            options.chunk_bytes = size_t(std::strtoull(argv[++k], nullptr, 10)) << 20 ;
+        } else if(has_value && std::strcmp(argv[k], "--hashes") == 0){
+            num_hashes = std::strtoull(argv[++k], nullptr, 10) ;
+        } else if(has_value && std::strcmp(argv[k], "--buckets") == 0){
+            num_buckets = std::strtoull(argv[++k], nullptr, 10) ;
+        } else if(has_value && std::strcmp(argv[k], "--output") == 0){
+            output = argv[++k] ;
+        } else {
+            std::cerr << "unknown option " << argv[k] << "\n" ;
+            return 2 ;
+        }
+    }
+    try {
+        CountMinSketch sketch(num_hashes, num_buckets, 1) ;
+        IngestStats stats = ingest_key_file(argv[1], sketch, options) ;
+        std::cout << stats.keys << " keys from " << stats.bytes << " bytes in " << stats.chunks << " chunks, "
+                  << stats.seconds << " s (" << stats.bytes_per_second / 1e9 << " GB/s, "
+                  << double(stats.keys) / stats.seconds / 1e6 << " M keys/s)\n" ;
+        if(!output.empty()){
+            std::ofstream out(output, std::ios::binary) ;
+            sketch.serialize(out) ;
+        }
+    } catch(const std::exception &e){
+        std::cerr << e.what() << "\n" ;
+        return 1 ;
+    }
+    return 0 ;
+}
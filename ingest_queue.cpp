@@ -0,0 +1,292 @@
+//
+// Ingestion front end with per-producer rings and a dedicated updater thread.
+//
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "ingest_queue.h"
+
+namespace {
+    // An idle updater re-checks the rings at least this often, bounding the cost of a missed wake-up.
+    const std::chrono::microseconds idle_wait(500) ;
+    const unsigned idle_spins = 64 ;
+
+    size_t round_up_pow2(size_t n){
+        size_t p = 1 ;
+        while(p < n){
+            p <<= 1 ;
+        }
+        return p ;
+    }
+}
+
+template <class Sketch>
+struct IngestQueue<Sketch>::Ring {
+    /*
+     * Single-producer single-consumer ring. tail is written only by the producer and head only by the updater;
+     * each side keeps a private copy of the other's index and reloads it only when the ring looks full or empty.
+     * The padding keeps the two sides' indices on separate cache lines.
+     */
+    explicit Ring(size_t capacity) : tail(0), head(0), items(capacity), weights(capacity), mask(capacity - 1),
+                                     spilled(0), spill_applied(0), dropped(0) {}
+
+    std::atomic<uint64_t> tail ;
+    uint64_t cached_head = 0 ; // producer's view of head
+    char producer_pad[64] ;
+    std::atomic<uint64_t> head ;
+    char consumer_pad[64] ;
+    std::vector<uint64_t> items ;
+    std::vector<int64_t> weights ;
+    const uint64_t mask ;
+
+    std::mutex spill_mutex ;
+    std::vector<uint64_t> spill_items ;
+    std::vector<int64_t> spill_weights ;
+    std::atomic<uint64_t> spilled ; // items ever spilled, written under spill_mutex
+    std::atomic<uint64_t> spill_applied ;
+    std::atomic<uint64_t> dropped ;
+};
+
+template <class Sketch>
+IngestQueue<Sketch>::IngestQueue(Sketch &sketch, const IngestQueueOptions &options):
+    sketch(sketch), options(options), updater_idle(false), stopping(false), flush_waiters(0){
+    if(options.producers == 0 || options.ring_capacity == 0 || options.batch == 0){
+        throw std::invalid_argument( "Producers, ring capacity and batch size must be positive." );
+    }
+    const size_t capacity = round_up_pow2(options.ring_capacity) ;
+    for(unsigned p=0; p < options.producers; p++){
+        rings.emplace_back(new Ring(capacity)) ;
+    }
+    updater = std::thread(&IngestQueue::run, this) ;
+}
+
+template <class Sketch>
+IngestQueue<Sketch>::~IngestQueue(){
+    stop() ;
+}
+
+template <class Sketch>
+void IngestQueue<Sketch>::stop(){
+    if(stopping.exchange(true)){
+        return ;
+    }
+    wake_updater() ;
+    updater.join() ;
+}
+
+template <class Sketch>
+void IngestQueue<Sketch>::wake_updater(){
+    if(updater_idle.load()){
+        std::lock_guard<std::mutex> lock(wait_mutex) ;
+        wake.notify_one() ;
+    }
+}
+
+template <class Sketch>
+size_t IngestQueue<Sketch>::push(unsigned producer, uint64_t item, int64_t weight){
+    return push_batch(producer, &item, &weight, 1) ;
+}
+
+template <class Sketch>
+size_t IngestQueue<Sketch>::push_batch(unsigned producer, const uint64_t *items, const int64_t *weights, size_t n){
+    /*
+     * Copies as much as fits, publishes it with one release store of tail and then applies the backpressure
+     * policy to the rest. Pushes after stop are refused.
+     */
+    if(producer >= rings.size()){
+        throw std::invalid_argument( "No such producer." );
+    }
+    Ring &ring = *rings[producer] ;
+    const uint64_t capacity = ring.mask + 1 ;
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed) ;
+    size_t done = 0 ;
+    while(done < n && !stopping.load(std::memory_order_relaxed)){
+        if(tail - ring.cached_head == capacity){
+            ring.cached_head = ring.head.load(std::memory_order_acquire) ;
+        }
+        size_t len = std::min<uint64_t>(n - done, capacity - (tail - ring.cached_head)) ;
+        if(len == 0){
+            if(options.policy == BACKPRESSURE_DROP){
+                ring.dropped.fetch_add(n - done, std::memory_order_relaxed) ;
+                break ;
+            }
+            if(options.policy == BACKPRESSURE_SPILL){
+                std::lock_guard<std::mutex> lock(ring.spill_mutex) ;
+                ring.spill_items.insert(ring.spill_items.end(), items + done, items + n) ;
+                if(weights == nullptr){
+                    ring.spill_weights.insert(ring.spill_weights.end(), n - done, 1) ;
+                } else {
+                    ring.spill_weights.insert(ring.spill_weights.end(), weights + done, weights + n) ;
+                }
+                ring.spilled.fetch_add(n - done, std::memory_order_release) ;
+                done = n ;
+                break ;
+            }
+            wake_updater() ;
+            std::this_thread::yield() ;
+            continue ;
+        }
+        for(size_t k=0; k < len; k++){
+            uint64_t slot = (tail + k) & ring.mask ;
+            ring.items[slot] = items[done + k] ;
+            ring.weights[slot] = (weights == nullptr) ? 1 : weights[done + k] ;
+        }
+        tail += len ;
+        done += len ;
+        ring.tail.store(tail, std::memory_order_release) ;
+    }
+    wake_updater() ;
+    return done ;
+}
+
+template <class Sketch>
+bool IngestQueue<Sketch>::drain(Ring &ring){
+    /*
+     * Applies everything published in the ring, in contiguous runs of at most batch items, then the spill list.
+     * Returns true if anything was applied.
+     */
+    uint64_t head = ring.head.load(std::memory_order_relaxed) ;
+    const uint64_t tail = ring.tail.load(std::memory_order_acquire) ;
+    bool progress = (head != tail) ;
+    while(head != tail){
+        uint64_t slot = head & ring.mask ;
+        size_t len = std::min<uint64_t>(std::min<uint64_t>(tail - head, options.batch), ring.mask + 1 - slot) ;
+        {
+            std::lock_guard<std::mutex> lock(sketch_mutex) ;
+            sketch.update_batch(&ring.items[slot], &ring.weights[slot], len) ;
+        }
+        head += len ;
+        ring.head.store(head, std::memory_order_release) ;
+    }
+    if(ring.spilled.load(std::memory_order_acquire) != ring.spill_applied.load(std::memory_order_relaxed)){
+        std::vector<uint64_t> items ;
+        std::vector<int64_t> weights ;
+        uint64_t spilled ;
+        {
+            std::lock_guard<std::mutex> lock(ring.spill_mutex) ;
+            items.swap(ring.spill_items) ;
+            weights.swap(ring.spill_weights) ;
+            spilled = ring.spilled.load(std::memory_order_relaxed) ;
+        }
+        for(size_t start=0; start < items.size(); start += options.batch){
+            std::lock_guard<std::mutex> lock(sketch_mutex) ;
+            sketch.update_batch(items.data() + start, weights.data() + start, std::min(options.batch, items.size() - start)) ;
+        }
+        ring.spill_applied.store(spilled, std::memory_order_release) ;
+        progress = true ;
+    }
+    return progress ;
+}
+
+template <class Sketch>
+void IngestQueue<Sketch>::run(){
+    unsigned spins = 0 ;
+    while(true){
+        bool progress = false ;
+        for(std::unique_ptr<Ring> &ring : rings){
+            progress |= drain(*ring) ;
+        }
+        if(progress){
+            spins = 0 ;
+            if(flush_waiters.load() > 0){
+                std::lock_guard<std::mutex> lock(wait_mutex) ;
+                drained.notify_all() ;
+            }
+            continue ;
+        }
+        if(stopping.load()){
+            // One last pass: producers may have published between the drain above and seeing stopping.
+            for(std::unique_ptr<Ring> &ring : rings){
+                drain(*ring) ;
+            }
+            std::lock_guard<std::mutex> lock(wait_mutex) ;
+            updater_done = true ;
+            drained.notify_all() ;
+            return ;
+        }
+        if(++spins < idle_spins){
+            std::this_thread::yield() ;
+            continue ;
+        }
+        std::unique_lock<std::mutex> lock(wait_mutex) ;
+        updater_idle.store(true) ;
+        wake.wait_for(lock, idle_wait) ;
+        updater_idle.store(false) ;
+    }
+}
+
+template <class Sketch>
+void IngestQueue<Sketch>::flush(){
+    /*
+     * Records how far every ring and spill list has been published and waits for the updater to get that far.
+     */
+    std::vector<uint64_t> tails, spills ;
+    for(std::unique_ptr<Ring> &ring : rings){
+        tails.push_back(ring->tail.load(std::memory_order_acquire)) ;
+        spills.push_back(ring->spilled.load(std::memory_order_acquire)) ;
+    }
+    auto done = [&](){
+        for(size_t p=0; p < rings.size(); p++){
+            if(rings[p]->head.load(std::memory_order_acquire) < tails[p]
+               || rings[p]->spill_applied.load(std::memory_order_acquire) < spills[p]){
+                return false ;
+            }
+        }
+        return true ;
+    } ;
+    flush_waiters.fetch_add(1) ;
+    {
+        std::unique_lock<std::mutex> lock(wait_mutex) ;
+        wake.notify_one() ;
+        while(!done() && !updater_done){
+            drained.wait_for(lock, idle_wait) ;
+        }
+    }
+    flush_waiters.fetch_sub(1) ;
+}
+
+template <class Sketch>
+int64_t IngestQueue<Sketch>::get_estimate(uint64_t item){
+    std::lock_guard<std::mutex> lock(sketch_mutex) ;
+    return sketch.get_estimate(item) ;
+}
+
+template <class Sketch>
+void IngestQueue<Sketch>::get_estimates(const uint64_t *items, size_t n, int64_t *estimates){
+    std::lock_guard<std::mutex> lock(sketch_mutex) ;
+    sketch.get_estimates(items, n, estimates) ;
+}
+
+template <class Sketch>
+int64_t IngestQueue<Sketch>::get_total_weight(){
+    std::lock_guard<std::mutex> lock(sketch_mutex) ;
+    return sketch.get_total_weight() ;
+}
+
+template <class Sketch>
+uint64_t IngestQueue<Sketch>::get_num_dropped() const {
+    uint64_t total = 0 ;
+    for(const std::unique_ptr<Ring> &ring : rings){
+        total += ring->dropped.load(std::memory_order_relaxed) ;
+    }
+    return total ;
+}
+
+template <class Sketch>
+uint64_t IngestQueue<Sketch>::get_num_spilled() const {
+    uint64_t total = 0 ;
+    for(const std::unique_ptr<Ring> &ring : rings){
+        total += ring->spilled.load(std::memory_order_relaxed) ;
+    }
+    return total ;
+}
+
+template class IngestQueue<CountMinSketch> ;
+template class IngestQueue<MultiplyShiftCountMinSketch> ;
+template class IngestQueue<TabulationCountMinSketch> ;
+template class IngestQueue<DoubleHashCountMinSketch> ;
+template class IngestQueue<BlockedCountMinSketch8> ;
+template class IngestQueue<BlockedCountMinSketch16> ;
+template class IngestQueue<BlockedCountMinSketch32> ;
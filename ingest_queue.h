@@ -0,0 +1,81 @@
+//
+// Ingestion front end that keeps producer threads off the sketch table.
+// Each producer owns a single-producer ring of (item, weight) pairs. One updater thread owns the sketch, drains
+// the rings in turn and applies what it finds through update_batch, so the table stays in that core's cache and
+// producers only ever write to their own ring. Pushing is wait-free unless the ring is full, when the
+// backpressure policy decides:
+//     BACKPRESSURE_BLOCK  wait for the updater to free space
+//     BACKPRESSURE_DROP   discard the items that do not fit and count them
+//     BACKPRESSURE_SPILL  append them to the producer's unbounded, mutex-guarded overflow list
+// flush waits until everything pushed before it has been applied, so a query made after flush sees the caller's
+// own writes. Queries take the sketch lock, which the updater holds only while applying a batch.
+//
+
+#ifndef LINEARSKETCHES_INGEST_QUEUE_H
+#define LINEARSKETCHES_INGEST_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum BackpressurePolicy {
+    BACKPRESSURE_BLOCK,
+    BACKPRESSURE_DROP,
+    BACKPRESSURE_SPILL
+};
+
+struct IngestQueueOptions {
+    unsigned producers = 1 ; // producer p may only be pushed to by one thread at a time
+    size_t ring_capacity = size_t(1) << 16 ; // entries per producer, rounded up to a power of two
+    BackpressurePolicy policy = BACKPRESSURE_BLOCK ;
+    size_t batch = 4096 ; // most items per update_batch call
+};
+
+template <class Sketch>
+class IngestQueue {
+public:
+    IngestQueue(Sketch &sketch, const IngestQueueOptions &options) ; // starts the updater; sketch is its own until stop
+    ~IngestQueue() ; // see stop
+    IngestQueue(const IngestQueue&) = delete ;
+    IngestQueue& operator=(const IngestQueue&) = delete ;
+
+    // Both return the number of items accepted, which is less than n only under BACKPRESSURE_DROP or after stop.
+    size_t push(unsigned producer, uint64_t item, int64_t weight=1) ;
+    size_t push_batch(unsigned producer, const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr
+    void flush() ; // returns once every item pushed before the call has been applied
+    void stop() ; // applies everything pushed so far and joins the updater; call it once producers are done
+                  // since later pushes are refused and pushes racing with it may be lost
+
+    int64_t get_estimate(uint64_t item) ;
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) ;
+    int64_t get_total_weight() ;
+    uint64_t get_num_dropped() const ;
+    uint64_t get_num_spilled() const ;
+
+private:
+    struct Ring ;
+
+    Sketch &sketch ;
+    IngestQueueOptions options ;
+    std::vector<std::unique_ptr<Ring> > rings ;
+    std::mutex sketch_mutex ; // held by the updater while it applies a batch
+    std::mutex wait_mutex ; // pairs with wake and drained
+    std::condition_variable wake ; // wakes an idle updater
+    std::condition_variable drained ; // wakes flush after the updater makes progress
+    std::atomic<bool> updater_idle ;
+    std::atomic<bool> stopping ;
+    std::atomic<unsigned> flush_waiters ;
+    bool updater_done = false ; // guarded by wait_mutex
+    std::thread updater ;
+
+    void run() ;
+    bool drain(Ring &ring) ;
+    void wake_updater() ;
+};
+
+#endif //LINEARSKETCHES_INGEST_QUEUE_H
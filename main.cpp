@@ -2,9 +2,39 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <type_traits>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "counting_sketches.h"
 #include "count_min_sketch.h"
+#include "blocked_count_min_sketch.h"
+#include "numa_placement.h"
+#include "numa_replicas.h"
+#include "snapshot_count_min_sketch.h"
+#include "table_codec.h"
+#include "async_checkpointer.h"
+#include "sketch_metrics.h"
+#include "stream_generators.h"
+#include "accuracy_harness.h"
+#include "sketch_trace.h"
+#include "file_ingest.h"
 #include "catch.hpp"
+#include "sketch_daemon.h"
+#include "shared_count_min_sketch.h"
+#include "ingest_queue.h"
+#include "parallel_update.h"
+#include "async_queries.h"
+#include "sampled_sketch.h"
+#include "sketch_ref.h"
 
 
 using namespace std ;
@@ -30,7 +60,7 @@ TEST_CASE("Testing COUNTING SKETCH constructors", "[constructors]"){
             REQUIRE(s[i][j] == 0) ;
         }
     } // end loop through sketch
-    REQUIRE(C.get_estimate(100) == 0) ;  // any item should have frequency of zero before population
+    REQUIRE(C.get_total_weight() == 0) ;  // point queries belong to the concrete sketches, see sketch_ref.h
 
 }
 
@@ -68,8 +98,10 @@ TEST_CASE("Testing COUNT MIN after updates", "[updates]"){
     REQUIRE(C.get_total_weight() == 0) ;
     float sketch_epsilon = C.get_epsilon() ;
 
-    // ensure sketch does not accept negative **items**
-    REQUIRE_THROWS(C.update(-1), "Item must be nonnegative.") ;
+    // items are unsigned 64-bit keys like on every other entry point, so the top of the range is a valid item
+    CountMinSketch top(n_hashes, n_buckets, seed) ;
+    top.update(~uint64_t(0)) ;
+    REQUIRE(top.get_estimate(~uint64_t(0)) == 1) ;
 
     // Update with weight of 1 implicitly defined
     int64_t x = 1 ;
@@ -224,6 +256,1366 @@ TEST_CASE("Testing COUNT MIN SKETCH merged stream", "[performance - merge]"){
 
 }
 
+template <class Sketch>
+void check_batched_paths(uint64_t n_hashes, uint64_t n_buckets, uint64_t seed){
+    /*
+     * The scalar and batched entry points of a sketch (and of its hash family) must agree.
+     */
+    Sketch scalar(n_hashes, n_buckets, seed) ;
+    Sketch batched(n_hashes, n_buckets, seed) ;
+    std::vector<uint64_t> items ;
+    std::vector<int64_t> weights ;
+    for(uint64_t i=0; i < 1000; i++){
+        items.push_back(i * 2654435761ULL) ;
+        weights.push_back(i % 7 + 1) ;
+    }
+    std::vector<uint64_t> row_major(n_hashes * items.size()) ;
+    std::vector<uint64_t> single(n_hashes) ;
+    scalar.get_hash_family().buckets(items.data(), items.size(), row_major.data()) ;
+    for(size_t k=0; k < items.size(); k++){
+        scalar.get_hash_family().buckets(items[k], single.data()) ;
+        for(uint64_t i=0; i < n_hashes; i++){
+            REQUIRE(single[i] < n_buckets) ;
+            REQUIRE(single[i] == row_major[i * items.size() + k]) ;
+            REQUIRE(single[i] == scalar.get_hash_family().bucket(i, items[k])) ;
+        }
+    }
+
+    for(size_t k=0; k < items.size(); k++){
+        scalar.update(items[k], weights[k]) ;
+    }
+    batched.update_batch(items.data(), weights.data(), items.size()) ;
+    REQUIRE(scalar.get_table() == batched.get_table()) ;
+    REQUIRE(scalar.get_total_weight() == batched.get_total_weight()) ;
+
+    std::vector<int64_t> estimates(items.size()) ;
+    batched.get_estimates(items.data(), items.size(), estimates.data()) ;
+    for(size_t k=0; k < items.size(); k++){
+        REQUIRE(estimates[k] == scalar.get_estimate(items[k])) ;
+        REQUIRE(estimates[k] >= weights[k]) ;
+    }
+}
+
+TEST_CASE("Testing hash family policies", "[hashing]"){
+    std::cout << "Testing hash family policies." << std::endl ;
+    check_batched_paths<MultiplyShiftCountMinSketch>(4, 100, 7) ;
+    check_batched_paths<CountMinSketch>(4, 100, 7) ;
+    check_batched_paths<TabulationCountMinSketch>(4, 100, 7) ;
+
+    // The family is part of the config.
+    REQUIRE(CountMinSketch(2, 5, 1).get_config()[3] == MERSENNE_PRIME_HASH_ID) ;
+    REQUIRE(MultiplyShiftCountMinSketch(2, 5, 1).get_config()[3] == MULTIPLY_SHIFT_HASH_ID) ;
+    REQUIRE(TabulationCountMinSketch(2, 5, 1).get_config()[3] == TABULATION_HASH_ID) ;
+    REQUIRE_THROWS(MultiplyShiftCountMinSketch(2, uint64_t(1) << 32, 1)) ;
+}
+
+TEST_CASE("Testing COUNT MIN serialization", "[serialization]"){
+    std::cout << "Testing COUNT MIN serialization." << std::endl ;
+    CountMinSketch s(3, 50, 11) ;
+    for(uint64_t i=0; i < 200; i++){
+        s.update(i % 37, i % 3 + 1) ;
+    }
+    std::stringstream buffer ;
+    s.serialize(buffer) ;
+    std::string bytes = buffer.str() ;
+
+    std::stringstream in(bytes) ;
+    CountMinSketch t = CountMinSketch::deserialize(in) ;
+    REQUIRE(t.get_config() == s.get_config()) ;
+    REQUIRE(t.get_total_weight() == s.get_total_weight()) ;
+    REQUIRE(t.get_table() == s.get_table()) ;
+    for(uint64_t i=0; i < 37; i++){
+        REQUIRE(t.get_estimate(i) == s.get_estimate(i)) ;
+    }
+
+    // A sketch built with a different hash family must be rejected.
+    std::stringstream mixed(bytes) ;
+    REQUIRE_THROWS(TabulationCountMinSketch::deserialize(mixed), "Incompatible hash family.") ;
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 8)) ;
+    REQUIRE_THROWS(CountMinSketch::deserialize(truncated)) ;
+}
+
+template <class Sketch>
+double mean_absolute_error(uint64_t n_hashes, uint64_t n_buckets, uint64_t seed,
+                           const std::vector<uint64_t> &items, const std::vector<int64_t> &frequencies){
+    /*
+     * Builds a sketch over items[k] with weight frequencies[k] and returns the mean of est(f_k) - f_k.
+     */
+    Sketch sketch(n_hashes, n_buckets, seed) ;
+    sketch.update_batch(items.data(), frequencies.data(), items.size()) ;
+    double total_error = 0. ;
+    for(size_t k=0; k < items.size(); k++){
+        int64_t est = sketch.get_estimate(items[k]) ;
+        REQUIRE(est >= frequencies[k]) ;
+        total_error += est - frequencies[k] ;
+    }
+    return total_error / items.size() ;
+}
+
+TEST_CASE("Testing double hashing accuracy against independent hashing", "[hashing]"){
+    /*
+     * Deriving every row from one 128-bit hash should not cost accuracy: over a skewed stream the
+     * mean overestimate of double hashing should be close to that of independent rows.
+     */
+    std::cout << "Testing double hashing accuracy." << std::endl ;
+    check_batched_paths<DoubleHashCountMinSketch>(5, 100, 7) ;
+
+    uint64_t n_hashes = 5 ;
+    uint64_t n_buckets = 200 ;
+    std::vector<uint64_t> items ;
+    std::vector<int64_t> frequencies ;
+    for(uint64_t i=1; i <= 5000; i++){
+        items.push_back(i * 0x9E3779B97F4A7C15ULL) ;
+        frequencies.push_back(1 + 10000 / i) ;
+    }
+
+    double independent_error = 0., double_hash_error = 0. ;
+    for(uint64_t seed=0; seed < 10; seed++){
+        independent_error += mean_absolute_error<CountMinSketch>(n_hashes, n_buckets, seed, items, frequencies) ;
+        double_hash_error += mean_absolute_error<DoubleHashCountMinSketch>(n_hashes, n_buckets, seed, items, frequencies) ;
+    }
+    std::cout << "Independent hashing mean error: " << independent_error / 10
+              << "  Double hashing mean error: " << double_hash_error / 10 << std::endl ;
+    REQUIRE(double_hash_error <= 1.1 * independent_error) ;
+    REQUIRE(independent_error <= 1.1 * double_hash_error) ;
+}
+
+TEST_CASE("Testing BLOCKED COUNT MIN sketch", "[blocked]"){
+    std::cout << "Testing BLOCKED COUNT MIN sketch." << std::endl ;
+    float relative_error = 0.05 ;
+    float confidence = 0.9 ;
+    uint64_t n_hashes = BlockedCountMinSketch16::suggest_num_hashes(confidence) ;
+    uint64_t n_blocks = BlockedCountMinSketch16::suggest_num_blocks(relative_error, n_hashes) ;
+    uint64_t seed = 3 ;
+    BlockedCountMinSketch16 s(n_hashes, n_blocks, seed) ;
+    REQUIRE(s.get_epsilon() <= relative_error) ;
+    REQUIRE(s.get_confidence() >= confidence) ;
+    REQUIRE(s.get_segment_width() * n_hashes <= BlockedCountMinSketch16::counters_per_block) ;
+    REQUIRE(s.get_memory_bytes() == 64 * n_blocks) ;
+    REQUIRE_THROWS(BlockedCountMinSketch16(33, 10, seed)) ;
+    REQUIRE_THROWS(s.update(1, -1), "Weight must be nonnegative.") ;
+
+    std::vector<uint64_t> items ;
+    std::vector<int64_t> frequencies ;
+    for(uint64_t i=1; i <= 2000; i++){
+        items.push_back(i) ;
+        frequencies.push_back(1 + 500 / i) ;
+    }
+    for(size_t k=0; k < items.size(); k++){
+        s.update(items[k], frequencies[k]) ;
+    }
+    BlockedCountMinSketch16 t(n_hashes, n_blocks, seed) ;
+    t.update_batch(items.data(), frequencies.data(), items.size()) ;
+    REQUIRE(t.get_total_weight() == s.get_total_weight()) ;
+
+    std::vector<int64_t> estimates(items.size()) ;
+    t.get_estimates(items.data(), items.size(), estimates.data()) ;
+    uint64_t failures = 0 ;
+    for(size_t k=0; k < items.size(); k++){
+        REQUIRE(estimates[k] == s.get_estimate(items[k])) ;
+        REQUIRE(estimates[k] >= frequencies[k]) ;
+        REQUIRE(s.get_lower_bound(items[k]) <= frequencies[k] + 1) ;
+        if(estimates[k] > frequencies[k] + s.get_epsilon() * s.get_total_weight()){
+            failures++ ;
+        }
+    }
+    REQUIRE(failures <= s.get_delta() * items.size()) ;
+
+    s.merge(t) ;
+    REQUIRE(s.get_total_weight() == 2 * t.get_total_weight()) ;
+    REQUIRE(s.get_estimate(1) >= 2 * frequencies[0]) ;
+    REQUIRE_THROWS(s.merge(s), "Cannot merge a sketch with itself.") ;
+    REQUIRE_THROWS(s.merge(BlockedCountMinSketch16(n_hashes, n_blocks, seed + 1)), "Incompatible sketch config.") ;
+
+    // 8-bit counters saturate rather than wrap.
+    BlockedCountMinSketch8 small(4, 16, seed) ;
+    small.update(7, 200) ;
+    small.update(7, 200) ;
+    REQUIRE(small.is_saturated(7)) ;
+    REQUIRE(small.get_estimate(7) == 255) ;
+    REQUIRE(small.get_upper_bound(7) == std::numeric_limits<int64_t>::max()) ;
+
+    // With one row and one block, row 0 spans the whole block and every offset, even ones included, gets used.
+    BlockedCountMinSketch8 one_row(1, 1, seed) ;
+    REQUIRE(one_row.get_segment_width() == BlockedCountMinSketch8::counters_per_block) ;
+    one_row.update_batch(items.data(), nullptr, items.size()) ;
+    REQUIRE(one_row.get_occupancy().nonzero == BlockedCountMinSketch8::counters_per_block) ;
+}
+
+TEST_CASE("Testing sketch reset and large tables", "[reset]"){
+    std::cout << "Testing sketch reset and large tables." << std::endl ;
+    // Small tables live on the heap and are cleared with memset.
+    CountMinSketch s(3, 50, 1) ;
+    for(uint64_t i=0; i < 100; i++){
+        s.update(i, 2) ;
+    }
+    CountMinSketch copy = s ;
+    s.reset() ;
+    REQUIRE(s.get_total_weight() == 0) ;
+    for(auto &row : s.get_table()){
+        for(int64_t c : row){
+            REQUIRE(c == 0) ;
+        }
+    }
+    REQUIRE(copy.get_estimate(5) >= 2) ; // copies own their table
+
+    // A 64MB table is mapped lazily and reset by releasing its pages.
+    uint64_t n_buckets = uint64_t(1) << 21 ;
+    CountMinSketch large(4, n_buckets, 1) ;
+    REQUIRE(large.get_memory_bytes() == 4 * n_buckets * sizeof(int64_t)) ;
+    large.use_huge_pages() ;
+    for(uint64_t i=0; i < 1000; i++){
+        large.update(i, 3) ;
+    }
+    REQUIRE(large.get_estimate(10) >= 3) ;
+    large.reset() ;
+    REQUIRE(large.get_total_weight() == 0) ;
+    for(uint64_t i=0; i < 1000; i++){
+        REQUIRE(large.get_estimate(i) == 0) ;
+    }
+    large.update(10) ;
+    REQUIRE(large.get_estimate(10) == 1) ;
+
+    BlockedCountMinSketch16 blocked(4, 100, 1) ;
+    blocked.update(3, 10) ;
+    blocked.reset() ;
+    REQUIRE(blocked.get_estimate(3) == 0) ;
+    REQUIRE(blocked.get_total_weight() == 0) ;
+}
+
+TEST_CASE("Testing NUMA placement and read replicas", "[numa]"){
+    std::cout << "Testing NUMA placement and read replicas." << std::endl ;
+    REQUIRE(get_num_numa_nodes() >= 1) ;
+    REQUIRE(get_current_numa_node() < get_num_numa_nodes()) ;
+
+    // Placement is best effort (containers often forbid mbind) but must never disturb the sketch.
+    CountMinSketch large(4, uint64_t(1) << 16, 1) ;
+    large.interleave_across_nodes() ;
+    CountMinSketch small(3, 50, 1) ;
+    REQUIRE_FALSE(small.interleave_across_nodes()) ; // heap tables are never re-bound
+    for(uint64_t i=0; i < 100; i++){
+        large.update(i) ;
+        small.update(i) ;
+    }
+    REQUIRE(large.get_estimate(7) >= 1) ;
+
+    NumaReadReplicas<CountMinSketch> replicas(small, std::chrono::milliseconds(0)) ;
+    REQUIRE(replicas.get_num_replicas() == get_num_numa_nodes()) ;
+    REQUIRE(replicas.get_total_weight() == small.get_total_weight()) ;
+    for(uint64_t i=0; i < 100; i++){
+        REQUIRE(replicas.get_estimate(i) == small.get_estimate(i)) ;
+    }
+
+    // Readers keep a consistent replica until the owner refreshes.
+    std::shared_ptr<CountMinSketch> held = replicas.get_replica(0) ;
+    small.update(5, 10) ;
+    REQUIRE(replicas.get_estimate(5) == small.get_estimate(5) - 10) ;
+    REQUIRE(replicas.maybe_refresh(small)) ;
+    REQUIRE(replicas.get_estimate(5) == small.get_estimate(5)) ;
+    REQUIRE(held->get_total_weight() == 100) ;
+
+    NumaReadReplicas<CountMinSketch> slow(small, std::chrono::milliseconds(3600 * 1000)) ;
+    REQUIRE_FALSE(slow.maybe_refresh(small)) ;
+
+    // Replicas of a pre-hashed sketch take pre-hashed keys too.
+    CountMinSketch hashed(3, 50, 1) ;
+    hashed.enable_prehashed_keys() ;
+    hashed.update_hashed(0x9e3779b97f4a7c15ULL, 3) ;
+    NumaReadReplicas<CountMinSketch> hashed_replicas(hashed, std::chrono::milliseconds(0)) ;
+    REQUIRE(hashed_replicas.get_replica(0)->get_key_mode() == PREHASHED_KEYS) ;
+    REQUIRE(hashed_replicas.get_replica(0)->get_estimate_hashed(0x9e3779b97f4a7c15ULL) == 3) ;
+}
+
+TEST_CASE("Testing COUNT MIN snapshots", "[snapshots]"){
+    std::cout << "Testing COUNT MIN snapshots." << std::endl ;
+    uint64_t n_hashes = 4 ;
+    uint64_t n_buckets = 1000 ;
+    uint64_t seed = 5 ;
+    SnapshotCountMinSketch s(n_hashes, n_buckets, seed) ;
+    CountMinSketch reference(n_hashes, n_buckets, seed) ;
+    REQUIRE(s.latest_snapshot()->get_total_weight() == 0) ;
+
+    for(uint64_t i=0; i < 500; i++){
+        s.update(i, 2) ;
+        reference.update(i, 2) ;
+    }
+    std::shared_ptr<const SnapshotCountMinSketch::snapshot_type> first = s.snapshot() ;
+    REQUIRE(first == s.latest_snapshot()) ;
+    REQUIRE(first->get_total_weight() == 1000) ;
+    REQUIRE(first->get_table() == reference.get_table()) ;
+
+    // Later writes copy pages and leave the snapshot untouched.
+    for(uint64_t i=0; i < 500; i++){
+        s.update(i, 1) ;
+    }
+    REQUIRE(first->get_total_weight() == 1000) ;
+    REQUIRE(first->get_table() == reference.get_table()) ;
+    std::vector<uint64_t> items = {0, 1, 2, 3} ;
+    std::vector<int64_t> estimates(items.size()) ;
+    first->get_estimates(items.data(), items.size(), estimates.data()) ;
+    for(size_t k=0; k < items.size(); k++){
+        REQUIRE(estimates[k] == reference.get_estimate(items[k])) ;
+        REQUIRE(s.get_estimate(items[k]) >= 3) ;
+    }
+
+    // A requested snapshot is published by the writer's next update.
+    s.request_snapshot() ;
+    REQUIRE(s.latest_snapshot() == first) ;
+    s.update(1000) ;
+    REQUIRE(s.latest_snapshot()->get_total_weight() == 1500) ;
+
+    // Serialized snapshots load as ordinary sketches.
+    std::stringstream buffer ;
+    first->serialize(buffer) ;
+    CountMinSketch loaded = CountMinSketch::deserialize(buffer) ;
+    REQUIRE(loaded.get_table() == reference.get_table()) ;
+    REQUIRE(loaded.get_total_weight() == 1000) ;
+}
+
+TEST_CASE("Testing COUNT MIN snapshots during ingest", "[snapshots]"){
+    /*
+     * Every row of a CountMin table sums to the total weight, so a torn snapshot would show up as a row
+     * whose sum disagrees with the snapshot's total weight.
+     */
+    std::cout << "Testing COUNT MIN snapshots during ingest." << std::endl ;
+    SnapshotCountMinSketch s(3, 5000, 9) ;
+    std::atomic<bool> done(false) ;
+    std::thread writer([&](){
+        std::vector<uint64_t> batch(256) ;
+        for(uint64_t round=0; round < 400; round++){
+            for(uint64_t k=0; k < batch.size(); k++){
+                batch[k] = round * 7919 + k ;
+            }
+            s.update_batch(batch.data(), nullptr, batch.size()) ;
+            if(round % 10 == 0){
+                s.snapshot() ;
+            }
+        }
+        done = true ;
+    });
+    uint64_t checked = 0 ;
+    bool consistent = true ;
+    while(!done || checked == 0){
+        std::shared_ptr<const SnapshotCountMinSketch::snapshot_type> snap = s.latest_snapshot() ;
+        for(const std::vector<int64_t> &row : snap->get_table()){
+            int64_t row_sum = 0 ;
+            for(int64_t c : row){
+                row_sum += c ;
+            }
+            consistent = consistent && (row_sum == snap->get_total_weight()) ;
+        }
+        checked++ ;
+    }
+    writer.join() ;
+    REQUIRE(consistent) ;
+}
+
+TEST_CASE("Testing delta checkpoints", "[deltas]"){
+    std::cout << "Testing delta checkpoints." << std::endl ;
+    uint64_t n_hashes = 4 ;
+    uint64_t n_buckets = 10000 ; // 40000 counters, 79 blocks
+    uint64_t seed = 2 ;
+    CountMinSketch edge(n_hashes, n_buckets, seed) ;
+    CountMinSketch aggregator(n_hashes, n_buckets, seed) ;
+    REQUIRE_THROWS(edge.export_delta(0), "Delta tracking is not enabled.") ;
+    uint64_t epoch = edge.enable_delta_tracking() ;
+
+    std::vector<uint64_t> items ;
+    for(uint64_t i=0; i < 5000; i++){
+        items.push_back(i) ;
+    }
+    edge.update_batch(items.data(), nullptr, items.size()) ;
+    SketchDelta first = edge.export_delta(epoch) ;
+    REQUIRE(first.from_epoch == epoch) ;
+    REQUIRE(first.to_epoch == edge.get_delta_epoch()) ;
+    REQUIRE(first.total_weight == 5000) ;
+    REQUIRE_THROWS(edge.export_delta(epoch), "Delta base epoch is not retained.") ;
+
+    std::stringstream wire ;
+    first.serialize(wire) ;
+    aggregator.apply_delta(SketchDelta::deserialize(wire)) ;
+    REQUIRE(aggregator.get_table() == edge.get_table()) ;
+    REQUIRE(aggregator.get_total_weight() == edge.get_total_weight()) ;
+
+    // Block ids past the table are rejected before they are shifted or used as an index, and so are ids that
+    // do not increase in a serialized delta.
+    SketchDelta forged ;
+    forged.config = edge.get_config() ;
+    forged.block_ids = {1, uint64_t(1) << 55} ;
+    forged.counters.assign(2 * SketchDelta::block_counters, 1) ;
+    CountMinSketch tracked_target(n_hashes, n_buckets, seed) ;
+    tracked_target.enable_delta_tracking() ;
+    REQUIRE_THROWS(tracked_target.apply_delta(forged), "Malformed sketch delta.") ;
+    REQUIRE(tracked_target.get_occupancy().nonzero == 0) ;
+    forged.block_ids = {3, 3} ;
+    std::stringstream forged_wire ;
+    forged.serialize(forged_wire) ;
+    REQUIRE_THROWS(SketchDelta::deserialize(forged_wire), "Sketch delta block ids are not increasing.") ;
+
+    // A corrupt block count is rejected before anything is allocated for it.
+    std::string corrupt = wire.str() ;
+    uint64_t huge_blocks = uint64_t(1) << 50 ;
+    std::memcpy(&corrupt[4 + 4 + 8 + 4 * 8 + 3 * 8], &huge_blocks, sizeof(huge_blocks)) ;
+    std::stringstream corrupt_wire(corrupt) ;
+    REQUIRE_THROWS(SketchDelta::deserialize(corrupt_wire), "Sketch delta has more blocks than its table.") ;
+
+    // Two updated items touch at most one block per row each.
+    edge.update(7, 3) ;
+    edge.update(4242, 1) ;
+    SketchDelta second = edge.export_delta(first.to_epoch) ;
+    REQUIRE(second.get_num_blocks() <= 2 * n_hashes) ;
+    REQUIRE(second.get_num_blocks() < first.get_num_blocks()) ;
+    REQUIRE(second.total_weight == 4) ;
+    aggregator.apply_delta(second) ;
+    REQUIRE(aggregator.get_table() == edge.get_table()) ;
+
+    // Nothing changed, nothing shipped.
+    SketchDelta empty = edge.export_delta(second.to_epoch) ;
+    REQUIRE(empty.get_num_blocks() == 0) ;
+
+    // Merges and resets are tracked too.
+    CountMinSketch other(n_hashes, n_buckets, seed) ;
+    other.update(1, 10) ;
+    edge.merge(other) ;
+    aggregator.apply_delta(edge.export_delta(empty.to_epoch)) ;
+    REQUIRE(aggregator.get_table() == edge.get_table()) ;
+    edge.reset() ;
+    aggregator.apply_delta(edge.export_delta(edge.get_delta_epoch())) ;
+    REQUIRE(aggregator.get_total_weight() == 0) ;
+    REQUIRE(aggregator.get_table() == edge.get_table()) ;
+
+    CountMinSketch wrong_seed(n_hashes, n_buckets, seed + 1) ;
+    REQUIRE_THROWS(wrong_seed.apply_delta(second), "Incompatible sketch config.") ;
+}
+
+TEST_CASE("Testing compressed counter encoding", "[codec]"){
+    std::cout << "Testing compressed counter encoding." << std::endl ;
+    std::mt19937_64 rng(1) ;
+    // Every width from 0 to 64 bits, including negative counters, full and partial blocks.
+    std::vector<int64_t> counters ;
+    for(unsigned width=0; width <= 64; width++){
+        for(size_t k=0; k < codec_block_counters; k++){
+            uint64_t r = rng() ;
+            int64_t value = (width == 64) ? int64_t(r) : int64_t(r & ((uint64_t(1) << width) - 1)) >> 1 ;
+            counters.push_back((k % 3 == 0) ? -value : value) ;
+        }
+    }
+    counters.push_back(std::numeric_limits<int64_t>::min()) ;
+    counters.push_back(std::numeric_limits<int64_t>::max()) ;
+    counters.push_back(-1) ;
+
+    std::vector<uint8_t> encoded ;
+    encode_counters(counters.data(), counters.size(), encoded) ;
+    REQUIRE(encoded.size() <= max_encoded_bytes(counters.size())) ;
+    std::vector<int64_t> decoded(counters.size()) ;
+    REQUIRE(decode_counters(encoded.data(), encoded.size(), decoded.data(), decoded.size()) == encoded.size()) ;
+    REQUIRE(decoded == counters) ;
+    REQUIRE_THROWS(decode_counters(encoded.data(), encoded.size() - 1, decoded.data(), decoded.size())) ;
+
+    // Blocks of zeros cost one byte and small counters a few bits each.
+    std::vector<int64_t> sparse(100000, 0) ;
+    for(size_t k=0; k < sparse.size(); k += 1000){
+        sparse[k] = 5 ;
+    }
+    encoded.clear() ;
+    encode_counters(sparse.data(), sparse.size(), encoded) ;
+    REQUIRE(encoded.size() < sparse.size() * sizeof(int64_t) / 20) ;
+
+    // Serialized sketches use the encoding.
+    CountMinSketch s(4, 20000, 1) ;
+    for(uint64_t i=0; i < 1000; i++){
+        s.update(i) ;
+    }
+    std::stringstream buffer ;
+    s.serialize(buffer) ;
+    REQUIRE(buffer.str().size() < s.get_memory_bytes() / 4) ;
+    REQUIRE(CountMinSketch::deserialize(buffer).get_table() == s.get_table()) ;
+}
+
+TEST_CASE("Testing asynchronous checkpoints", "[checkpoints]"){
+    std::cout << "Testing asynchronous checkpoints." << std::endl ;
+    char dir_template[] = "/tmp/linearsketches-XXXXXX" ;
+    REQUIRE(mkdtemp(dir_template) != nullptr) ;
+    std::string dir = dir_template ;
+    SnapshotCountMinSketch s(3, 5000, 9) ;
+    CheckpointConfig config ;
+    config.directory = dir ;
+    config.prefix = "cm" ;
+    config.interval = std::chrono::milliseconds(5) ;
+    config.retain = 2 ;
+    std::vector<std::string> files ;
+    {
+        AsyncCheckpointer<SnapshotCountMinSketch> checkpointer(s, config) ;
+        std::vector<uint64_t> batch(256) ;
+        for(uint64_t round=0; checkpointer.get_num_checkpoints() < 4; round++){
+            for(uint64_t k=0; k < batch.size(); k++){
+                batch[k] = round * 7919 + k ;
+            }
+            s.update_batch(batch.data(), nullptr, batch.size()) ;
+            std::this_thread::sleep_for(std::chrono::microseconds(200)) ;
+        }
+        checkpointer.stop() ;
+        s.snapshot() ;
+        REQUIRE(checkpointer.checkpoint_now()) ;
+        REQUIRE_FALSE(checkpointer.checkpoint_now()) ;
+        // Concurrent checkpoints of one snapshot write it exactly once.
+        s.update(1) ;
+        s.snapshot() ;
+        std::atomic<int> written(0) ;
+        std::vector<std::thread> callers ;
+        for(int t=0; t < 4; t++){
+            callers.emplace_back([&](){ written += checkpointer.checkpoint_now() ? 1 : 0 ; }) ;
+        }
+        for(std::thread &caller : callers){
+            caller.join() ;
+        }
+        REQUIRE(written.load() == 1) ;
+        REQUIRE(checkpointer.get_num_failures() == 0) ;
+        files = checkpointer.list_checkpoints() ;
+    }
+    // Only the newest two survive, no temporaries are left behind and the newest holds everything written.
+    REQUIRE(files.size() == 2) ;
+    REQUIRE(access((files.back() + ".tmp").c_str(), F_OK) != 0) ;
+    std::ifstream in(files.back(), std::ios::binary) ;
+    CountMinSketch restored = CountMinSketch::deserialize(in) ;
+    REQUIRE(restored.get_total_weight() == s.latest_snapshot()->get_total_weight()) ;
+    REQUIRE(restored.get_table() == s.latest_snapshot()->get_table()) ;
+    for(const std::string &f : files){
+        unlink(f.c_str()) ;
+    }
+    rmdir(dir.c_str()) ;
+}
+
+TEST_CASE("Testing sketch metrics", "[metrics]"){
+    std::cout << "Testing sketch metrics." << std::endl ;
+    SECTION("Latency histogram buckets"){
+        for(uint64_t v : {0ULL, 1ULL, 31ULL, 32ULL, 33ULL, 1000ULL, 123456789ULL, ~0ULL}){
+            size_t b = LatencyHistogram::bucket_of(v) ;
+            REQUIRE(b < LatencyHistogram::num_buckets) ;
+            REQUIRE(LatencyHistogram::bucket_upper(b) >= v) ;
+            REQUIRE(LatencyHistogram::bucket_upper(b) - v <= v / 16) ;
+            REQUIRE((b == 0 || LatencyHistogram::bucket_upper(b - 1) < v)) ;
+        }
+        LatencyHistogram h ;
+        for(uint64_t v=1; v <= 1000; v++){
+            h.record(v) ;
+        }
+        REQUIRE(h.get_count() == 1000) ;
+        REQUIRE(h.percentile(0.5) >= 500) ;
+        REQUIRE(h.percentile(0.5) <= 500 + 500 / 16) ;
+    }
+    SECTION("Occupancy"){
+        CountMinSketch cm(3, 1000, 1) ;
+        REQUIRE(cm.get_occupancy().fill_ratio() == 0.0) ;
+        cm.update(7) ;
+        REQUIRE(cm.get_occupancy().nonzero == 3) ;
+        REQUIRE(cm.get_occupancy().counters == 3000) ;
+        BlockedCountMinSketch8 b(4, 16, 1) ;
+        b.update(5, 1000) ;
+        REQUIRE(b.get_occupancy().saturated == 4) ;
+    }
+    SECTION("Operation counts"){
+        SketchMetrics before = scrape_metrics() ;
+        CountMinSketch a(3, 1000, 1), c(3, 1000, 1) ;
+        std::vector<uint64_t> items(100, 3) ;
+        std::vector<int64_t> estimates(items.size()) ;
+        std::thread other([&](){ c.update_batch(items.data(), nullptr, items.size()) ; }) ;
+        other.join() ;
+        a.update(1) ;
+        a.get_estimates(items.data(), items.size(), estimates.data()) ;
+        a.merge(c) ;
+        SketchMetrics after = scrape_metrics() ;
+#ifdef LINEARSKETCHES_METRICS
+        REQUIRE(after.enabled) ;
+        REQUIRE(after.operations[METRIC_UPDATE] - before.operations[METRIC_UPDATE] == 101) ;
+        REQUIRE(after.operations[METRIC_QUERY] - before.operations[METRIC_QUERY] == 100) ;
+        REQUIRE(after.calls[METRIC_MERGE] - before.calls[METRIC_MERGE] == 1) ;
+        REQUIRE(after.latency[METRIC_MERGE].get_count() > before.latency[METRIC_MERGE].get_count()) ;
+#else
+        REQUIRE_FALSE(after.enabled) ;
+        REQUIRE(after.operations[METRIC_UPDATE] == 0) ;
+#endif
+        REQUIRE(format_metrics(after).find("linearsketches_operations_total{op=\"update\"}") != std::string::npos) ;
+    }
+}
+
+TEST_CASE("Testing stream generators", "[generators]"){
+    std::cout << "Testing stream generators." << std::endl ;
+    const size_t n = 1 << 20 ;
+    std::vector<uint64_t> items(n), again(n) ;
+    SECTION("Zipf"){
+        ZipfGenerator zipf(10000, 1.1, 5) ;
+        zipf.fill(items.data(), n) ;
+        ZipfGenerator(10000, 1.1, 5).fill(again.data(), n) ;
+        REQUIRE(items == again) ;
+        std::vector<uint64_t> counts(10000, 0) ;
+        REQUIRE(*std::max_element(items.begin(), items.end()) < 10000) ;
+        for(uint64_t item : items){
+            counts[item]++ ;
+        }
+        for(uint64_t k : {0, 1, 10}){
+            double expected = zipf.probability(k) * n ;
+            REQUIRE(std::abs(double(counts[k]) - expected) < 5 * std::sqrt(expected)) ;
+        }
+    }
+    SECTION("Uniform and Pareto weights"){
+        UniformGenerator(1000, 3).fill(items.data(), n) ;
+        REQUIRE(*std::max_element(items.begin(), items.end()) == 999) ;
+        std::vector<int64_t> weights(n) ;
+        ParetoWeightGenerator(1.5, 1, 1000000, 3).fill(weights.data(), n) ;
+        REQUIRE(*std::min_element(weights.begin(), weights.end()) >= 1) ;
+        REQUIRE(*std::max_element(weights.begin(), weights.end()) <= 1000000) ;
+        REQUIRE(std::count(weights.begin(), weights.end(), 1) > int64_t(n / 2)) ;
+    }
+    SECTION("Adversarial collisions"){
+        CountMinSketch cm(3, 64, 8) ;
+        CollisionGenerator colliding(cm.get_hash_family(), 3, 42, 16, 3, 8) ;
+        colliding.fill(items.data(), 1000) ;
+        cm.update_batch(items.data(), nullptr, 1000) ;
+        REQUIRE(cm.get_estimate(42) == 1000) ;
+    }
+}
+
+TEST_CASE("Testing the accuracy harness", "[evaluation]"){
+    std::cout << "Testing the accuracy harness." << std::endl ;
+    std::vector<uint64_t> items(200000) ;
+    ZipfGenerator(50000, 1.0, 4).fill(items.data(), items.size()) ;
+    ExactBaseline baseline = build_exact_baseline(items.data(), nullptr, items.size()) ;
+    REQUIRE(baseline.total_weight == int64_t(items.size())) ;
+    CountMinSketch cm(4, 2000, 4) ;
+    EvaluationResult result = evaluate_sketch("cm", cm, items.data(), nullptr, items.size(), baseline) ;
+    REQUIRE(result.memory_bytes == cm.get_memory_bytes()) ;
+    REQUIRE(result.error_bound == Approx(cm.get_epsilon() * items.size())) ;
+    // CountMin never underestimates and should meet its bound for at least a confidence fraction of items.
+    REQUIRE(result.relative_errors[0] >= 0.0) ;
+    REQUIRE(result.relative_errors[0] <= result.relative_errors[num_error_quantiles - 1]) ;
+    REQUIRE(result.within_bound >= cm.get_confidence()) ;
+    for(const auto &entry : baseline.counts){
+        REQUIRE(cm.get_estimate(entry.first) >= entry.second) ;
+    }
+}
+
+TEST_CASE("Testing trace replay", "[traces]"){
+    std::cout << "Testing trace replay." << std::endl ;
+    char path[] = "/tmp/linearsketches-trace-XXXXXX" ;
+    int fd = mkstemp(path) ;
+    REQUIRE(fd >= 0) ;
+    close(fd) ;
+    const uint64_t n = 100000 ;
+    std::vector<uint64_t> items(n) ;
+    std::vector<int64_t> weights(n) ;
+    ZipfGenerator(5000, 1.0, 6).fill(items.data(), n) ;
+    ParetoWeightGenerator(2.0, 1, 100, 6).fill(weights.data(), n) ;
+    {
+        TraceWriter writer(path, true) ;
+        for(uint64_t k=0; k < n; k++){
+            writer.append(items[k], weights[k], k * 100) ; // 10M records per second
+        }
+    }
+    CountMinSketch expected(3, 1000, 6) ;
+    expected.update_batch(items.data(), weights.data(), n) ;
+
+    MappedTrace trace(path) ;
+    REQUIRE(trace.get_num_records() == n) ;
+    REQUIRE(trace.has_timestamps()) ;
+    REQUIRE(trace.get_item(17) == items[17]) ;
+    REQUIRE(trace.get_timestamp(17) == 1700) ;
+    ReplayOptions options ;
+    options.window_bytes = 1 << 16 ; // many windows so readahead and release are exercised
+    for(unsigned threads : {1u, 3u}){
+        for(bool paced : {false, true}){
+            options.threads = threads ;
+            options.paced = paced ;
+            options.batch = paced ? 1000 : 4096 ;
+            CountMinSketch replayed(3, 1000, 6) ;
+            ReplayStats stats = replay_trace(trace, replayed, options) ;
+            REQUIRE(stats.records == n) ;
+            REQUIRE(stats.total_weight == expected.get_total_weight()) ;
+            REQUIRE(replayed.get_total_weight() == expected.get_total_weight()) ;
+            REQUIRE(replayed.get_table() == expected.get_table()) ;
+            if(paced){
+                REQUIRE(stats.seconds >= 0.009) ; // the last batch is due 9.9ms in
+            }
+        }
+    }
+    // Shards start empty whatever the target holds, so replaying into a tracked, non-empty sketch adds once.
+    options.threads = 3 ;
+    options.paced = false ;
+    CountMinSketch twice(3, 1000, 6) ;
+    twice.enable_delta_tracking() ;
+    twice.update_batch(items.data(), weights.data(), n) ;
+    replay_trace(trace, twice, options) ;
+    REQUIRE(twice.get_total_weight() == 2 * expected.get_total_weight()) ;
+    REQUIRE(twice.get_estimate(items[0]) == 2 * expected.get_estimate(items[0])) ;
+    BlockedCountMinSketch16 blocked(4, 512, 6), blocked_expected(4, 512, 6) ;
+    blocked_expected.update_batch(items.data(), weights.data(), n) ;
+    replay_trace(trace, blocked, options) ;
+    REQUIRE(blocked.get_estimate(items[0]) == blocked_expected.get_estimate(items[0])) ;
+    REQUIRE(blocked.get_total_weight() == blocked_expected.get_total_weight()) ;
+    unlink(path) ;
+    std::ofstream truncated(path, std::ios::binary) ;
+    truncated << "LSTR" ;
+    truncated.close() ;
+    REQUIRE_THROWS_AS(MappedTrace(path), std::invalid_argument) ;
+    unlink(path) ;
+}
+
+TEST_CASE("Testing parallel key file ingest", "[ingest]"){
+    std::cout << "Testing parallel key file ingest." << std::endl ;
+    SECTION("Decimal parser"){
+        const char text[] = "0\n18446744073709551615\r\n123456789012, 7\t42" ;
+        uint64_t keys[8] ;
+        const char *stop ;
+        REQUIRE(parse_decimal_keys(text, text + sizeof(text) - 1, keys, 8, &stop) == 5) ;
+        REQUIRE(keys[0] == 0) ;
+        REQUIRE(keys[1] == 18446744073709551615ULL) ;
+        REQUIRE(keys[2] == 123456789012ULL) ;
+        REQUIRE(keys[3] == 7) ;
+        REQUIRE(keys[4] == 42) ;
+        REQUIRE(stop == text + sizeof(text) - 1) ;
+        const char too_big[] = "18446744073709551616\n" ;
+        REQUIRE_THROWS_AS(parse_decimal_keys(too_big, too_big + sizeof(too_big) - 1, keys, 8, &stop), std::invalid_argument) ;
+        const char junk[] = "12x\n" ;
+        REQUIRE_THROWS_AS(parse_decimal_keys(junk, junk + sizeof(junk) - 1, keys, 8, &stop), std::invalid_argument) ;
+    }
+    SECTION("Text and binary files"){
+        const size_t n = 200000 ;
+        std::vector<uint64_t> items(n) ;
+        UniformGenerator(uint64_t(1) << 40, 10).fill(items.data(), n) ;
+        CountMinSketch expected(3, 1000, 10) ;
+        expected.update_batch(items.data(), nullptr, n) ;
+
+        char text_path[] = "/tmp/linearsketches-keys-XXXXXX" ;
+        char binary_path[] = "/tmp/linearsketches-keys-XXXXXX" ;
+        close(mkstemp(text_path)) ;
+        close(mkstemp(binary_path)) ;
+        {
+            std::ofstream text(text_path) ;
+            for(size_t k=0; k < n; k++){
+                text << items[k] << ((k % 3 == 0) ? "\r\n" : "\n") ;
+            }
+            std::ofstream binary(binary_path, std::ios::binary) ;
+            binary.write(reinterpret_cast<const char*>(items.data()), n * sizeof(uint64_t)) ;
+        }
+        IngestOptions options ;
+        options.threads = 3 ;
+        options.chunk_bytes = 10000 ; // far smaller than the file so lines straddle chunk boundaries
+        CountMinSketch from_text(3, 1000, 10) ;
+        IngestStats stats = ingest_key_file(text_path, from_text, options) ;
+        REQUIRE(stats.keys == n) ;
+        REQUIRE(from_text.get_table() == expected.get_table()) ;
+
+        options.format = KEY_FILE_BINARY ;
+        CountMinSketch from_binary(3, 1000, 10) ;
+        stats = ingest_key_file(binary_path, from_binary, options) ;
+        REQUIRE(stats.keys == n) ;
+        REQUIRE(from_binary.get_table() == expected.get_table()) ;
+        REQUIRE(from_binary.get_total_weight() == int64_t(n)) ;
+
+        // Worker shards start empty whatever the target holds.
+        CountMinSketch again(3, 1000, 10) ;
+        again.enable_delta_tracking() ;
+        again.update_batch(items.data(), nullptr, n) ;
+        ingest_key_file(binary_path, again, options) ;
+        REQUIRE(again.get_total_weight() == 2 * int64_t(n)) ;
+        REQUIRE(again.get_estimate(items[0]) == 2 * expected.get_estimate(items[0])) ;
+
+        {
+            std::ofstream bad(text_path, std::ios::app) ;
+            bad << "oops\n" ;
+        }
+        options.format = KEY_FILE_TEXT ;
+        CountMinSketch untouched(3, 1000, 10) ;
+        REQUIRE_THROWS_AS(ingest_key_file(text_path, untouched, options), std::invalid_argument) ;
+        REQUIRE(untouched.get_total_weight() == 0) ;
+        unlink(text_path) ;
+        unlink(binary_path) ;
+    }
+}
+
+TEST_CASE("Testing the sketch daemon", "[daemon]"){
+    std::cout << "Testing the sketch daemon." << std::endl ;
+    char path[] = "/tmp/linearsketches-daemon-XXXXXX" ;
+    close(mkstemp(path)) ;
+    SketchDaemon daemon(path) ;
+    std::thread server([&daemon](){ daemon.run() ; }) ;
+
+    const size_t n = 100000 ;
+    std::vector<uint64_t> items(n) ;
+    std::vector<int64_t> weights(n) ;
+    UniformGenerator(50000, 11).fill(items.data(), n) ;
+    for(size_t k=0; k < n; k++){
+        weights[k] = int64_t(k % 5) + 1 ;
+    }
+    CountMinSketch expected(4, 2048, 3) ;
+    expected.update_batch(items.data(), nullptr, n / 2) ;
+    expected.update_batch(items.data() + n / 2, weights.data() + n / 2, n - n / 2) ;
+    {
+        SketchClient client(path) ;
+        client.create("flows", 4, 2048, 3) ;
+        client.create("flows", 4, 2048, 3) ; // same config is accepted
+        REQUIRE_THROWS_AS(client.create("flows", 4, 1024, 3), std::runtime_error) ;
+        for(size_t start=0; start < n / 2; start += 1000){
+            client.update("flows", items.data() + start, nullptr, 1000) ;
+        }
+        client.update("flows", items.data() + n / 2, weights.data() + n / 2, n - n / 2) ;
+        client.sync("flows") ;
+
+        std::vector<int64_t> estimates(n), local(n) ;
+        client.query("flows", items.data(), n, estimates.data()) ;
+        expected.get_estimates(items.data(), n, local.data()) ;
+        REQUIRE(estimates == local) ;
+        REQUIRE_THROWS_AS(client.query("missing", items.data(), 10, estimates.data()), std::runtime_error) ;
+        client.query("flows", items.data(), 1, estimates.data()) ; // the connection survives an error reply
+        REQUIRE(estimates[0] == local[0]) ;
+
+        // Oversized shapes are refused, including ones whose cell count overflows, and the daemon keeps serving.
+        REQUIRE_THROWS_AS(client.create("huge", uint64_t(1) << 40, uint64_t(1) << 40, 0), std::runtime_error) ;
+        REQUIRE_THROWS_AS(client.create("huge", 8, default_max_sketch_bytes, 0), std::runtime_error) ;
+        client.query("flows", items.data(), 1, estimates.data()) ;
+        REQUIRE(estimates[0] == local[0]) ;
+    }
+    daemon.stop() ;
+    server.join() ;
+    REQUIRE(daemon.get_num_sketches() == 1) ;
+
+    // With no size limit the allocation itself fails; the error is returned rather than ending the daemon.
+    SketchDaemon unlimited(path, ~uint64_t(0)) ;
+    std::thread unlimited_server([&unlimited](){ unlimited.run() ; }) ;
+    {
+        SketchClient client(path) ;
+        REQUIRE_THROWS_AS(client.create("huge", 1, uint64_t(1) << 58, 0), std::runtime_error) ;
+        client.create("flows", 4, 2048, 3) ;
+        std::vector<int64_t> estimates(1) ;
+        client.query("flows", items.data(), 1, estimates.data()) ;
+        REQUIRE(estimates[0] == 0) ;
+    }
+    unlimited.stop() ;
+    unlimited_server.join() ;
+    REQUIRE(unlimited.get_num_sketches() == 1) ;
+}
+
+TEST_CASE("Testing the shared memory sketch", "[shared]"){
+    std::cout << "Testing the shared memory sketch." << std::endl ;
+    const std::string name = "/linearsketches-test-" + std::to_string(getpid()) ;
+    SharedCountMinSketch::unlink(name) ;
+    const size_t n = 100000 ;
+    std::vector<uint64_t> items(n) ;
+    UniformGenerator(20000, 12).fill(items.data(), n) ;
+    CountMinSketch expected(4, 1500, 9) ;
+    expected.update_batch(items.data(), nullptr, n) ;
+
+    SharedCountMinSketch shared(name, 4, 1500, 9) ;
+    REQUIRE(shared.created()) ;
+    REQUIRE(shared.get_config() == expected.get_config()) ;
+    pid_t child = fork() ;
+    REQUIRE(child >= 0) ;
+    if(child == 0){
+        // Another process attaches and updates the second half concurrently with the parent.
+        int status = 0 ;
+        try {
+            SharedCountMinSketch attached(name, 4, 1500, 9) ;
+            status = attached.created() ? 1 : 0 ;
+            for(size_t k=n / 2; k < n; k++){
+                attached.update(items[k]) ;
+            }
+        } catch(...){
+            status = 2 ;
+        }
+        _exit(status) ;
+    }
+    for(size_t start=0; start < n / 2; start += 1000){
+        shared.update_batch(items.data() + start, nullptr, 1000) ;
+    }
+    int status ;
+    REQUIRE(waitpid(child, &status, 0) == child) ;
+    REQUIRE(WIFEXITED(status)) ;
+    REQUIRE(WEXITSTATUS(status) == 0) ;
+    REQUIRE(shared.get_table() == expected.get_table()) ;
+    REQUIRE(shared.get_total_weight() == int64_t(n)) ;
+    std::vector<int64_t> estimates(n), local(n) ;
+    shared.get_estimates(items.data(), n, estimates.data()) ;
+    expected.get_estimates(items.data(), n, local.data()) ;
+    REQUIRE(estimates == local) ;
+    REQUIRE(shared.get_estimate(items[0]) == expected.get_estimate(items[0])) ;
+
+    REQUIRE_THROWS_AS(SharedCountMinSketch(name, 4, 1000, 9), std::invalid_argument) ;
+    REQUIRE_THROWS_AS(SharedCountMinSketch(name, 4, 1500, 10), std::invalid_argument) ;
+    shared.reset() ;
+    REQUIRE(shared.get_total_weight() == 0) ;
+    REQUIRE(shared.get_estimate(items[0]) == 0) ;
+    REQUIRE(SharedCountMinSketch::unlink(name)) ;
+}
+
+TEST_CASE("Testing the ingestion queue", "[queue]"){
+    std::cout << "Testing the ingestion queue." << std::endl ;
+    const unsigned producers = 3 ;
+    const size_t n = 60000 ;
+    std::vector<uint64_t> items(n * producers) ;
+    UniformGenerator(10000, 13).fill(items.data(), items.size()) ;
+    CountMinSketch expected(4, 1000, 5) ;
+    expected.update_batch(items.data(), nullptr, items.size()) ;
+
+    auto produce = [&](IngestQueue<CountMinSketch> &queue, std::vector<size_t> &accepted){
+        std::vector<std::thread> threads ;
+        for(unsigned p=0; p < producers; p++){
+            threads.emplace_back([&, p](){
+                for(size_t start=0; start < n; start += 100){
+                    accepted[p] += queue.push_batch(p, items.data() + p * n + start, nullptr, 100) ;
+                }
+            }) ;
+        }
+        for(std::thread &t : threads){
+            t.join() ;
+        }
+    } ;
+    IngestQueueOptions options ;
+    options.producers = producers ;
+    options.ring_capacity = 256 ; // small enough that producers regularly find their ring full
+    options.batch = 64 ;
+    SECTION("Block"){
+        CountMinSketch sketch(4, 1000, 5) ;
+        IngestQueue<CountMinSketch> queue(sketch, options) ;
+        std::vector<size_t> accepted(producers, 0) ;
+        produce(queue, accepted) ;
+        queue.flush() ;
+        REQUIRE(queue.get_total_weight() == int64_t(n * producers)) ;
+        std::vector<int64_t> estimates(items.size()), local(items.size()) ;
+        queue.get_estimates(items.data(), items.size(), estimates.data()) ;
+        expected.get_estimates(items.data(), items.size(), local.data()) ;
+        REQUIRE(estimates == local) ;
+
+        // flush gives read-your-writes
+        queue.push(0, 123456789, 7) ;
+        queue.flush() ;
+        REQUIRE(queue.get_estimate(123456789) >= 7) ;
+        queue.stop() ;
+        REQUIRE(queue.push(0, 1) == 0) ;
+    }
+    SECTION("Drop"){
+        options.policy = BACKPRESSURE_DROP ;
+        CountMinSketch sketch(4, 1000, 5) ;
+        IngestQueue<CountMinSketch> queue(sketch, options) ;
+        std::vector<size_t> accepted(producers, 0) ;
+        produce(queue, accepted) ;
+        queue.stop() ;
+        size_t total = accepted[0] + accepted[1] + accepted[2] ;
+        REQUIRE(total + queue.get_num_dropped() == n * producers) ;
+        REQUIRE(sketch.get_total_weight() == int64_t(total)) ;
+    }
+    SECTION("Spill"){
+        options.policy = BACKPRESSURE_SPILL ;
+        CountMinSketch sketch(4, 1000, 5) ;
+        {
+            IngestQueue<CountMinSketch> queue(sketch, options) ;
+            std::vector<size_t> accepted(producers, 0) ;
+            produce(queue, accepted) ;
+            REQUIRE(accepted[0] + accepted[1] + accepted[2] == n * producers) ;
+        }
+        REQUIRE(sketch.get_table() == expected.get_table()) ;
+    }
+}
+
+TEST_CASE("Testing parallel batch updates", "[parallel]"){
+    std::cout << "Testing parallel batch updates." << std::endl ;
+    const size_t n = 5 * parallel_chunk_items + 1234 ;
+    std::vector<uint64_t> items(n) ;
+    std::vector<int64_t> weights(n) ;
+    UniformGenerator(1 << 20, 14).fill(items.data(), n) ;
+    for(size_t k=0; k < n; k++){
+        weights[k] = int64_t(k % 3) + 1 ;
+    }
+    CountMinSketch expected(4, 512, 8) ;
+    expected.update_batch(items.data(), weights.data(), n) ;
+
+    CountMinSketch sharded(4, 512, 8) ;
+    REQUIRE(parallel_update(sharded, items.data(), weights.data(), n, 3, PARALLEL_SHARDED) == PARALLEL_SHARDED) ;
+    REQUIRE(sharded.get_table() == expected.get_table()) ;
+    REQUIRE(sharded.get_total_weight() == expected.get_total_weight()) ;
+
+    CountMinSketch automatic(4, 512, 8) ;
+    REQUIRE(parallel_update(automatic, items.data(), weights.data(), n, 4) == PARALLEL_SHARDED) ; // 16KB table, 2.6MB input
+    REQUIRE(automatic.get_table() == expected.get_table()) ;
+
+    // Shards start empty even when the target is tracked and already holds counts.
+    CountMinSketch tracked(4, 512, 8), tracked_replica(4, 512, 8) ;
+    uint64_t epoch = tracked.enable_delta_tracking() ;
+    parallel_update(tracked, items.data(), weights.data(), n, 3, PARALLEL_SHARDED) ;
+    parallel_update(tracked, items.data(), weights.data(), n, 3, PARALLEL_SHARDED) ;
+    REQUIRE(tracked.get_total_weight() == 2 * expected.get_total_weight()) ;
+    tracked_replica.apply_delta(tracked.export_delta(epoch)) ;
+    REQUIRE(tracked_replica.get_table() == tracked.get_table()) ;
+    REQUIRE(tracked.get_estimate(items[0]) == 2 * expected.get_estimate(items[0])) ;
+
+    BlockedCountMinSketch16 blocked(4, 256, 8), blocked_expected(4, 256, 8) ;
+    blocked_expected.update_batch(items.data(), nullptr, n) ;
+    parallel_update(blocked, items.data(), nullptr, n, 3, PARALLEL_SHARDED) ;
+    std::vector<int64_t> estimates(n), local(n) ;
+    blocked.get_estimates(items.data(), n, estimates.data()) ;
+    blocked_expected.get_estimates(items.data(), n, local.data()) ;
+    REQUIRE(estimates == local) ;
+
+    REQUIRE(choose_parallel_strategy(uint64_t(1) << 30, 0, n, 4) == PARALLEL_SERIAL) ; // replicas dwarf the input
+    REQUIRE(choose_parallel_strategy(4096, 4, 1000, 4) == PARALLEL_SERIAL) ; // too little work to split
+    REQUIRE(choose_parallel_strategy(4096, 4, n, 1) == PARALLEL_SERIAL) ;
+}
+
+TEST_CASE("Testing row-partitioned updates", "[parallel]"){
+    std::cout << "Testing row-partitioned updates." << std::endl ;
+    const size_t n = 3 * parallel_chunk_items ;
+    std::vector<uint64_t> items(n) ;
+    std::vector<int64_t> weights(n) ;
+    UniformGenerator(1 << 20, 15).fill(items.data(), n) ;
+    for(size_t k=0; k < n; k++){
+        weights[k] = int64_t(k % 4) + 1 ;
+    }
+    CountMinSketch expected(5, 1 << 16, 6) ;
+    expected.update_batch(items.data(), weights.data(), n) ;
+
+    // 2.5MB of counters against 1.5MB of input: too big to replicate, so the rows are shared out.
+    CountMinSketch by_rows(5, 1 << 16, 6) ;
+    REQUIRE(parallel_update(by_rows, items.data(), weights.data(), n, 3) == PARALLEL_ROWS) ;
+    REQUIRE(by_rows.get_table() == expected.get_table()) ;
+    REQUIRE(by_rows.get_total_weight() == expected.get_total_weight()) ;
+
+    TabulationCountMinSketch tabulation(3, 1000, 6), tabulation_expected(3, 1000, 6) ;
+    tabulation_expected.update_batch(items.data(), nullptr, n) ;
+    tabulation.update_batch_by_rows(items.data(), nullptr, n, 8) ; // more threads than rows
+    REQUIRE(tabulation.get_table() == tabulation_expected.get_table()) ;
+
+    DoubleHashCountMinSketch double_hash(5, 3000, 6), double_hash_expected(5, 3000, 6) ;
+    double_hash_expected.update_batch(items.data(), weights.data(), n) ;
+    double_hash.update_batch_by_rows(items.data(), weights.data(), n, 2) ;
+    REQUIRE(double_hash.get_table() == double_hash_expected.get_table()) ;
+
+    // Rows of 3000 counters straddle both the clear blocks and the delta blocks.
+    CountMinSketch small_expected(5, 3000, 6), tracked(5, 3000, 6), replica(5, 3000, 6) ;
+    small_expected.update_batch(items.data(), weights.data(), n) ;
+    tracked.enable_lazy_reset() ;
+    tracked.update_batch(items.data(), nullptr, n) ;
+    tracked.reset() ;
+    uint64_t epoch = tracked.enable_delta_tracking() ;
+    tracked.update_batch_by_rows(items.data(), weights.data(), n, 3) ;
+    REQUIRE(tracked.get_table() == small_expected.get_table()) ;
+    replica.apply_delta(tracked.export_delta(epoch)) ;
+    REQUIRE(replica.get_table() == small_expected.get_table()) ;
+
+    BlockedCountMinSketch8 blocked(4, 1 << 16, 6) ;
+    REQUIRE(parallel_update(blocked, items.data(), nullptr, n, 3, PARALLEL_ROWS) == PARALLEL_SERIAL) ;
+    REQUIRE(blocked.get_total_weight() == int64_t(n)) ;
+    REQUIRE(choose_parallel_strategy(uint64_t(1) << 30, 1, n, 4) == PARALLEL_SERIAL) ;
+}
+
+#ifdef LINEARSKETCHES_COROUTINES
+namespace {
+    struct DetachedQuery {
+        // Minimal eagerly started, self-destroying coroutine for exercising the awaitable.
+        struct promise_type {
+            DetachedQuery get_return_object(){ return {} ; }
+            std::suspend_never initial_suspend() noexcept { return {} ; }
+            std::suspend_never final_suspend() noexcept { return {} ; }
+            void return_void(){}
+            void unhandled_exception(){ std::terminate() ; }
+        };
+    };
+
+    DetachedQuery await_estimate(AsyncQueryService<CountMinSketch> &service, uint64_t item, std::promise<int64_t> &result){
+        result.set_value(co_await service.co_get_estimate(item)) ;
+    }
+}
+#endif
+
+TEST_CASE("Testing asynchronous queries", "[async]"){
+    std::cout << "Testing asynchronous queries." << std::endl ;
+    const size_t n = 20000 ;
+    std::vector<uint64_t> items(n) ;
+    UniformGenerator(5000, 16).fill(items.data(), n) ;
+    CountMinSketch sketch(4, 500, 17) ;
+    sketch.update_batch(items.data(), nullptr, n) ;
+    std::vector<int64_t> expected(n) ;
+    sketch.get_estimates(items.data(), n, expected.data()) ;
+
+    AsyncQueryOptions options ;
+    options.threads = 2 ;
+    options.max_batch = 64 ;
+    options.deadline = std::chrono::milliseconds(20) ;
+    AsyncQueryService<CountMinSketch> service(sketch, options) ;
+
+    // Concurrent single-key requests are coalesced into batches of up to 64 keys.
+    std::vector<std::future<int64_t> > singles ;
+    for(size_t k=0; k < 256; k++){
+        singles.push_back(service.get_estimate(items[k])) ;
+    }
+    for(size_t k=0; k < 256; k++){
+        REQUIRE(singles[k].get() == expected[k]) ;
+    }
+    REQUIRE(service.get_num_batches() < service.get_num_requests()) ;
+
+    // A request larger than max_batch is answered on its own.
+    std::vector<int64_t> batch = service.get_estimates(items.data(), n).get() ;
+    REQUIRE(batch == expected) ;
+
+    std::promise<std::vector<int64_t> > delivered ;
+    service.get_estimates(items.data() + 100, 10, [&delivered](const int64_t *estimates, size_t len, std::exception_ptr){
+        delivered.set_value(std::vector<int64_t>(estimates, estimates + len)) ;
+    }) ;
+    REQUIRE(delivered.get_future().get() == std::vector<int64_t>(expected.begin() + 100, expected.begin() + 110)) ;
+
+#ifdef LINEARSKETCHES_COROUTINES
+    std::promise<int64_t> awaited ;
+    await_estimate(service, items[7], awaited) ;
+    REQUIRE(awaited.get_future().get() == expected[7]) ;
+#endif
+
+    // Queries can also be served while an ingestion queue keeps updating the sketch.
+    CountMinSketch live(4, 500, 17) ;
+    IngestQueue<CountMinSketch> queue(live, IngestQueueOptions()) ;
+    AsyncQueryService<IngestQueue<CountMinSketch> > live_service(queue, options) ;
+    queue.push_batch(0, items.data(), nullptr, n) ;
+    queue.flush() ;
+    REQUIRE(live_service.get_estimates(items.data(), n).get() == expected) ;
+}
+
+TEST_CASE("Testing the sampling front end", "[sampling]"){
+    std::cout << "Testing the sampling front end." << std::endl ;
+    const size_t n = 1000000 ;
+    const uint64_t universe = 1000 ;
+    std::vector<uint64_t> items(n) ;
+    ZipfGenerator(universe, 1.1, 18).fill(items.data(), n) ;
+    std::vector<int64_t> exact(universe, 0) ;
+    for(uint64_t item : items){
+        exact[item]++ ;
+    }
+
+    SECTION("Keeping everything matches the plain sketch"){
+        CountMinSketch plain(4, 2000, 19), sampled_sketch(4, 2000, 19) ;
+        plain.update_batch(items.data(), nullptr, n) ;
+        SampledSketch<CountMinSketch> sampled(sampled_sketch, SamplingOptions()) ;
+        sampled.update_batch(items.data(), nullptr, n / 2) ;
+        for(size_t k=n / 2; k < n; k++){
+            sampled.update(items[k]) ;
+        }
+        REQUIRE(sampled.get_num_kept() == n) ;
+        REQUIRE(sampled_sketch.get_table() == plain.get_table()) ;
+        REQUIRE(sampled.get_upper_bound(0) == plain.get_upper_bound(0)) ;
+    }
+    SECTION("Sampled estimates stay within the widened bounds"){
+        CountMinSketch sketch(4, 2000, 19) ;
+        SamplingOptions options ;
+        options.probability = 0.1 ;
+        SampledSketch<CountMinSketch> sampled(sketch, options) ;
+        for(size_t start=0; start < n; start += 5000){
+            sampled.update_batch(items.data() + start, nullptr, 5000) ;
+        }
+        REQUIRE(sampled.get_num_seen() == n) ;
+        REQUIRE(std::abs(double(sampled.get_num_kept()) - 0.1 * n) < 0.01 * n) ; // ~11 standard deviations
+        REQUIRE(std::abs(double(sketch.get_total_weight()) - double(n)) < 0.01 * n) ;
+        size_t covered = 0 ;
+        for(uint64_t item=0; item < universe; item++){
+            covered += (sampled.get_lower_bound(item) <= exact[item] && exact[item] <= sampled.get_upper_bound(item)) ;
+        }
+        REQUIRE(covered >= universe * 99 / 100) ;
+        REQUIRE(std::abs(double(sampled.get_estimate(0)) - double(exact[0])) < 0.05 * exact[0]) ;
+    }
+    SECTION("The probability follows the arrival rate"){
+        CountMinSketch sketch(4, 2000, 19) ;
+        SamplingOptions options ;
+        options.target_rate = 1000 ; // far below any real arrival rate
+        options.adjust_interval = std::chrono::milliseconds(1) ;
+        SampledSketch<CountMinSketch> sampled(sketch, options) ;
+        auto begin = std::chrono::steady_clock::now() ;
+        while(std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(20)){
+            sampled.update_batch(items.data(), nullptr, 10000) ;
+        }
+        REQUIRE(sampled.get_probability() < 0.5) ;
+        REQUIRE(sampled.get_probability() >= options.min_probability) ;
+        REQUIRE(sampled.get_min_probability_used() <= sampled.get_probability()) ;
+        REQUIRE_THROWS_AS(sampled.set_probability(0.0), std::invalid_argument) ;
+    }
+}
+
+TEST_CASE("Testing lazy resets", "[lazy]"){
+    std::cout << "Testing lazy resets." << std::endl ;
+    const size_t n = 50000 ;
+    std::vector<uint64_t> first(n), second(n) ;
+    UniformGenerator(1 << 20, 20).fill(first.data(), n) ;
+    UniformGenerator(1 << 20, 21).fill(second.data(), n) ;
+
+    CountMinSketch lazy(4, 3000, 22) ;
+    lazy.enable_lazy_reset() ;
+    REQUIRE(lazy.is_lazy_reset()) ;
+    lazy.update_batch(first.data(), nullptr, n) ;
+    lazy.reset() ;
+    REQUIRE(lazy.get_total_weight() == 0) ;
+    REQUIRE(lazy.get_occupancy().nonzero == 0) ;
+    REQUIRE(lazy.get_estimate(first[0]) == 0) ;
+
+    // The next window only sees its own items, through every read and write path.
+    CountMinSketch fresh(4, 3000, 22) ;
+    lazy.update_batch(second.data(), nullptr, n / 2) ;
+    fresh.update_batch(second.data(), nullptr, n / 2) ;
+    for(size_t k=n / 2; k < n; k++){
+        lazy.update(second[k]) ;
+        fresh.update(second[k]) ;
+    }
+    std::vector<int64_t> estimates(n), expected(n) ;
+    lazy.get_estimates(first.data(), n, estimates.data()) ;
+    fresh.get_estimates(first.data(), n, expected.data()) ;
+    REQUIRE(estimates == expected) ;
+    REQUIRE(lazy.get_table() == fresh.get_table()) ;
+    {
+        // Queries never clear stale blocks, so several query threads may share the sketch.
+        AsyncQueryOptions options ;
+        options.threads = 4 ;
+        options.max_batch = 512 ;
+        AsyncQueryService<CountMinSketch> service(lazy, options) ;
+        std::vector<std::future<std::vector<int64_t> > > futures ;
+        for(size_t start=0; start < n; start += 1000){
+            futures.push_back(service.get_estimates(first.data() + start, 1000)) ;
+        }
+        for(size_t k=0; k < futures.size(); k++){
+            std::vector<int64_t> got = futures[k].get() ;
+            REQUIRE(std::equal(got.begin(), got.end(), expected.begin() + k * 1000)) ;
+        }
+    }
+    REQUIRE(lazy.get_occupancy().nonzero == fresh.get_occupancy().nonzero) ;
+
+    // Merging and serializing see stale blocks as zero.
+    lazy.reset() ;
+    lazy.update(7, 3) ;
+    CountMinSketch target(4, 3000, 22) ;
+    target.merge(lazy) ;
+    REQUIRE(target.get_total_weight() == 3) ;
+    REQUIRE(target.get_estimate(7) == 3) ;
+    std::stringstream stream ;
+    lazy.serialize(stream) ;
+    CountMinSketch restored = CountMinSketch::deserialize(stream) ;
+    REQUIRE(restored.get_table() == target.get_table()) ;
+
+    // A delta spanning a lazy reset carries the cleared counters.
+    CountMinSketch tracked(4, 3000, 22), replica(4, 3000, 22) ;
+    tracked.enable_lazy_reset() ;
+    tracked.update_batch(first.data(), nullptr, n) ;
+    replica.update_batch(first.data(), nullptr, n) ;
+    uint64_t epoch = tracked.enable_delta_tracking() ;
+    tracked.reset() ;
+    tracked.update_batch(second.data(), nullptr, 100) ;
+    replica.apply_delta(tracked.export_delta(epoch)) ;
+    REQUIRE(replica.get_table() == tracked.get_table()) ;
+    REQUIRE(replica.get_total_weight() == 100) ;
+}
+
+TEST_CASE("Testing pre-hashed keys", "[prehashed]"){
+    std::cout << "Testing pre-hashed keys." << std::endl ;
+    const size_t n = 100000 ;
+    std::vector<uint64_t> items(n), keys(n) ;
+    ZipfGenerator(100000, 1.1, 30).fill(items.data(), n) ;
+    for(size_t k=0; k < n; k++){
+        keys[k] = DoubleHash::fmix64(items[k] + 0x9E3779B97F4A7C15ULL) ; // the caller's routing hash
+    }
+
+    CountMinSketch s(4, 2000, 31), t(4, 2000, 31) ;
+    s.enable_prehashed_keys() ;
+    t.enable_prehashed_keys() ;
+    REQUIRE(s.get_key_mode() == PREHASHED_KEYS) ;
+    REQUIRE(s.get_config().size() == 5) ;
+    REQUIRE(s.get_config()[4] == PREHASHED_KEYS) ;
+    s.update_batch_hashed(keys.data(), nullptr, n) ;
+    for(size_t k=0; k < n; k++){
+        t.update_hashed(keys[k]) ;
+    }
+    REQUIRE(s.get_table() == t.get_table()) ;
+    REQUIRE(s.get_total_weight() == int64_t(n)) ;
+
+    // Never an underestimate, and within epsilon * n for all but a few keys.
+    std::unordered_map<uint64_t, int64_t> truth ;
+    for(size_t k=0; k < n; k++){
+        truth[keys[k]]++ ;
+    }
+    std::vector<uint64_t> distinct ;
+    for(const auto &entry : truth){
+        distinct.push_back(entry.first) ;
+    }
+    std::vector<int64_t> estimates(distinct.size()) ;
+    s.get_estimates_hashed(distinct.data(), distinct.size(), estimates.data()) ;
+    size_t within = 0 ;
+    for(size_t k=0; k < distinct.size(); k++){
+        REQUIRE(estimates[k] == s.get_estimate_hashed(distinct[k])) ;
+        REQUIRE(estimates[k] >= truth[distinct[k]]) ;
+        within += (estimates[k] - truth[distinct[k]] <= s.get_epsilon() * n) ? 1 : 0 ;
+    }
+    REQUIRE(within >= 0.98 * distinct.size()) ;
+
+    // The two kinds of key never mix.
+    CountMinSketch plain(4, 2000, 31) ;
+    REQUIRE_THROWS(s.update(1)) ;
+    REQUIRE_THROWS(s.get_estimate(1)) ;
+    REQUIRE_THROWS(s.update_batch(items.data(), nullptr, 10)) ;
+    REQUIRE_THROWS(plain.update_hashed(keys[0])) ;
+    REQUIRE_THROWS(plain.get_estimates_hashed(keys.data(), 10, estimates.data())) ;
+    REQUIRE_THROWS(plain.merge(s), "Incompatible sketch config.") ;
+    plain.update(1) ;
+    REQUIRE_THROWS(plain.enable_prehashed_keys()) ;
+
+    // Empty shards made from a pre-hashed sketch keep its key mode.
+    std::unique_ptr<CountMinSketch> shard = s.make_empty() ;
+    REQUIRE(shard->get_key_mode() == PREHASHED_KEYS) ;
+    REQUIRE(shard->get_total_weight() == 0) ;
+    REQUIRE(shard->get_config() == s.get_config()) ;
+
+    t.merge(s) ;
+    REQUIRE(t.get_estimate_hashed(keys[0]) == 2 * s.get_estimate_hashed(keys[0])) ;
+
+    // The key mode survives serialization.
+    std::stringstream stream ;
+    s.serialize(stream) ;
+    CountMinSketch restored = CountMinSketch::deserialize(stream) ;
+    REQUIRE(restored.get_config() == s.get_config()) ;
+    REQUIRE(restored.get_estimate_hashed(keys[0]) == s.get_estimate_hashed(keys[0])) ;
+    REQUIRE_THROWS(restored.get_estimate(items[0])) ;
+}
+
+TEST_CASE("Testing sketch references", "[sketch_ref]"){
+    std::cout << "Testing sketch references." << std::endl ;
+    // Hot-path calls are statically dispatched: no sketch carries a vtable.
+    static_assert(!std::is_polymorphic<CountMinSketch>::value, "CountMinSketch must not be polymorphic") ;
+    static_assert(!std::is_polymorphic<BlockedCountMinSketch16>::value, "BlockedCountMinSketch16 must not be polymorphic") ;
+
+    const size_t n = 20000 ;
+    std::vector<uint64_t> items(n) ;
+    ZipfGenerator(5000, 1.1, 40).fill(items.data(), n) ;
+    CountMinSketch cm(4, 1000, 41), cm_direct(4, 1000, 41) ;
+    BlockedCountMinSketch16 blocked(4, 500, 41), blocked_direct(4, 500, 41) ;
+    std::vector<SketchRef> sketches = {SketchRef(cm), SketchRef(blocked)} ;
+    for(SketchRef &sketch : sketches){
+        sketch.update_batch(items.data(), nullptr, n / 2) ;
+        for(size_t k=n / 2; k < n; k++){
+            sketch.update(items[k]) ;
+        }
+    }
+    cm_direct.update_batch(items.data(), nullptr, n) ;
+    blocked_direct.update_batch(items.data(), nullptr, n) ;
+    REQUIRE(cm.get_table() == cm_direct.get_table()) ;
+    REQUIRE(sketches[0].get_config() == cm_direct.get_config()) ;
+    REQUIRE(sketches[1].get_config() == blocked_direct.get_config()) ;
+
+    std::vector<int64_t> estimates(n) ;
+    sketches[1].get_estimates(items.data(), n, estimates.data()) ;
+    for(size_t k=0; k < 100; k++){
+        REQUIRE(sketches[0].get_estimate(items[k]) == cm_direct.get_estimate(items[k])) ;
+        REQUIRE(estimates[k] == blocked_direct.get_estimate(items[k])) ;
+        REQUIRE(sketches[0].get_lower_bound(items[k]) == cm_direct.get_lower_bound(items[k])) ;
+    }
+    REQUIRE(sketches[0].get_total_weight() == int64_t(n)) ;
+    REQUIRE(sketches[1].get_memory_bytes() == blocked_direct.get_memory_bytes()) ;
+    sketches[0].update(~uint64_t(0)) ; // the whole 64-bit range passes through to CountMin
+    REQUIRE(cm.get_estimate(~uint64_t(0)) >= 1) ;
+
+    SketchRef copy = sketches[0] ;
+    copy.reset() ;
+    REQUIRE(cm.get_total_weight() == 0) ;
+}
+
 // int main() {
 //    return 0 ;
 //}
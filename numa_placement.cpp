@@ -0,0 +1,108 @@
+//
+// Minimal NUMA helpers for placing sketch tables.
+//
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa_placement.h"
+
+namespace {
+    const char node_sysfs_dir[] = "/sys/devices/system/node/" ;
+
+    std::vector<unsigned> parse_cpu_list(const std::string &list){
+        /*
+         * Parses the kernel's list format, e.g. "0-3,8,10-11".
+         */
+        std::vector<unsigned> ids ;
+        std::stringstream ss(list) ;
+        std::string range ;
+        while(std::getline(ss, range, ',')){
+            if(range.empty() || range[0] == '\n'){
+                continue ;
+            }
+            size_t dash = range.find('-') ;
+            unsigned lo = std::stoul(range.substr(0, dash)) ;
+            unsigned hi = (dash == std::string::npos) ? lo : std::stoul(range.substr(dash + 1)) ;
+            for(unsigned id=lo; id <= hi; id++){
+                ids.push_back(id) ;
+            }
+        }
+        return ids ;
+    }
+
+    std::string read_line(const std::string &path){
+        std::ifstream in(path) ;
+        std::string line ;
+        std::getline(in, line) ;
+        return line ;
+    }
+
+    struct Topology {
+        uint64_t num_nodes = 1 ;
+        std::vector<unsigned> cpu_to_node ;
+
+        Topology(){
+            std::vector<unsigned> nodes = parse_cpu_list(read_line(std::string(node_sysfs_dir) + "online")) ;
+            for(unsigned node : nodes){
+                num_nodes = std::max<uint64_t>(num_nodes, node + 1) ;
+                for(unsigned cpu : parse_cpu_list(read_line(std::string(node_sysfs_dir) + "node" + std::to_string(node) + "/cpulist"))){
+                    if(cpu >= cpu_to_node.size()){
+                        cpu_to_node.resize(cpu + 1, 0) ;
+                    }
+                    cpu_to_node[cpu] = node ;
+                }
+            }
+        }
+    };
+
+    const Topology& topology(){
+        static const Topology t ;
+        return t ;
+    }
+
+    bool set_policy(void *addr, size_t num_bytes, int mode, const std::vector<unsigned long> &mask){
+        if(addr == nullptr || num_bytes == 0){
+            return false ;
+        }
+        unsigned long max_node = mask.size() * 8 * sizeof(unsigned long) ;
+        return syscall(SYS_mbind, addr, num_bytes, mode, mask.data(), max_node, MPOL_MF_MOVE) == 0 ;
+    }
+
+    std::vector<unsigned long> node_mask(uint64_t num_nodes){
+        return std::vector<unsigned long>(num_nodes / (8 * sizeof(unsigned long)) + 1, 0) ;
+    }
+}
+
+uint64_t get_num_numa_nodes(){
+    return topology().num_nodes ;
+}
+
+unsigned get_numa_node_of_cpu(int cpu){
+    const Topology &t = topology() ;
+    return (cpu >= 0 && size_t(cpu) < t.cpu_to_node.size()) ? t.cpu_to_node[cpu] : 0 ;
+}
+
+unsigned get_current_numa_node(){
+    return get_numa_node_of_cpu(sched_getcpu()) ;
+}
+
+bool interleave_pages_across_nodes(void *addr, size_t num_bytes){
+    uint64_t num_nodes = get_num_numa_nodes() ;
+    std::vector<unsigned long> mask = node_mask(num_nodes) ;
+    for(uint64_t node=0; node < num_nodes; node++){
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long))) ;
+    }
+    return set_policy(addr, num_bytes, MPOL_INTERLEAVE, mask) ;
+}
+
+bool bind_pages_to_node(void *addr, size_t num_bytes, unsigned node){
+    std::vector<unsigned long> mask = node_mask(std::max<uint64_t>(get_num_numa_nodes(), node + 1)) ;
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long))) ;
+    return set_policy(addr, num_bytes, MPOL_BIND, mask) ;
+}
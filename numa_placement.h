@@ -0,0 +1,22 @@
+//
+// Minimal NUMA helpers for placing sketch tables.
+// Topology is read from /sys and memory policy is set with the mbind system call directly, so there is no
+// dependency on libnuma. On machines (or containers) without NUMA everything reports a single node and the
+// placement calls are harmless no-ops.
+//
+
+#ifndef LINEARSKETCHES_NUMA_PLACEMENT_H
+#define LINEARSKETCHES_NUMA_PLACEMENT_H
+
+#include <cstddef>
+#include <cstdint>
+
+uint64_t get_num_numa_nodes() ; // number of online nodes, at least 1
+unsigned get_numa_node_of_cpu(int cpu) ;
+unsigned get_current_numa_node() ; // node of the cpu the calling thread is running on
+
+// Both only affect pages that are faulted in afterwards, or already resident pages that the kernel can migrate.
+bool interleave_pages_across_nodes(void *addr, size_t num_bytes) ;
+bool bind_pages_to_node(void *addr, size_t num_bytes, unsigned node) ;
+
+#endif //LINEARSKETCHES_NUMA_PLACEMENT_H
@@ -0,0 +1,70 @@
+//
+// Per-NUMA-node read replicas of a CountMin sketch.
+//
+#include <atomic>
+#include "count_min_sketch.h"
+#include "numa_placement.h"
+#include "numa_replicas.h"
+
+template <class Sketch>
+NumaReadReplicas<Sketch>::NumaReadReplicas(Sketch &source, std::chrono::milliseconds refresh_interval):
+    replicas(get_num_numa_nodes()), refresh_interval(refresh_interval){
+    refresh(source) ;
+}
+
+template <class Sketch>
+void NumaReadReplicas<Sketch>::refresh(Sketch &source){
+    /*
+     * Each replica is a new sketch with the same config, key mode included, whose table is bound to its node
+     * before any page is touched; merging the source into the empty replica then faults every page in on that node.
+     */
+    for(unsigned node=0; node < replicas.size(); node++){
+        std::shared_ptr<Sketch> replica = std::make_shared<Sketch>(source.get_num_hashes(), source.get_num_buckets(), source.get_seed()) ;
+        if(source.get_key_mode() == PREHASHED_KEYS){
+            replica->enable_prehashed_keys() ;
+        }
+        replica->bind_to_node(node) ;
+        replica->merge(source) ;
+        std::atomic_store(&replicas[node], replica) ;
+    }
+    last_refresh = std::chrono::steady_clock::now() ;
+}
+
+template <class Sketch>
+bool NumaReadReplicas<Sketch>::maybe_refresh(Sketch &source){
+    if(std::chrono::steady_clock::now() - last_refresh < refresh_interval){
+        return false ;
+    }
+    refresh(source) ;
+    return true ;
+}
+
+template <class Sketch>
+std::shared_ptr<Sketch> NumaReadReplicas<Sketch>::get_replica(unsigned node) const {
+    return std::atomic_load(&replicas[node < replicas.size() ? node : 0]) ;
+}
+
+template <class Sketch>
+std::shared_ptr<Sketch> NumaReadReplicas<Sketch>::local_replica() const {
+    return get_replica(get_current_numa_node()) ;
+}
+
+template <class Sketch>
+int64_t NumaReadReplicas<Sketch>::get_estimate(uint64_t item) const {
+    return local_replica()->get_estimate(item) ;
+}
+
+template <class Sketch>
+void NumaReadReplicas<Sketch>::get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const {
+    local_replica()->get_estimates(items, n, estimates) ;
+}
+
+template <class Sketch>
+int64_t NumaReadReplicas<Sketch>::get_total_weight() const {
+    return local_replica()->get_total_weight() ;
+}
+
+template class NumaReadReplicas<MultiplyShiftCountMinSketch> ;
+template class NumaReadReplicas<CountMinSketch> ;
+template class NumaReadReplicas<TabulationCountMinSketch> ;
+template class NumaReadReplicas<DoubleHashCountMinSketch> ;
@@ -0,0 +1,44 @@
+//
+// Per-NUMA-node read replicas of a CountMin sketch for query-heavy services.
+// One copy of the sketch is kept on every node and queries are answered from the copy on the caller's node,
+// so readers never pay remote-memory latency or contend on the cache lines the ingest thread is writing.
+//
+// The replicas are refreshed by whoever owns the source sketch (normally the ingest thread) by calling
+// refresh or maybe_refresh, which copies the source into a freshly placed replica per node and publishes it
+// atomically. Readers holding the previous replica keep it alive until they finish, so queries never block
+// the refresh and always see one consistent copy of the table and its total weight.
+//
+
+#ifndef LINEARSKETCHES_NUMA_REPLICAS_H
+#define LINEARSKETCHES_NUMA_REPLICAS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+template <class Sketch>
+class NumaReadReplicas {
+public:
+    NumaReadReplicas(Sketch &source, std::chrono::milliseconds refresh_interval) ;
+
+    void refresh(Sketch &source) ; // copies source onto every node
+    bool maybe_refresh(Sketch &source) ; // refreshes if refresh_interval has passed since the last refresh
+
+    // Queries are answered from the replica on the calling thread's node.
+    int64_t get_estimate(uint64_t item) const ;
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const ;
+    int64_t get_total_weight() const ;
+    uint64_t get_num_replicas() const { return replicas.size() ; }
+    std::shared_ptr<Sketch> get_replica(unsigned node) const ;
+
+private:
+    std::vector<std::shared_ptr<Sketch> > replicas ; // only accessed through std::atomic_load / std::atomic_store
+    std::chrono::steady_clock::duration refresh_interval ;
+    std::chrono::steady_clock::time_point last_refresh ;
+
+    std::shared_ptr<Sketch> local_replica() const ;
+};
+
+#endif //LINEARSKETCHES_NUMA_REPLICAS_H
@@ -0,0 +1,205 @@
+//
+// Multi-threaded ingestion of one large in-memory batch.
+//
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "parallel_update.h"
+
+namespace {
+    class ChunkScheduler {
+        /*
+         * Work stealing over the chunk indices [0, num_chunks). Worker t starts with the t-th contiguous run and
+         * takes chunks from its front; a worker whose run is empty steals the back half of the largest other run.
+         * Chunks are tens of thousands of items, so a mutex per run costs nothing measurable.
+         */
+    public:
+        ChunkScheduler(size_t num_chunks, unsigned workers) : runs(workers){
+            for(unsigned t=0; t < workers; t++){
+                runs[t].begin = num_chunks * t / workers ;
+                runs[t].end = num_chunks * (t + 1) / workers ;
+            }
+        }
+
+        bool next(unsigned t, size_t &chunk){
+            {
+                std::lock_guard<std::mutex> lock(runs[t].mutex) ;
+                if(runs[t].begin < runs[t].end){
+                    chunk = runs[t].begin++ ;
+                    return true ;
+                }
+            }
+            while(true){
+                unsigned victim = t ;
+                size_t most = 0 ;
+                for(unsigned v=0; v < runs.size(); v++){
+                    std::lock_guard<std::mutex> lock(runs[v].mutex) ;
+                    if(runs[v].end - runs[v].begin > most){
+                        most = runs[v].end - runs[v].begin ;
+                        victim = v ;
+                    }
+                }
+                if(most == 0){
+                    return false ;
+                }
+                size_t begin, end ;
+                {
+                    std::lock_guard<std::mutex> lock(runs[victim].mutex) ;
+                    size_t left = runs[victim].end - runs[victim].begin ;
+                    if(left == 0){
+                        continue ; // emptied since we looked
+                    }
+                    end = runs[victim].end ;
+                    begin = end - (left + 1) / 2 ;
+                    runs[victim].end = begin ;
+                }
+                std::lock_guard<std::mutex> lock(runs[t].mutex) ;
+                runs[t].begin = begin + 1 ;
+                runs[t].end = end ;
+                chunk = begin ;
+                return true ;
+            }
+        }
+
+    private:
+        struct Run {
+            std::mutex mutex ;
+            size_t begin = 0, end = 0 ;
+        };
+        std::vector<Run> runs ;
+    };
+
+    template <class Fn>
+    void run_workers(unsigned threads, Fn fn){
+        /*
+         * Runs fn(t) for t in [0, threads), t = 0 on the calling thread, and rethrows the first exception.
+         */
+        std::vector<std::exception_ptr> errors(threads) ;
+        auto guarded = [&](unsigned t){
+            try {
+                fn(t) ;
+            } catch(...){
+                errors[t] = std::current_exception() ;
+            }
+        } ;
+        std::vector<std::thread> workers ;
+        for(unsigned t=1; t < threads; t++){
+            workers.emplace_back(guarded, t) ;
+        }
+        guarded(0) ;
+        for(std::thread &worker : workers){
+            worker.join() ;
+        }
+        for(const std::exception_ptr &error : errors){
+            if(error){
+                std::rethrow_exception(error) ;
+            }
+        }
+    }
+
+    template <class Sketch>
+    void update_sharded(Sketch &sketch, const uint64_t *items, const int64_t *weights, size_t n, unsigned threads){
+        const size_t num_chunks = (n + parallel_chunk_items - 1) / parallel_chunk_items ;
+        std::vector<std::unique_ptr<Sketch> > shards ;
+        for(unsigned t=0; t < threads; t++){
+            shards.push_back(sketch.make_empty()) ;
+        }
+        ChunkScheduler scheduler(num_chunks, threads) ;
+        run_workers(threads, [&](unsigned t){
+            size_t chunk ;
+            while(scheduler.next(t, chunk)){
+                size_t start = chunk * parallel_chunk_items ;
+                size_t len = std::min(parallel_chunk_items, n - start) ;
+                shards[t]->update_batch(items + start, (weights == nullptr) ? nullptr : weights + start, len) ;
+            }
+        }) ;
+        // Tree merge: at stride s, shard t absorbs shard t + s for every t that is a multiple of 2s.
+        for(unsigned stride=1; stride < threads; stride *= 2){
+            std::vector<unsigned> targets ;
+            for(unsigned t=0; t + stride < threads; t += 2 * stride){
+                targets.push_back(t) ;
+            }
+            run_workers(unsigned(targets.size()), [&](unsigned k){
+                shards[targets[k]]->merge(*shards[targets[k] + stride]) ;
+            }) ;
+        }
+        sketch.merge(*shards[0]) ;
+    }
+
+    // Row partitioning needs per-row hashing and a row-major table, which only the CountMin sketches have.
+    template <class HashFamily>
+    uint64_t partitionable_rows(const BasicCountMinSketch<HashFamily> &sketch){
+        return sketch.get_num_hashes() ;
+    }
+
+    template <class Sketch>
+    uint64_t partitionable_rows(const Sketch&){
+        return 0 ;
+    }
+
+    template <class HashFamily>
+    void update_by_rows(BasicCountMinSketch<HashFamily> &sketch, const uint64_t *items, const int64_t *weights, size_t n, unsigned threads){
+        sketch.update_batch_by_rows(items, weights, n, threads) ;
+    }
+
+    template <class Sketch>
+    void update_by_rows(Sketch &sketch, const uint64_t *items, const int64_t *weights, size_t n, unsigned){
+        sketch.update_batch(items, weights, n) ;
+    }
+}
+
+ParallelStrategy choose_parallel_strategy(uint64_t table_bytes, uint64_t num_rows, size_t n, unsigned threads){
+    /*
+     * Sharding pays one zeroed replica and one merge pass per thread. Require the replicas together to be no
+     * larger than the input itself, so the merge stays a small fraction of the hashing and counter updates.
+     * Past that, row partitioning costs no extra memory and each thread's random writes are confined to its
+     * own rows, so it is used whenever there are at least two rows to share out.
+     */
+    if(threads <= 1 || n < 2 * parallel_chunk_items){
+        return PARALLEL_SERIAL ;
+    }
+    if(table_bytes * threads <= uint64_t(n) * sizeof(uint64_t)){
+        return PARALLEL_SHARDED ;
+    }
+    if(num_rows >= 2){
+        return PARALLEL_ROWS ;
+    }
+    return PARALLEL_SERIAL ;
+}
+
+template <class Sketch>
+ParallelStrategy parallel_update(Sketch &sketch, const uint64_t *items, const int64_t *weights, size_t n,
+                                 unsigned threads, ParallelStrategy strategy){
+    if(threads == 0){
+        threads = std::max(1u, std::thread::hardware_concurrency()) ;
+    }
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, (n + parallel_chunk_items - 1) / parallel_chunk_items))) ;
+    const uint64_t num_rows = partitionable_rows(sketch) ;
+    if(strategy == PARALLEL_AUTO){
+        strategy = choose_parallel_strategy(sketch.get_memory_bytes(), num_rows, n, threads) ;
+    }
+    if(strategy == PARALLEL_ROWS && num_rows == 0){
+        strategy = PARALLEL_SERIAL ;
+    }
+    if(strategy == PARALLEL_SHARDED){
+        update_sharded(sketch, items, weights, n, threads) ;
+    } else if(strategy == PARALLEL_ROWS){
+        update_by_rows(sketch, items, weights, n, threads) ;
+    } else {
+        sketch.update_batch(items, weights, n) ;
+    }
+    return strategy ;
+}
+
+template ParallelStrategy parallel_update(CountMinSketch&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
+template ParallelStrategy parallel_update(MultiplyShiftCountMinSketch&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
+template ParallelStrategy parallel_update(TabulationCountMinSketch&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
+template ParallelStrategy parallel_update(DoubleHashCountMinSketch&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
+template ParallelStrategy parallel_update(BlockedCountMinSketch8&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
+template ParallelStrategy parallel_update(BlockedCountMinSketch16&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
+template ParallelStrategy parallel_update(BlockedCountMinSketch32&, const uint64_t*, const int64_t*, size_t, unsigned, ParallelStrategy) ;
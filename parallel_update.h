@@ -0,0 +1,45 @@
+//
+// Multi-threaded ingestion of one large in-memory batch.
+// The batch is cut into chunks of parallel_chunk_items which are dealt out to the workers in contiguous runs;
+// a worker that runs out steals the back half of the largest remaining run, so a slow core never leaves the
+// others idle at the end. Each worker feeds its chunks to a private, empty sketch with the same config and these are
+// merged pairwise in a tree, in parallel, before the result is merged into the caller's sketch.
+//
+// Replicas cost one table per thread and a merge pass over each, so they only pay off when the batch is large
+// compared with the table. For larger tables CountMin sketches can instead be updated cooperatively by rows:
+// thread t owns rows t, t + T, ... and every thread scans the whole batch, updating only its own rows, so there
+// is no replica memory and nothing to merge, at the cost of each thread reading the entire input. Per-row hash
+// families are evaluated only for a thread's own rows; DoubleHash hashes each item once per thread. Lazily reset
+// or delta-tracked sketches only pay for the blocks the batch touches, each handled by the thread owning its
+// row, plus the O(rows) blocks straddling two rows, which are handled up front. Sketches whose
+// rows cannot be separated (the blocked sketch keeps all of an item's counters in one cache line) fall back to a
+// serial update_batch.
+//
+
+#ifndef LINEARSKETCHES_PARALLEL_UPDATE_H
+#define LINEARSKETCHES_PARALLEL_UPDATE_H
+
+#include <cstddef>
+#include <cstdint>
+
+enum ParallelStrategy {
+    PARALLEL_AUTO,
+    PARALLEL_SERIAL, // one update_batch on the calling thread
+    PARALLEL_SHARDED, // per-thread replicas merged at the end
+    PARALLEL_ROWS // rows partitioned among the threads, CountMin sketches only
+};
+
+const size_t parallel_chunk_items = size_t(1) << 16 ;
+
+// The strategy parallel_update uses under PARALLEL_AUTO for a table of table_bytes and n items. num_rows is 0 for
+// sketches that cannot be row partitioned.
+ParallelStrategy choose_parallel_strategy(uint64_t table_bytes, uint64_t num_rows, size_t n, unsigned threads) ;
+
+// Adds items (with weights, or unit weights if nullptr) to sketch using threads workers, 0 meaning every hardware
+// thread, and returns the strategy used. When sharding, an exception from any worker is rethrown after all have
+// stopped and sketch is left unchanged.
+template <class Sketch>
+ParallelStrategy parallel_update(Sketch &sketch, const uint64_t *items, const int64_t *weights, size_t n,
+                                 unsigned threads=0, ParallelStrategy strategy=PARALLEL_AUTO) ;
+
+#endif //LINEARSKETCHES_PARALLEL_UPDATE_H
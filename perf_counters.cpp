@@ -0,0 +1,101 @@
+//
+// Hardware performance counters through perf_event_open(2).
+//
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+namespace {
+    struct EventSpec {
+        uint32_t type ;
+        uint64_t config ;
+        const char *name ;
+    };
+
+    uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result){
+        return cache | (op << 8) | (result << 16) ;
+    }
+
+    const EventSpec event_specs[num_perf_events] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), "L1d-misses"},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), "LLC-misses"},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), "dTLB-misses"},
+    };
+
+    int open_event(const EventSpec &spec){
+        perf_event_attr attr ;
+        std::memset(&attr, 0, sizeof(attr)) ;
+        attr.size = sizeof(attr) ;
+        attr.type = spec.type ;
+        attr.config = spec.config ;
+        attr.disabled = 1 ;
+        attr.exclude_kernel = 1 ;
+        attr.exclude_hv = 1 ;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING ;
+        return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) ;
+    }
+}
+
+PerfCounters::PerfCounters(){
+    for(size_t e=0; e < num_perf_events; e++){
+        fds[e] = open_event(event_specs[e]) ;
+    }
+}
+
+PerfCounters::~PerfCounters(){
+    for(int fd : fds){
+        if(fd >= 0){
+            close(fd) ;
+        }
+    }
+}
+
+void PerfCounters::start(){
+    for(int fd : fds){
+        if(fd >= 0){
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0) ;
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) ;
+        }
+    }
+}
+
+PerfReading PerfCounters::stop(){
+    /*
+     * Each read returns {value, time_enabled, time_running}. A counter that never ran (the PMU had no room
+     * for it) is reported as unavailable rather than as zero.
+     */
+    for(int fd : fds){
+        if(fd >= 0){
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) ;
+        }
+    }
+    PerfReading reading ;
+    for(size_t e=0; e < num_perf_events; e++){
+        uint64_t raw[3] ;
+        if(fds[e] < 0 || read(fds[e], raw, sizeof(raw)) != ssize_t(sizeof(raw)) || raw[2] == 0){
+            continue ;
+        }
+        reading.available[e] = true ;
+        reading.values[e] = double(raw[0]) * double(raw[1]) / double(raw[2]) ;
+    }
+    return reading ;
+}
+
+bool PerfCounters::any_available() const {
+    for(int fd : fds){
+        if(fd >= 0){
+            return true ;
+        }
+    }
+    return false ;
+}
+
+const char* PerfCounters::event_name(PerfEvent event){
+    return event_specs[event].name ;
+}
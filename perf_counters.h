@@ -0,0 +1,47 @@
+//
+// Hardware performance counters through perf_event_open(2), for the benchmark harness.
+// PerfCounters opens one counter per event for the calling thread (user space only). Events the kernel or the
+// PMU refuse, e.g. under a restrictive perf_event_paranoid or in a VM without a virtual PMU, are left out
+// rather than failing, and read reports them as unavailable. Readings are scaled by time_enabled/time_running
+// so counters that were multiplexed with others are still comparable.
+//
+
+#ifndef LINEARSKETCHES_PERF_COUNTERS_H
+#define LINEARSKETCHES_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum PerfEvent {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    num_perf_events
+};
+
+struct PerfReading {
+    bool available[num_perf_events] = {} ;
+    double values[num_perf_events] = {} ;
+};
+
+class PerfCounters {
+public:
+    PerfCounters() ; // opens the counters disabled
+    ~PerfCounters() ;
+    PerfCounters(const PerfCounters&) = delete ;
+    PerfCounters& operator=(const PerfCounters&) = delete ;
+
+    void start() ; // resets and enables every available counter
+    PerfReading stop() ; // disables the counters and returns what they counted since start
+    bool any_available() const ;
+    static const char* event_name(PerfEvent event) ;
+
+private:
+    int fds[num_perf_events] ;
+};
+
+#endif //LINEARSKETCHES_PERF_COUNTERS_H
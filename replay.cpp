@@ -0,0 +1,107 @@
+//
+// Records and replays binary stream traces (see sketch_trace.h).
+//
+// Usage: LinearSketchesReplay generate OUT.trace N [SKEW [RATE]]  N Zipf items, timestamped at RATE items/sec if given
+//        LinearSketchesReplay convert IN.txt OUT.trace            text trace with "key" or "key weight" per line
+//        LinearSketchesReplay replay IN.trace [--threads T] [--batch B] [--paced SPEED] [--hashes H] [--buckets W]
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "accuracy_harness.h"
+#include "count_min_sketch.h"
+#include "sketch_trace.h"
+#include "stream_generators.h"
+
+namespace {
+    int usage(){
+        std::cerr << "usage: LinearSketchesReplay generate OUT.trace N [SKEW [RATE]]\n"
+                  << "       LinearSketchesReplay convert IN.txt OUT.trace\n"
+                  << "       LinearSketchesReplay replay IN.trace [--threads T] [--batch B] [--paced SPEED] [--hashes H] [--buckets W]\n" ;
+        return 2 ;
+    }
+
+    int generate(int argc, char **argv){
+        uint64_t n = std::strtoull(argv[3], nullptr, 10) ;
+        double skew = (argc > 4) ? std::atof(argv[4]) : 1.1 ;
+        double rate = (argc > 5) ? std::atof(argv[5]) : 0.0 ;
+        ZipfGenerator zipf(1 << 20, skew, 1) ;
+        std::vector<uint64_t> items(1 << 16) ;
+        TraceWriter writer(argv[2], rate > 0.0) ;
+        for(uint64_t done=0; done < n; done += items.size()){
+            size_t len = size_t(std::min<uint64_t>(items.size(), n - done)) ;
+            zipf.fill(items.data(), len) ;
+            for(size_t k=0; k < len; k++){
+                uint64_t timestamp = (rate > 0.0) ? uint64_t(double(done + k) * 1e9 / rate) : 0 ;
+                writer.append(items[k], 1, timestamp) ;
+            }
+        }
+        writer.close() ;
+        return 0 ;
+    }
+
+    int convert(char **argv){
+        std::vector<uint64_t> items ;
+        std::vector<int64_t> weights ;
+        read_text_trace(argv[2], items, weights) ;
+        TraceWriter writer(argv[3], false) ;
+        for(size_t k=0; k < items.size(); k++){
+            writer.append(items[k], weights.empty() ? 1 : weights[k]) ;
+        }
+        writer.close() ;
+        return 0 ;
+    }
+
+    int replay(int argc, char **argv){
+        ReplayOptions options ;
+        uint64_t num_hashes = 4, num_buckets = 1 << 16 ;
+        for(int k=3; k + 1 < argc; k += 2){
+            if(std::strcmp(argv[k], "--threads") == 0){
+                options.threads = unsigned(std::atoi(argv[k + 1])) ;
+            } else if(std::strcmp(argv[k], "--batch") == 0){
+                options.batch = size_t(std::strtoull(argv[k + 1], nullptr, 10)) ;
+            } else if(std::strcmp(argv[k], "--paced") == 0){
+                options.paced = true ;
+                options.speed = std::atof(argv[k + 1]) ;
+            } else if(std::strcmp(argv[k], "--hashes") == 0){
+                num_hashes = std::strtoull(argv[k + 1], nullptr, 10) ;
+            } else if(std::strcmp(argv[k], "--buckets") == 0){
+                num_buckets = std::strtoull(argv[k + 1], nullptr, 10) ;
+            } else {
+                return usage() ;
+            }
+        }
+        MappedTrace trace(argv[2]) ;
+        CountMinSketch sketch(num_hashes, num_buckets, 1) ;
+        ReplayStats stats = replay_trace(trace, sketch, options) ;
+        std::cout << stats.records << " records, total weight " << stats.total_weight << " in " << stats.seconds << " s ("
+                  << stats.records_per_second / 1e6 << " M records/s" ;
+        if(options.paced){
+            std::cout << ", max lag " << stats.max_lag_seconds * 1e3 << " ms" ;
+        }
+        std::cout << ")\n" ;
+        return 0 ;
+    }
+}
+
+int main(int argc, char **argv){
+    try {
+        if(argc >= 4 && std::strcmp(argv[1], "generate") == 0){
+            return generate(argc, argv) ;
+        }
+        if(argc == 4 && std::strcmp(argv[1], "convert") == 0){
+            return convert(argv) ;
+        }
+        if(argc >= 3 && std::strcmp(argv[1], "replay") == 0){
+            return replay(argc, argv) ;
+        }
+    } catch(const std::exception &e){
+        std::cerr << e.what() << "\n" ;
+        return 1 ;
+    }
+    return usage() ;
+}
@@ -0,0 +1,164 @@
+//
+// Sampling front end for ingest rates beyond what the update path can absorb.
+//
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "sampled_sketch.h"
+
+namespace {
+    // Single updates only look at the clock this often, so adapting the rate costs nothing per item.
+    const uint64_t adjust_check_period = 1024 ;
+}
+
+template <class Sketch>
+SampledSketch<Sketch>::SampledSketch(Sketch &sketch, const SamplingOptions &options):
+    sketch(sketch), options(options), rng(options.seed), last_adjust(std::chrono::steady_clock::now()){
+    if(!(options.min_probability > 0.0 && options.min_probability <= 1.0) || options.target_rate < 0.0){
+        throw std::invalid_argument( "Minimum probability must lie in (0, 1] and the target rate be nonnegative." );
+    }
+    set_probability(options.probability) ;
+    min_probability_used = probability ;
+}
+
+template <class Sketch>
+void SampledSketch<Sketch>::set_probability(double p){
+    /*
+     * The skip is memoryless, so redrawing it under the new probability keeps every later update's chance of
+     * being kept exactly p.
+     */
+    if(!(p > 0.0 && p <= 1.0)){
+        throw std::invalid_argument( "Sampling probability must lie in (0, 1]." );
+    }
+    probability = p ;
+    inv_probability = 1.0 / p ;
+    inv_log_q = (p < 1.0) ? 1.0 / std::log1p(-p) : 0.0 ;
+    min_probability_used = std::min(min_probability_used, p) ;
+    skip = draw_skip() ;
+}
+
+template <class Sketch>
+uint64_t SampledSketch<Sketch>::draw_skip(){
+    if(inv_log_q == 0.0){
+        return 0 ;
+    }
+    double u = 1.0 - rng.next_unit() ; // (0, 1] so the log is finite
+    double s = std::floor(std::log(u) * inv_log_q) ;
+    return (s >= 1.8e19) ? std::numeric_limits<uint64_t>::max() : uint64_t(s) ;
+}
+
+template <class Sketch>
+int64_t SampledSketch<Sketch>::scale(int64_t weight){
+    /*
+     * weight / p rounded to a neighbouring integer with the probabilities that make the expectation exact.
+     */
+    double scaled = double(weight) * inv_probability ;
+    double whole = std::floor(scaled) ;
+    return int64_t(whole) + ((rng.next_unit() < scaled - whole) ? 1 : 0) ;
+}
+
+template <class Sketch>
+void SampledSketch<Sketch>::update(uint64_t item, int64_t weight){
+    num_seen++ ;
+    max_weight = std::max(max_weight, weight) ;
+    if(skip > 0){
+        skip-- ;
+    } else {
+        sketch.update(item, scale(weight)) ;
+        num_kept++ ;
+        skip = draw_skip() ;
+    }
+    if(options.target_rate > 0.0 && num_seen % adjust_check_period == 0){
+        maybe_adjust() ;
+    }
+}
+
+template <class Sketch>
+void SampledSketch<Sketch>::update_batch(const uint64_t *items, const int64_t *weights, size_t n){
+    /*
+     * Jumps straight from one kept update to the next, gathers the kept ones and hands them to the sketch's
+     * batched path in one call.
+     */
+    kept_items.clear() ;
+    kept_weights.clear() ;
+    size_t k = 0 ;
+    while(skip < n - k){
+        k += skip ;
+        kept_items.push_back(items[k]) ;
+        kept_weights.push_back(scale((weights == nullptr) ? 1 : weights[k])) ;
+        k++ ;
+        skip = draw_skip() ;
+    }
+    skip -= (n - k) ;
+    if(weights != nullptr){
+        for(size_t j=0; j < n; j++){
+            max_weight = std::max(max_weight, weights[j]) ;
+        }
+    }
+    sketch.update_batch(kept_items.data(), kept_weights.data(), kept_items.size()) ;
+    num_seen += n ;
+    num_kept += kept_items.size() ;
+    if(options.target_rate > 0.0){
+        maybe_adjust() ;
+    }
+}
+
+template <class Sketch>
+void SampledSketch<Sketch>::maybe_adjust(){
+    auto now = std::chrono::steady_clock::now() ;
+    if(now - last_adjust < options.adjust_interval){
+        return ;
+    }
+    double seconds = std::chrono::duration<double>(now - last_adjust).count() ;
+    double arrival_rate = double(num_seen - seen_at_adjust) / seconds ;
+    if(arrival_rate > 0.0){
+        set_probability(std::max(options.min_probability, std::min(1.0, options.target_rate / arrival_rate))) ;
+    }
+    seen_at_adjust = num_seen ;
+    last_adjust = now ;
+}
+
+template <class Sketch>
+double SampledSketch<Sketch>::sampling_error(int64_t estimate) const {
+    /*
+     * With c = w_max * (1 - p) / p the sampling error of a frequency f has standard deviation sqrt(c * f). Rather
+     * than plugging in the estimate for f, which understates the error exactly when the sampler undershot, take
+     * the largest f consistent with the estimate, the root of f = estimate + z * sqrt(c * f), and return
+     * z * sqrt(c * f) for it (a Wilson-style bound).
+     */
+    double p = min_probability_used ;
+    double c = double(max_weight) * (1.0 - p) / p ;
+    double z = options.bound_sigmas ;
+    double root = 0.5 * (z * std::sqrt(c) + std::sqrt(z * z * c + 4.0 * std::max(0.0, double(estimate)))) ;
+    return z * std::sqrt(c) * root ;
+}
+
+template <class Sketch>
+int64_t SampledSketch<Sketch>::get_estimate(uint64_t item){
+    return sketch.get_estimate(item) ;
+}
+
+template <class Sketch>
+int64_t SampledSketch<Sketch>::get_upper_bound(uint64_t item){
+    int64_t bound = sketch.get_upper_bound(item) ;
+    if(bound == std::numeric_limits<int64_t>::max()){
+        return bound ;
+    }
+    return bound + int64_t(std::ceil(sampling_error(sketch.get_estimate(item)))) ;
+}
+
+template <class Sketch>
+int64_t SampledSketch<Sketch>::get_lower_bound(uint64_t item){
+    return sketch.get_lower_bound(item) - int64_t(std::ceil(sampling_error(sketch.get_estimate(item)))) ;
+}
+
+template class SampledSketch<CountMinSketch> ;
+template class SampledSketch<MultiplyShiftCountMinSketch> ;
+template class SampledSketch<TabulationCountMinSketch> ;
+template class SampledSketch<DoubleHashCountMinSketch> ;
+template class SampledSketch<BlockedCountMinSketch8> ;
+template class SampledSketch<BlockedCountMinSketch16> ;
+template class SampledSketch<BlockedCountMinSketch32> ;
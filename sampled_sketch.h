@@ -0,0 +1,77 @@
+//
+// Sampling front end for ingest rates beyond what the update path can absorb.
+// Each update is kept with probability p and its weight scaled by 1/p (rounded up or down at random so that the
+// scaled weight stays unbiased), so every counter and estimate remains an unbiased estimate of the unsampled one.
+// Rather than drawing a random number per item, the number of updates to skip before the next kept one is drawn
+// from the geometric distribution, floor(log(U) / log(1 - p)), so skipped items cost only a counter decrement.
+//
+// Sampling adds variance on top of the sketch's own error. An item of frequency f whose updates weigh at most
+// w_max has sampled estimate variance at most w_max * f * (1 - p) / p, with p the smallest probability used so
+// far, and get_lower_bound and get_upper_bound widen the sketch's bounds by bound_sigmas standard deviations of
+// it, evaluated at the largest f the estimate is consistent with.
+//
+// With a target_rate the front end measures how many updates arrive per second and, every adjust_interval, sets
+// p so that roughly target_rate of them per second reach the sketch.
+//
+
+#ifndef LINEARSKETCHES_SAMPLED_SKETCH_H
+#define LINEARSKETCHES_SAMPLED_SKETCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "stream_generators.h"
+
+struct SamplingOptions {
+    double probability = 1.0 ; // initial sampling probability, in (0, 1]
+    double target_rate = 0.0 ; // updates per second to pass on to the sketch; 0 keeps probability fixed
+    double min_probability = 1e-4 ; // floor for the adaptive probability
+    std::chrono::milliseconds adjust_interval = std::chrono::milliseconds(100) ;
+    double bound_sigmas = 3.0 ; // width of the sampling term in the bounds, in standard deviations
+    uint64_t seed = 1 ;
+};
+
+template <class Sketch>
+class SampledSketch {
+public:
+    SampledSketch(Sketch &sketch, const SamplingOptions &options) ;
+
+    void update(uint64_t item, int64_t weight=1) ;
+    void update_batch(const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr for unit weights
+
+    int64_t get_estimate(uint64_t item) ;
+    int64_t get_upper_bound(uint64_t item) ;
+    int64_t get_lower_bound(uint64_t item) ;
+
+    void set_probability(double p) ; // takes effect from the next update
+    double get_probability() const { return probability ; }
+    double get_min_probability_used() const { return min_probability_used ; }
+    uint64_t get_num_seen() const { return num_seen ; }
+    uint64_t get_num_kept() const { return num_kept ; }
+    Sketch& get_sketch() { return sketch ; }
+
+private:
+    Sketch &sketch ;
+    SamplingOptions options ;
+    StreamRng rng ;
+    double probability = 1.0 ;
+    double inv_probability = 1.0 ;
+    double inv_log_q = 0.0 ; // 1 / log(1 - p), 0 when p == 1
+    double min_probability_used = 1.0 ;
+    uint64_t skip = 0 ; // updates still to be skipped before the next kept one
+    uint64_t num_seen = 0 ;
+    uint64_t num_kept = 0 ;
+    int64_t max_weight = 1 ;
+    uint64_t seen_at_adjust = 0 ;
+    std::chrono::steady_clock::time_point last_adjust ;
+    std::vector<uint64_t> kept_items ;
+    std::vector<int64_t> kept_weights ;
+
+    uint64_t draw_skip() ;
+    int64_t scale(int64_t weight) ;
+    void maybe_adjust() ;
+    double sampling_error(int64_t estimate) const ;
+};
+
+#endif //LINEARSKETCHES_SAMPLED_SKETCH_H
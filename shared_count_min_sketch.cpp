@@ -0,0 +1,236 @@
+//
+// CountMin sketch living in a POSIX shared memory segment.
+//
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shared_count_min_sketch.h"
+#include "sketch_metrics.h"
+
+static_assert(sizeof(SharedSketchHeader) == 64, "the header layout is part of the segment format") ;
+
+const uint32_t SharedCountMinSketch::format_version ;
+
+namespace {
+    const char shared_magic[4] = {'L', 'S', 'S', 'H'} ;
+    const size_t batch_chunk = 64 ;
+    // How long an attaching process waits for the creator to finish initialising the segment.
+    const std::chrono::seconds attach_timeout(5) ;
+
+    std::string errno_message(const std::string &what, const std::string &name){
+        return what + " " + name + ": " + std::strerror(errno) ;
+    }
+}
+
+size_t SharedCountMinSketch::layout_bytes(uint64_t num_hashes, uint64_t num_buckets, size_t *counters_offset){
+    size_t params_end = sizeof(SharedSketchHeader) + 2 * num_hashes * sizeof(uint64_t) ;
+    *counters_offset = (params_end + 63) & ~size_t(63) ;
+    return *counters_offset + num_hashes * num_buckets * sizeof(int64_t) ;
+}
+
+void SharedCountMinSketch::map(int fd, size_t bytes){
+    void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ;
+    if(p == MAP_FAILED){
+        throw std::runtime_error( errno_message("Cannot map shared sketch", name) );
+    }
+    segment = p ;
+    segment_bytes = bytes ;
+    header = static_cast<SharedSketchHeader*>(segment) ;
+}
+
+SharedCountMinSketch::SharedCountMinSketch(const std::string &name, uint64_t num_hashes, uint64_t num_buckets, uint64_t seed)
+        : name(name), num_hashes(num_hashes), num_buckets(num_buckets), seed(seed){
+    /*
+     * Creation is decided by O_EXCL, so exactly one process initialises the segment. The creator sizes the segment
+     * before writing anything and publishes the header with a release store of ready; attachers wait for the
+     * size and then for ready before reading the rest of the header.
+     */
+    if(num_hashes == 0 || num_buckets == 0){
+        throw std::invalid_argument( "Sketch shape must be positive." );
+    }
+    size_t counters_offset ;
+    const size_t bytes = layout_bytes(num_hashes, num_buckets, &counters_offset) ;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600) ;
+    creator = (fd >= 0) ;
+    if(!creator && errno == EEXIST){
+        fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0) ;
+    }
+    if(fd < 0){
+        throw std::runtime_error( errno_message("Cannot open shared sketch", name) );
+    }
+
+    try {
+        const auto deadline = std::chrono::steady_clock::now() + attach_timeout ;
+        if(creator){
+            if(ftruncate(fd, off_t(bytes)) != 0){
+                throw std::runtime_error( errno_message("Cannot size shared sketch", name) );
+            }
+            map(fd, bytes) ;
+            MersennePrimeHash family(num_hashes, num_buckets, seed) ;
+            uint64_t *params = reinterpret_cast<uint64_t*>(header + 1) ;
+            std::copy(family.get_a_params().begin(), family.get_a_params().end(), params) ;
+            std::copy(family.get_b_params().begin(), family.get_b_params().end(), params + num_hashes) ;
+            std::memcpy(header->magic, shared_magic, sizeof(shared_magic)) ;
+            header->version = format_version ;
+            header->counter_bytes = sizeof(int64_t) ;
+            header->num_hashes = num_hashes ;
+            header->num_buckets = num_buckets ;
+            header->seed = seed ;
+            header->hash_family = MersennePrimeHash::family_id() ;
+            header->segment_bytes = bytes ;
+            header->total_weight = 0 ; // counters are already zero from ftruncate
+            __atomic_store_n(&header->ready, 1u, __ATOMIC_RELEASE) ;
+        } else {
+            struct stat st ;
+            while(fstat(fd, &st) == 0 && st.st_size == 0 && std::chrono::steady_clock::now() < deadline){
+                std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+            }
+            if(st.st_size < off_t(sizeof(SharedSketchHeader))){
+                throw std::runtime_error( "Shared sketch " + name + " was never initialised." );
+            }
+            map(fd, size_t(st.st_size)) ;
+            while(__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) == 0 && std::chrono::steady_clock::now() < deadline){
+                std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+            }
+            if(__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) == 0){
+                throw std::runtime_error( "Shared sketch " + name + " was never initialised." );
+            }
+            if(std::memcmp(header->magic, shared_magic, sizeof(shared_magic)) != 0 || header->version != format_version){
+                throw std::invalid_argument( "Shared sketch " + name + " has an unsupported format." );
+            }
+            if(header->counter_bytes != sizeof(int64_t)){
+                throw std::invalid_argument( "Shared sketch " + name + " uses a different counter width." );
+            }
+            if(header->num_hashes != num_hashes || header->num_buckets != num_buckets || header->seed != seed
+               || header->hash_family != MersennePrimeHash::family_id()){
+                throw std::invalid_argument( "Shared sketch " + name + " exists with a different config." );
+            }
+            if(header->segment_bytes != bytes || segment_bytes != bytes){
+                throw std::invalid_argument( "Shared sketch " + name + " has the wrong size." );
+            }
+        }
+        const uint64_t *params = reinterpret_cast<const uint64_t*>(header + 1) ;
+        hashes.reset(new MersennePrimeHash(num_hashes, num_buckets, params, params + num_hashes)) ;
+        counters = reinterpret_cast<int64_t*>(static_cast<char*>(segment) + counters_offset) ;
+    } catch(...){
+        if(segment != nullptr){
+            munmap(segment, segment_bytes) ;
+        }
+        close(fd) ;
+        if(creator){
+            shm_unlink(name.c_str()) ;
+        }
+        throw ;
+    }
+    close(fd) ;
+}
+
+SharedCountMinSketch::~SharedCountMinSketch(){
+    munmap(segment, segment_bytes) ;
+}
+
+bool SharedCountMinSketch::unlink(const std::string &name){
+    return shm_unlink(name.c_str()) == 0 ;
+}
+
+void SharedCountMinSketch::update(uint64_t item, int64_t weight){
+    SKETCH_METRICS_SCOPE(METRIC_UPDATE, 1) ;
+    RowBuckets buckets(num_hashes) ;
+    hashes->buckets(item, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        __atomic_fetch_add(&counters[i * num_buckets + buckets[i]], weight, __ATOMIC_RELAXED) ;
+    }
+    __atomic_fetch_add(&header->total_weight, weight, __ATOMIC_RELAXED) ;
+}
+
+void SharedCountMinSketch::update_batch(const uint64_t *items, const int64_t *weights, size_t n){
+    /*
+     * Same chunked, row-at-a-time walk as CountMinSketch::update_batch with every add made atomic.
+     * The total weight is added once per call.
+     */
+    SKETCH_METRICS_SCOPE(METRIC_UPDATE, n) ;
+    std::vector<uint64_t> buckets(num_hashes * batch_chunk) ;
+    int64_t weight_sum = 0 ;
+    for(size_t start=0; start < n; start += batch_chunk){
+        size_t len = std::min(batch_chunk, n - start) ;
+        hashes->buckets(items + start, len, buckets.data()) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            const uint64_t *row_buckets = buckets.data() + i * len ;
+            int64_t *row = counters + i * num_buckets ;
+            for(size_t k=0; k < len; k++){
+                __atomic_fetch_add(&row[row_buckets[k]], (weights == nullptr) ? 1 : weights[start + k], __ATOMIC_RELAXED) ;
+            }
+        }
+        if(weights == nullptr){
+            weight_sum += len ;
+        } else {
+            for(size_t k=0; k < len; k++){
+                weight_sum += weights[start + k] ;
+            }
+        }
+    }
+    __atomic_fetch_add(&header->total_weight, weight_sum, __ATOMIC_RELAXED) ;
+}
+
+int64_t SharedCountMinSketch::get_estimate(uint64_t item) const {
+    SKETCH_METRICS_SCOPE(METRIC_QUERY, 1) ;
+    int64_t estimate = std::numeric_limits<int64_t>::max() ;
+    RowBuckets buckets(num_hashes) ;
+    hashes->buckets(item, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        estimate = std::min(estimate, __atomic_load_n(&counters[i * num_buckets + buckets[i]], __ATOMIC_RELAXED)) ;
+    }
+    return estimate ;
+}
+
+void SharedCountMinSketch::get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const {
+    SKETCH_METRICS_SCOPE(METRIC_QUERY, n) ;
+    std::vector<uint64_t> buckets(num_hashes * batch_chunk) ;
+    for(size_t start=0; start < n; start += batch_chunk){
+        size_t len = std::min(batch_chunk, n - start) ;
+        hashes->buckets(items + start, len, buckets.data()) ;
+        int64_t *chunk_estimates = estimates + start ;
+        std::fill(chunk_estimates, chunk_estimates + len, std::numeric_limits<int64_t>::max()) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            const uint64_t *row_buckets = buckets.data() + i * len ;
+            const int64_t *row = counters + i * num_buckets ;
+            for(size_t k=0; k < len; k++){
+                chunk_estimates[k] = std::min(chunk_estimates[k], __atomic_load_n(&row[row_buckets[k]], __ATOMIC_RELAXED)) ;
+            }
+        }
+    }
+}
+
+void SharedCountMinSketch::reset(){
+    for(uint64_t c=0; c < num_hashes * num_buckets; c++){
+        __atomic_store_n(&counters[c], int64_t(0), __ATOMIC_RELAXED) ;
+    }
+    __atomic_store_n(&header->total_weight, int64_t(0), __ATOMIC_RELAXED) ;
+}
+
+int64_t SharedCountMinSketch::get_total_weight() const {
+    return __atomic_load_n(&header->total_weight, __ATOMIC_RELAXED) ;
+}
+
+std::vector<uint64_t> SharedCountMinSketch::get_config() const {
+    return {num_hashes, num_buckets, seed, MersennePrimeHash::family_id()} ;
+}
+
+std::vector<std::vector<int64_t>> SharedCountMinSketch::get_table() const {
+    std::vector<std::vector<int64_t>> table(num_hashes, std::vector<int64_t>(num_buckets)) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        for(uint64_t j=0; j < num_buckets; j++){
+            table[i][j] = __atomic_load_n(&counters[i * num_buckets + j], __ATOMIC_RELAXED) ;
+        }
+    }
+    return table ;
+}
@@ -0,0 +1,79 @@
+//
+// CountMin sketch living in a POSIX shared memory segment so several processes can update and query it directly.
+// The segment holds a versioned header, the hash parameters and the counters:
+//     SharedSketchHeader                      64 bytes
+//     u64 a[num_hashes], u64 b[num_hashes]     MersennePrimeHash parameters, the same family as CountMinSketch
+//     i64 counters[num_hashes * num_buckets]  row-major, starting on a cache line
+// Counters and the total weight are changed with atomic adds, so any number of attached processes may update and
+// query at once without IPC or locks. Adds are not atomic across rows, so a query racing with an update may see
+// it in some rows and not yet in others.
+//
+// The first process to open a name creates and initialises the segment; later ones attach and must ask for the
+// same num_hashes, num_buckets and seed, with the same header version and counter width, or attaching throws.
+// Segments outlive the processes using them until unlink is called.
+//
+
+#ifndef LINEARSKETCHES_SHARED_COUNT_MIN_SKETCH_H
+#define LINEARSKETCHES_SHARED_COUNT_MIN_SKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hash_families.h"
+
+struct SharedSketchHeader {
+    char magic[4] ; // "LSSH"
+    uint32_t version ;
+    uint32_t counter_bytes ;
+    uint32_t ready ; // set last, with release ordering, once the creator has written everything else
+    uint64_t num_hashes ;
+    uint64_t num_buckets ;
+    uint64_t seed ;
+    uint64_t hash_family ;
+    uint64_t segment_bytes ;
+    int64_t total_weight ; // updated atomically
+};
+
+class SharedCountMinSketch {
+public:
+    static const uint32_t format_version = 1 ;
+
+    // Creates the segment called name (a shm_open name such as "/flows") or attaches to an existing one.
+    SharedCountMinSketch(const std::string &name, uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    ~SharedCountMinSketch() ;
+    SharedCountMinSketch(const SharedCountMinSketch&) = delete ;
+    SharedCountMinSketch& operator=(const SharedCountMinSketch&) = delete ;
+    static bool unlink(const std::string &name) ; // removes the name; attached processes keep their mapping
+
+    void update(uint64_t item, int64_t weight=1) ;
+    void update_batch(const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr for unit weights
+    int64_t get_estimate(uint64_t item) const ;
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const ;
+    void reset() ; // zeroes every counter; not atomic with respect to concurrent updates
+
+    int64_t get_total_weight() const ;
+    uint64_t get_num_hashes() const { return num_hashes ; }
+    uint64_t get_num_buckets() const { return num_buckets ; }
+    uint64_t get_seed() const { return seed ; }
+    std::vector<uint64_t> get_config() const ; // same layout as CountingSketch::get_config
+    std::vector<std::vector<int64_t>> get_table() const ;
+    bool created() const { return creator ; } // true if this handle initialised the segment
+    const std::string& get_name() const { return name ; }
+
+private:
+    std::string name ;
+    uint64_t num_hashes, num_buckets, seed ;
+    void *segment = nullptr ;
+    size_t segment_bytes = 0 ;
+    SharedSketchHeader *header = nullptr ;
+    int64_t *counters = nullptr ;
+    std::unique_ptr<MersennePrimeHash> hashes ;
+    bool creator = false ;
+
+    static size_t layout_bytes(uint64_t num_hashes, uint64_t num_buckets, size_t *counters_offset) ;
+    void map(int fd, size_t bytes) ;
+};
+
+#endif //LINEARSKETCHES_SHARED_COUNT_MIN_SKETCH_H
@@ -0,0 +1,456 @@
+//
+// Local daemon hosting named CountMin sketches behind a Unix domain stream socket.
+//
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sketch_daemon.h"
+
+namespace {
+    const size_t initial_buffer_bytes = size_t(256) << 10 ;
+    // A connection whose replies pile up past this is not read from until the client drains them.
+    const size_t max_pending_output = size_t(8) << 20 ;
+
+    inline size_t padded(size_t bytes){
+        return (bytes + 7) & ~size_t(7) ;
+    }
+
+    void append_error(uint8_t *p, uint32_t request_id, const std::string &message){
+        /*
+         * Writes an OP_ERROR frame into the sizeof(FrameHeader) + padded(message.size()) bytes at p.
+         */
+        FrameHeader out = {} ;
+        out.frame_bytes = uint32_t(sizeof(FrameHeader) + padded(message.size())) ;
+        out.op = OP_ERROR ;
+        out.count = uint32_t(message.size()) ;
+        out.request_id = request_id ;
+        std::memcpy(p, &out, sizeof(out)) ;
+        std::memcpy(p + sizeof(out), message.data(), message.size()) ;
+        std::memset(p + sizeof(out) + message.size(), 0, padded(message.size()) - message.size()) ;
+    }
+
+    sockaddr_un socket_address(const std::string &path){
+        sockaddr_un address ;
+        std::memset(&address, 0, sizeof(address)) ;
+        address.sun_family = AF_UNIX ;
+        if(path.size() >= sizeof(address.sun_path)){
+            throw std::invalid_argument( "Socket path too long." );
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1) ;
+        return address ;
+    }
+
+    void send_all(int fd, const void *data, size_t bytes){
+        const char *p = static_cast<const char*>(data) ;
+        while(bytes > 0){
+            ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL) ;
+            if(n < 0 && errno == EINTR){
+                continue ;
+            }
+            if(n <= 0){
+                throw std::runtime_error( std::string("Lost connection to sketch daemon: ") + std::strerror(errno) );
+            }
+            p += n ;
+            bytes -= size_t(n) ;
+        }
+    }
+
+    void recv_all(int fd, void *data, size_t bytes){
+        char *p = static_cast<char*>(data) ;
+        while(bytes > 0){
+            ssize_t n = recv(fd, p, bytes, 0) ;
+            if(n < 0 && errno == EINTR){
+                continue ;
+            }
+            if(n <= 0){
+                throw std::runtime_error( "Lost connection to sketch daemon." );
+            }
+            p += n ;
+            bytes -= size_t(n) ;
+        }
+    }
+}
+
+struct SketchDaemon::Connection {
+    int fd ;
+    std::vector<uint64_t> in ; // uint64_t storage keeps every frame, and so every key array, 8-byte aligned
+    size_t in_bytes = 0 ;
+    std::vector<uint64_t> out ;
+    size_t out_bytes = 0 ;
+    size_t out_sent = 0 ;
+    uint32_t events = 0 ;
+
+    explicit Connection(int fd) : fd(fd), in(initial_buffer_bytes / sizeof(uint64_t)) {}
+
+    uint8_t* append_output(size_t bytes){
+        /*
+         * Reserves bytes (a multiple of 8) at the end of the output buffer.
+         */
+        if(out_sent == out_bytes){
+            out_sent = out_bytes = 0 ;
+        }
+        if((out_bytes + bytes) / sizeof(uint64_t) > out.size()){
+            out.resize(std::max(out.size() * 2, (out_bytes + bytes) / sizeof(uint64_t))) ;
+        }
+        uint8_t *p = reinterpret_cast<uint8_t*>(out.data()) + out_bytes ;
+        out_bytes += bytes ;
+        return p ;
+    }
+};
+
+SketchDaemon::SketchDaemon(const std::string &socket_path, uint64_t max_sketch_bytes) :
+    socket_path(socket_path), max_sketch_bytes(max_sketch_bytes){
+    sockaddr_un address = socket_address(socket_path) ;
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) ;
+    unlink(socket_path.c_str()) ;
+    if(listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd, 128) != 0){
+        int err = errno ;
+        if(listen_fd >= 0){
+            close(listen_fd) ;
+        }
+        throw std::runtime_error( "Cannot listen on " + socket_path + ": " + std::strerror(err) );
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC) ;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) ;
+    epoll_event event = {} ;
+    event.events = EPOLLIN ;
+    event.data.fd = listen_fd ;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) ;
+    event.data.fd = wake_fd ;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) ;
+}
+
+SketchDaemon::~SketchDaemon(){
+    while(!connections.empty()){
+        close_connection(connections.begin()->first) ;
+    }
+    close(wake_fd) ;
+    close(epoll_fd) ;
+    close(listen_fd) ;
+    unlink(socket_path.c_str()) ;
+}
+
+void SketchDaemon::stop(){
+    uint64_t one = 1 ;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one)) ;
+    (void)ignored ;
+}
+
+void SketchDaemon::run(){
+    epoll_event events[64] ;
+    while(true){
+        int n = epoll_wait(epoll_fd, events, 64, -1) ;
+        if(n < 0 && errno == EINTR){
+            continue ;
+        }
+        for(int k=0; k < n; k++){
+            int fd = events[k].data.fd ;
+            if(fd == wake_fd){
+                uint64_t value ;
+                ssize_t ignored = read(wake_fd, &value, sizeof(value)) ;
+                (void)ignored ;
+                return ;
+            }
+            if(fd == listen_fd){
+                accept_connections() ;
+                continue ;
+            }
+            auto it = connections.find(fd) ;
+            if(it == connections.end()){
+                continue ;
+            }
+            Connection &c = *it->second ;
+            bool keep = !(events[k].events & (EPOLLERR | EPOLLHUP)) || (events[k].events & EPOLLIN) ;
+            if(keep && (events[k].events & EPOLLIN)){
+                keep = read_frames(c) ;
+            }
+            if(keep){
+                keep = flush_output(c) ;
+            }
+            if(!keep){
+                close_connection(fd) ;
+            }
+        }
+    }
+}
+
+void SketchDaemon::accept_connections(){
+    while(true){
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) ;
+        if(fd < 0){
+            return ;
+        }
+        std::unique_ptr<Connection> c(new Connection(fd)) ;
+        epoll_event event = {} ;
+        event.events = c->events = EPOLLIN ;
+        event.data.fd = fd ;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) ;
+        connections[fd] = std::move(c) ;
+    }
+}
+
+bool SketchDaemon::read_frames(Connection &c){
+    /*
+     * One recv per readiness event keeps connections fair; level-triggered epoll reports the rest later.
+     * Complete frames are handled in place and the trailing partial frame is moved to the front, which keeps
+     * frame starts 8-byte aligned since every frame is a multiple of 8 bytes.
+     */
+    uint8_t *buffer = reinterpret_cast<uint8_t*>(c.in.data()) ;
+    size_t capacity = c.in.size() * sizeof(uint64_t) ;
+    ssize_t n = recv(c.fd, buffer + c.in_bytes, capacity - c.in_bytes, 0) ;
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)){
+        return false ;
+    }
+    if(n < 0){
+        return true ;
+    }
+    c.in_bytes += size_t(n) ;
+    size_t pos = 0 ;
+    while(c.in_bytes - pos >= sizeof(FrameHeader)){
+        FrameHeader header ;
+        std::memcpy(&header, buffer + pos, sizeof(header)) ;
+        if(header.frame_bytes < sizeof(FrameHeader) || header.frame_bytes % 8 != 0 || header.frame_bytes > max_frame_bytes
+           || sizeof(FrameHeader) + padded(header.name_length) > header.frame_bytes){
+            return false ;
+        }
+        if(c.in_bytes - pos < header.frame_bytes){
+            break ;
+        }
+        dispatch_frame(c, header, buffer + pos) ;
+        pos += header.frame_bytes ;
+    }
+    std::memmove(buffer, buffer + pos, c.in_bytes - pos) ;
+    c.in_bytes -= pos ;
+    if(c.in_bytes >= sizeof(FrameHeader)){
+        // Make room for a frame larger than the buffer.
+        FrameHeader header ;
+        std::memcpy(&header, buffer, sizeof(header)) ;
+        if(header.frame_bytes > capacity){
+            c.in.resize(padded(header.frame_bytes) / sizeof(uint64_t)) ;
+        }
+    }
+    return true ;
+}
+
+bool SketchDaemon::flush_output(Connection &c){
+    while(c.out_sent < c.out_bytes){
+        ssize_t n = send(c.fd, reinterpret_cast<const uint8_t*>(c.out.data()) + c.out_sent, c.out_bytes - c.out_sent, MSG_NOSIGNAL) ;
+        if(n < 0 && errno == EINTR){
+            continue ;
+        }
+        if(n < 0 && errno == EAGAIN){
+            break ;
+        }
+        if(n < 0){
+            return false ;
+        }
+        c.out_sent += size_t(n) ;
+    }
+    size_t pending = c.out_bytes - c.out_sent ;
+    uint32_t wanted = (pending < max_pending_output ? uint32_t(EPOLLIN) : 0u) | (pending > 0 ? uint32_t(EPOLLOUT) : 0u) ;
+    if(wanted != c.events){
+        epoll_event event = {} ;
+        event.events = c.events = wanted ;
+        event.data.fd = c.fd ;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &event) ;
+    }
+    return true ;
+}
+
+void SketchDaemon::dispatch_frame(Connection &c, const FrameHeader &header, const uint8_t *frame){
+    /*
+     * A request that throws (a sketch refusing its input, an allocation failing) must not take the daemon and
+     * every sketch it holds down with it. Any partial reply is dropped and the client gets OP_ERROR instead.
+     */
+    const size_t out_bytes = c.out_bytes ;
+    const size_t out_sent = c.out_sent ;
+    std::string message ;
+    try {
+        handle_frame(c, header, frame) ;
+        return ;
+    } catch(const std::exception &e){
+        message = e.what() ;
+    } catch(...){
+        message = "Request failed." ;
+    }
+    c.out_bytes = out_bytes ;
+    c.out_sent = out_sent ;
+    append_error(c.append_output(sizeof(FrameHeader) + padded(message.size())), header.request_id, message) ;
+}
+
+void SketchDaemon::handle_frame(Connection &c, const FrameHeader &header, const uint8_t *frame){
+    const size_t name_bytes = padded(header.name_length) ;
+    const std::string name(reinterpret_cast<const char*>(frame) + sizeof(FrameHeader), header.name_length) ;
+    const uint8_t *payload = frame + sizeof(FrameHeader) + name_bytes ;
+    const size_t payload_bytes = header.frame_bytes - sizeof(FrameHeader) - name_bytes ;
+
+    auto reply = [&](DaemonOp op, uint32_t count, size_t body_bytes) -> uint8_t* {
+        FrameHeader out = {} ;
+        out.frame_bytes = uint32_t(sizeof(FrameHeader) + padded(body_bytes)) ;
+        out.op = op ;
+        out.count = count ;
+        out.request_id = header.request_id ;
+        uint8_t *p = c.append_output(out.frame_bytes) ;
+        std::memcpy(p, &out, sizeof(out)) ;
+        std::memset(p + sizeof(out) + body_bytes, 0, padded(body_bytes) - body_bytes) ;
+        return p + sizeof(out) ;
+    } ;
+    auto fail = [&](const std::string &message){
+        append_error(c.append_output(sizeof(FrameHeader) + padded(message.size())), header.request_id, message) ;
+    } ;
+
+    auto it = sketches.find(name) ;
+    switch(header.op){
+        case OP_CREATE: {
+            uint64_t shape[3] ;
+            if(payload_bytes != sizeof(shape)){
+                return fail("Malformed create request.") ;
+            }
+            std::memcpy(shape, payload, sizeof(shape)) ;
+            if(it == sketches.end()){
+                if(shape[0] == 0 || shape[1] == 0){
+                    return fail("Sketch shape must be positive.") ;
+                }
+                // Dividing rather than multiplying keeps the check itself from overflowing.
+                if(shape[1] > max_sketch_bytes / sizeof(int64_t) / shape[0]){
+                    return fail("Sketch " + name + " would exceed the daemon's table size limit.") ;
+                }
+                std::unique_ptr<CountMinSketch> sketch(new CountMinSketch(shape[0], shape[1], shape[2])) ;
+                sketches[name] = std::move(sketch) ; // only named once it exists
+            } else if(it->second->get_num_hashes() != shape[0] || it->second->get_num_buckets() != shape[1] || it->second->get_seed() != shape[2]){
+                return fail("Sketch " + name + " exists with a different config.") ;
+            }
+            reply(OP_OK, 0, 0) ;
+            return ;
+        }
+        case OP_UPDATE: {
+            const bool weighted = (header.flags & frame_weighted) != 0 ;
+            if(payload_bytes != size_t(header.count) * sizeof(uint64_t) * (weighted ? 2 : 1)){
+                return fail("Malformed update request.") ;
+            }
+            if(it == sketches.end()){
+                return fail("No sketch named " + name + ".") ;
+            }
+            const uint64_t *items = reinterpret_cast<const uint64_t*>(payload) ;
+            it->second->update_batch(items, weighted ? reinterpret_cast<const int64_t*>(items + header.count) : nullptr, header.count) ;
+            if(header.flags & frame_ack){
+                reply(OP_OK, 0, 0) ;
+            }
+            return ;
+        }
+        case OP_QUERY: {
+            if(payload_bytes != size_t(header.count) * sizeof(uint64_t)){
+                return fail("Malformed query request.") ;
+            }
+            if(it == sketches.end()){
+                return fail("No sketch named " + name + ".") ;
+            }
+            // Estimates are written straight into the reply; frames in the output buffer are 8-byte aligned.
+            int64_t *estimates = reinterpret_cast<int64_t*>(reply(OP_RESULT, header.count, header.count * sizeof(int64_t))) ;
+            it->second->get_estimates(reinterpret_cast<const uint64_t*>(payload), header.count, estimates) ;
+            return ;
+        }
+        default:
+            return fail("Unknown request.") ;
+    }
+}
+
+void SketchDaemon::close_connection(int fd){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) ;
+    close(fd) ;
+    connections.erase(fd) ;
+}
+
+SketchClient::SketchClient(const std::string &socket_path){
+    sockaddr_un address = socket_address(socket_path) ;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) ;
+    if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0){
+        int err = errno ;
+        if(fd >= 0){
+            close(fd) ;
+        }
+        throw std::runtime_error( "Cannot connect to " + socket_path + ": " + std::strerror(err) );
+    }
+}
+
+SketchClient::~SketchClient(){
+    close(fd) ;
+}
+
+void SketchClient::send_frame(DaemonOp op, const std::string &name, uint16_t flags, uint32_t count,
+                              const void *payload, size_t payload_bytes, const void *extra, size_t extra_bytes){
+    /*
+     * The header and name are sent from a small buffer and the key arrays straight from the caller's memory.
+     */
+    if(name.size() > 255){
+        throw std::invalid_argument( "Sketch names are at most 255 bytes." );
+    }
+    uint8_t head[sizeof(FrameHeader) + 256] = {} ;
+    FrameHeader header = {} ;
+    header.frame_bytes = uint32_t(sizeof(FrameHeader) + padded(name.size()) + payload_bytes + extra_bytes) ;
+    header.op = op ;
+    header.name_length = uint8_t(name.size()) ;
+    header.flags = flags ;
+    header.count = count ;
+    header.request_id = next_request++ ;
+    std::memcpy(head, &header, sizeof(header)) ;
+    std::memcpy(head + sizeof(header), name.data(), name.size()) ;
+    send_all(fd, head, sizeof(header) + padded(name.size())) ;
+    send_all(fd, payload, payload_bytes) ;
+    send_all(fd, extra, extra_bytes) ;
+}
+
+FrameHeader SketchClient::read_reply(std::vector<uint64_t> &payload){
+    FrameHeader header ;
+    recv_all(fd, &header, sizeof(header)) ;
+    if(header.frame_bytes < sizeof(header) || header.frame_bytes % 8 != 0 || header.frame_bytes > max_frame_bytes){
+        throw std::runtime_error( "Malformed reply from sketch daemon." );
+    }
+    payload.resize((header.frame_bytes - sizeof(header)) / sizeof(uint64_t)) ;
+    recv_all(fd, payload.data(), header.frame_bytes - sizeof(header)) ;
+    if(header.op == OP_ERROR){
+        throw std::runtime_error( std::string(reinterpret_cast<const char*>(payload.data()), std::min<size_t>(header.count, payload.size() * 8)) );
+    }
+    return header ;
+}
+
+void SketchClient::create(const std::string &name, uint64_t num_hashes, uint64_t num_buckets, uint64_t seed){
+    uint64_t shape[3] = {num_hashes, num_buckets, seed} ;
+    send_frame(OP_CREATE, name, 0, 0, shape, sizeof(shape), nullptr, 0) ;
+    read_reply(buffer) ;
+}
+
+void SketchClient::update(const std::string &name, const uint64_t *items, const int64_t *weights, size_t n){
+    const size_t per_frame = (max_frame_bytes - sizeof(FrameHeader) - 256) / (weights == nullptr ? 8 : 16) ;
+    for(size_t start=0; start < n; start += per_frame){
+        size_t len = std::min(per_frame, n - start) ;
+        send_frame(OP_UPDATE, name, weights == nullptr ? 0 : frame_weighted, uint32_t(len),
+                   items + start, len * sizeof(uint64_t), weights == nullptr ? nullptr : weights + start,
+                   weights == nullptr ? 0 : len * sizeof(int64_t)) ;
+    }
+}
+
+void SketchClient::sync(const std::string &name){
+    send_frame(OP_UPDATE, name, frame_ack, 0, nullptr, 0, nullptr, 0) ;
+    read_reply(buffer) ;
+}
+
+void SketchClient::query(const std::string &name, const uint64_t *items, size_t n, int64_t *estimates){
+    const size_t per_frame = (max_frame_bytes - sizeof(FrameHeader) - 256) / sizeof(uint64_t) ;
+    for(size_t start=0; start < n; start += per_frame){
+        size_t len = std::min(per_frame, n - start) ;
+        send_frame(OP_QUERY, name, 0, uint32_t(len), items + start, len * sizeof(uint64_t), nullptr, 0) ;
+        FrameHeader header = read_reply(buffer) ;
+        if(header.op != OP_RESULT || header.count != len){
+            throw std::runtime_error( "Unexpected reply from sketch daemon." );
+        }
+        std::memcpy(estimates + start, buffer.data(), len * sizeof(int64_t)) ;
+    }
+}
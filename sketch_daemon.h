@@ -0,0 +1,113 @@
+//
+// Local daemon hosting named CountMin sketches behind a Unix domain stream socket.
+// One thread runs an epoll loop over the listening socket and every connection and owns all the sketches, so no
+// locking is needed. Each connection reads into one 8-byte aligned buffer and frames are processed in place:
+// the keys of an update or query frame are handed straight to update_batch / get_estimates without being copied.
+//
+// Wire format (host byte order). Every frame starts with a 16 byte header
+//     u32 frame_bytes   whole frame including the header, a multiple of 8
+//     u8  op            a DaemonOp
+//     u8  name_length   sketch name, stored right after the header and zero padded to a multiple of 8
+//     u16 flags         frame_weighted, frame_ack
+//     u32 count         number of keys, or of estimates in a result
+//     u32 request_id    echoed in the reply
+// followed by the padded name and the payload:
+//     OP_CREATE  u64 num_hashes, u64 num_buckets, u64 seed                       reply OP_OK
+//     OP_UPDATE  u64 items[count], then i64 weights[count] if frame_weighted      reply OP_OK only if frame_ack
+//     OP_QUERY   u64 items[count]                                                 reply OP_RESULT with i64 estimates
+// A failed request is answered with OP_ERROR carrying a message; malformed framing closes the connection.
+// A create whose table would exceed the daemon's max_sketch_bytes is refused, so no client can exhaust its memory.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_DAEMON_H
+#define LINEARSKETCHES_SKETCH_DAEMON_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "count_min_sketch.h"
+
+enum DaemonOp : uint8_t {
+    OP_CREATE = 1,
+    OP_UPDATE = 2,
+    OP_QUERY = 3,
+    OP_OK = 16,
+    OP_RESULT = 17,
+    OP_ERROR = 18
+};
+
+const uint16_t frame_weighted = 1 ;
+const uint16_t frame_ack = 2 ;
+const size_t max_frame_bytes = size_t(16) << 20 ;
+const uint64_t default_max_sketch_bytes = uint64_t(1) << 32 ; // largest table a client may create
+
+struct FrameHeader {
+    uint32_t frame_bytes ;
+    uint8_t op ;
+    uint8_t name_length ;
+    uint16_t flags ;
+    uint32_t count ;
+    uint32_t request_id ;
+};
+
+class SketchDaemon {
+public:
+    // Binds and listens, replacing a stale socket file.
+    explicit SketchDaemon(const std::string &socket_path, uint64_t max_sketch_bytes=default_max_sketch_bytes) ;
+    ~SketchDaemon() ;
+    SketchDaemon(const SketchDaemon&) = delete ;
+    SketchDaemon& operator=(const SketchDaemon&) = delete ;
+
+    void run() ; // serves until stop is called
+    void stop() ; // safe from any thread and from signal handlers
+    size_t get_num_sketches() const { return sketches.size() ; } // only meaningful once run has returned
+
+private:
+    struct Connection ;
+
+    std::string socket_path ;
+    uint64_t max_sketch_bytes ;
+    int listen_fd = -1 ;
+    int epoll_fd = -1 ;
+    int wake_fd = -1 ;
+    std::unordered_map<int, std::unique_ptr<Connection> > connections ;
+    std::unordered_map<std::string, std::unique_ptr<CountMinSketch> > sketches ;
+
+    void accept_connections() ;
+    bool read_frames(Connection &c) ; // false when the connection should be closed
+    bool flush_output(Connection &c) ;
+    void dispatch_frame(Connection &c, const FrameHeader &header, const uint8_t *frame) ; // replies OP_ERROR if handling throws
+    void handle_frame(Connection &c, const FrameHeader &header, const uint8_t *frame) ;
+    void close_connection(int fd) ;
+};
+
+class SketchClient {
+    /*
+     * Blocking client. Updates are pipelined without waiting for the daemon; a query waits for its result, and
+     * throws if an error for any earlier request on the connection arrives first.
+     */
+public:
+    explicit SketchClient(const std::string &socket_path) ;
+    ~SketchClient() ;
+    SketchClient(const SketchClient&) = delete ;
+    SketchClient& operator=(const SketchClient&) = delete ;
+
+    void create(const std::string &name, uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+    void update(const std::string &name, const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr
+    void sync(const std::string &name) ; // waits until every earlier update on this connection is applied
+    void query(const std::string &name, const uint64_t *items, size_t n, int64_t *estimates) ;
+
+private:
+    int fd = -1 ;
+    uint32_t next_request = 1 ;
+    std::vector<uint64_t> buffer ;
+
+    void send_frame(DaemonOp op, const std::string &name, uint16_t flags, uint32_t count,
+                    const void *payload, size_t payload_bytes, const void *extra, size_t extra_bytes) ;
+    FrameHeader read_reply(std::vector<uint64_t> &payload) ; // throws on OP_ERROR
+};
+
+#endif //LINEARSKETCHES_SKETCH_DAEMON_H
@@ -0,0 +1,110 @@
+//
+// A delta checkpoint: the counters of a sketch that changed between two epochs.
+//
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "sketch_delta.h"
+#include "sketch_io.h"
+#include "table_codec.h"
+
+const uint64_t SketchDelta::block_shift ;
+const uint64_t SketchDelta::block_counters ;
+
+namespace {
+    const char delta_magic[4] = {'L', 'S', 'C', 'D'} ;
+    const uint32_t delta_format_version = 2 ;
+
+    void write_u64(std::ostream &os, uint64_t x){
+        os.write(reinterpret_cast<const char*>(&x), sizeof(x)) ;
+    }
+    uint64_t read_u64(std::istream &is){
+        uint64_t x = 0 ;
+        is.read(reinterpret_cast<char*>(&x), sizeof(x)) ;
+        return x ;
+    }
+
+    uint64_t max_delta_blocks(const std::vector<uint64_t> &config, std::istream &is){
+        /*
+         * A delta can't have more blocks than its sketch's table, and each block's counters take at least one
+         * byte per codec block, so a seekable stream also bounds the count by the bytes left in it.
+         */
+        if(config.size() < 2 || (config[1] != 0 && config[0] > std::numeric_limits<uint64_t>::max() / config[1])){
+            return 0 ;
+        }
+        uint64_t table_counters = config[0] * config[1] ;
+        uint64_t bound = table_counters / SketchDelta::block_counters + (table_counters % SketchDelta::block_counters != 0) ;
+        std::streampos here = is.tellg() ;
+        if(here != std::streampos(-1) && is.seekg(0, std::ios::end)){
+            std::streampos end = is.tellg() ;
+            is.seekg(here) ;
+            if(end != std::streampos(-1) && end >= here){
+                uint64_t per_block = SketchDelta::block_counters / codec_block_counters ;
+                bound = std::min<uint64_t>(bound, uint64_t(end - here) / per_block) ;
+            }
+        }
+        is.clear() ;
+        return bound ;
+    }
+}
+
+void SketchDelta::serialize(std::ostream &os) const {
+    /*
+     * magic, version, config size, config, from_epoch, to_epoch, total_weight, number of blocks, then the
+     * gaps between consecutive block ids and the counter differences, both with the counter codec.
+     */
+    os.write(delta_magic, sizeof(delta_magic)) ;
+    os.write(reinterpret_cast<const char*>(&delta_format_version), sizeof(delta_format_version)) ;
+    write_u64(os, config.size()) ;
+    for(uint64_t c : config){
+        write_u64(os, c) ;
+    }
+    write_u64(os, from_epoch) ;
+    write_u64(os, to_epoch) ;
+    write_u64(os, uint64_t(total_weight)) ;
+    write_u64(os, block_ids.size()) ;
+    std::vector<int64_t> gaps(block_ids.size()) ;
+    for(uint64_t k=0; k < block_ids.size(); k++){
+        gaps[k] = int64_t(block_ids[k] - (k == 0 ? 0 : block_ids[k - 1])) ;
+    }
+    write_counters(os, gaps.data(), gaps.size()) ;
+    write_counters(os, counters.data(), counters.size()) ;
+}
+
+SketchDelta SketchDelta::deserialize(std::istream &is){
+    char magic[sizeof(delta_magic)] ;
+    uint32_t version = 0 ;
+    is.read(magic, sizeof(magic)) ;
+    is.read(reinterpret_cast<char*>(&version), sizeof(version)) ;
+    uint64_t config_size = read_u64(is) ;
+    if(!is || std::memcmp(magic, delta_magic, sizeof(magic)) != 0 || version != delta_format_version || config_size > 64){
+        throw std::invalid_argument( "Not a serialized sketch delta." );
+    }
+    SketchDelta delta ;
+    for(uint64_t i=0; i < config_size; i++){
+        delta.config.push_back(read_u64(is)) ;
+    }
+    delta.from_epoch = read_u64(is) ;
+    delta.to_epoch = read_u64(is) ;
+    delta.total_weight = int64_t(read_u64(is)) ;
+    uint64_t num_blocks = read_u64(is) ;
+    if(!is){
+        throw std::invalid_argument( "Truncated sketch delta." );
+    }
+    if(num_blocks > max_delta_blocks(delta.config, is)){
+        throw std::invalid_argument( "Sketch delta has more blocks than its table." );
+    }
+    std::vector<int64_t> gaps(num_blocks) ;
+    read_counters(is, gaps.data(), gaps.size()) ;
+    delta.block_ids.resize(num_blocks) ;
+    for(uint64_t k=0; k < num_blocks; k++){
+        delta.block_ids[k] = (k == 0 ? 0 : delta.block_ids[k - 1]) + uint64_t(gaps[k]) ;
+        if(k > 0 && delta.block_ids[k] <= delta.block_ids[k - 1]){ // also catches gaps that overflow
+            throw std::invalid_argument( "Sketch delta block ids are not increasing." );
+        }
+    }
+    delta.counters.resize(num_blocks * block_counters) ;
+    read_counters(is, delta.counters.data(), delta.counters.size()) ;
+    return delta ;
+}
@@ -0,0 +1,33 @@
+//
+// A delta checkpoint: the counters of a sketch that changed between two epochs.
+// Only blocks of delta_block_counters counters (4KB) with at least one changed counter are included, and each
+// carries the per-counter differences, so shipping and applying a delta costs in proportion to how much of
+// the table changed rather than to its size. See CountingSketch::export_delta and CountingSketch::apply_delta.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_DELTA_H
+#define LINEARSKETCHES_SKETCH_DELTA_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+struct SketchDelta {
+    static const uint64_t block_shift = 9 ;
+    static const uint64_t block_counters = uint64_t(1) << block_shift ;
+
+    std::vector<uint64_t> config ; // config of the sketch the delta was exported from
+    uint64_t from_epoch = 0 ; // the delta takes a sketch at from_epoch ...
+    uint64_t to_epoch = 0 ; // ... to to_epoch
+    int64_t total_weight = 0 ; // change in total weight
+    std::vector<uint64_t> block_ids ; // blocks with a changed counter, ascending
+    std::vector<int64_t> counters ; // block_counters differences per block, in block_ids order
+
+    uint64_t get_num_blocks() const { return block_ids.size() ; }
+
+    void serialize(std::ostream &os) const ;
+    static SketchDelta deserialize(std::istream &is) ;
+};
+
+#endif //LINEARSKETCHES_SKETCH_DELTA_H
@@ -0,0 +1,80 @@
+//
+// Serialized sketch format shared by CountMinSketch, its snapshots and checkpoints.
+//
+#include <cstring>
+#include <stdexcept>
+#include "sketch_io.h"
+#include "table_codec.h"
+
+namespace {
+    // Serialized sketches start with this tag followed by a format version.
+    const char sketch_magic[4] = {'L', 'S', 'C', 'M'} ;
+    const uint32_t sketch_format_version = 2 ;
+    const uint64_t max_config_size = 64 ;
+}
+
+void write_sketch_header(std::ostream &os, const std::vector<uint64_t> &config, int64_t total_weight){
+    uint64_t config_size = config.size() ;
+    os.write(sketch_magic, sizeof(sketch_magic)) ;
+    os.write(reinterpret_cast<const char*>(&sketch_format_version), sizeof(sketch_format_version)) ;
+    os.write(reinterpret_cast<const char*>(&config_size), sizeof(config_size)) ;
+    os.write(reinterpret_cast<const char*>(config.data()), config_size * sizeof(uint64_t)) ;
+    os.write(reinterpret_cast<const char*>(&total_weight), sizeof(total_weight)) ;
+    if(!os){
+        throw std::runtime_error( "Failed to write sketch." );
+    }
+}
+
+std::vector<uint64_t> read_sketch_header(std::istream &is, int64_t &total_weight){
+    /*
+     * Returns the config and sets total_weight. The caller checks the config is one it can load.
+     */
+    char magic[sizeof(sketch_magic)] ;
+    uint32_t version = 0 ;
+    uint64_t config_size = 0 ;
+    is.read(magic, sizeof(magic)) ;
+    is.read(reinterpret_cast<char*>(&version), sizeof(version)) ;
+    is.read(reinterpret_cast<char*>(&config_size), sizeof(config_size)) ;
+    if(!is || std::memcmp(magic, sketch_magic, sizeof(magic)) != 0 || version != sketch_format_version || config_size > max_config_size){
+        throw std::invalid_argument( "Not a serialized CountMin sketch." );
+    }
+    std::vector<uint64_t> config(config_size) ;
+    is.read(reinterpret_cast<char*>(config.data()), config_size * sizeof(uint64_t)) ;
+    is.read(reinterpret_cast<char*>(&total_weight), sizeof(total_weight)) ;
+    if(!is){
+        throw std::invalid_argument( "Not a serialized CountMin sketch." );
+    }
+    return config ;
+}
+
+void write_counters(std::ostream &os, const int64_t *counters, size_t n){
+    std::vector<uint8_t> encoded ;
+    encoded.reserve(n / 4) ;
+    encode_counters(counters, n, encoded) ;
+    write_encoded_counters(os, encoded) ;
+}
+
+void write_encoded_counters(std::ostream &os, const std::vector<uint8_t> &encoded){
+    uint64_t encoded_size = encoded.size() ;
+    os.write(reinterpret_cast<const char*>(&encoded_size), sizeof(encoded_size)) ;
+    os.write(reinterpret_cast<const char*>(encoded.data()), encoded_size) ;
+    if(!os){
+        throw std::runtime_error( "Failed to write sketch." );
+    }
+}
+
+void read_counters(std::istream &is, int64_t *counters, size_t n){
+    /*
+     * The encoded table is read in one go and decoded from memory so loading stays I/O bound.
+     */
+    uint64_t encoded_size = 0 ;
+    is.read(reinterpret_cast<char*>(&encoded_size), sizeof(encoded_size)) ;
+    if(!is || encoded_size > max_encoded_bytes(n)){
+        throw std::invalid_argument( "Truncated CountMin sketch." );
+    }
+    std::vector<uint8_t> encoded(encoded_size) ;
+    is.read(reinterpret_cast<char*>(encoded.data()), encoded_size) ;
+    if(!is || decode_counters(encoded.data(), encoded.size(), counters, n) != encoded_size){
+        throw std::invalid_argument( "Truncated CountMin sketch." );
+    }
+}
@@ -0,0 +1,24 @@
+//
+// Serialized sketch format shared by CountMinSketch, its snapshots and checkpoints.
+// A serialized sketch is: magic "LSCM", format version, the config vector (see get_config), the total weight
+// and then the counters of the table in row-major order, compressed with the block codec in table_codec.h
+// and prefixed by their encoded length. Integers are written in host byte order.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_IO_H
+#define LINEARSKETCHES_SKETCH_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+void write_sketch_header(std::ostream &os, const std::vector<uint64_t> &config, int64_t total_weight) ;
+std::vector<uint64_t> read_sketch_header(std::istream &is, int64_t &total_weight) ;
+
+void write_counters(std::ostream &os, const int64_t *counters, size_t n) ;
+void write_encoded_counters(std::ostream &os, const std::vector<uint8_t> &encoded) ; // for tables encoded piecewise with encode_counters
+void read_counters(std::istream &is, int64_t *counters, size_t n) ;
+
+#endif //LINEARSKETCHES_SKETCH_IO_H
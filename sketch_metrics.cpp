@@ -0,0 +1,241 @@
+//
+// Optional hot-path metrics for the sketches.
+//
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include "sketch_metrics.h"
+
+const size_t LatencyHistogram::sub_bucket_bits ;
+const size_t LatencyHistogram::num_buckets ;
+
+namespace {
+    const char *op_names[num_metric_ops] = {"update", "query", "merge"} ;
+    const double reported_quantiles[] = {0.5, 0.9, 0.99, 0.999} ;
+
+    struct ThreadMetrics {
+        /*
+         * Written only by the owning thread, read by scrapers. The counters are atomics so that reads from
+         * another thread are well defined, but the owner updates them with a plain load and store rather than
+         * a locked read-modify-write.
+         */
+        std::atomic<uint64_t> operations[num_metric_ops] ;
+        std::atomic<uint64_t> calls[num_metric_ops] ;
+        std::atomic<uint64_t> batch_sizes[64] ;
+        std::atomic<uint64_t> latency[num_metric_ops][LatencyHistogram::num_buckets] ;
+        uint64_t sample_countdown = metrics_sample_period ;
+
+        ThreadMetrics(){
+            for(size_t op=0; op < num_metric_ops; op++){
+                operations[op].store(0) ;
+                calls[op].store(0) ;
+                for(std::atomic<uint64_t> &c : latency[op]){
+                    c.store(0) ;
+                }
+            }
+            for(std::atomic<uint64_t> &c : batch_sizes){
+                c.store(0) ;
+            }
+        }
+    };
+
+    inline void bump(std::atomic<uint64_t> &counter, uint64_t amount){
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed) ;
+    }
+
+    void add_thread_metrics(const ThreadMetrics &t, SketchMetrics &out){
+        for(size_t op=0; op < num_metric_ops; op++){
+            out.operations[op] += t.operations[op].load(std::memory_order_relaxed) ;
+            out.calls[op] += t.calls[op].load(std::memory_order_relaxed) ;
+            std::vector<uint64_t> &counts = out.latency[op].get_counts() ;
+            for(size_t b=0; b < LatencyHistogram::num_buckets; b++){
+                counts[b] += t.latency[op][b].load(std::memory_order_relaxed) ;
+            }
+        }
+        for(size_t k=0; k < out.batch_sizes.size(); k++){
+            out.batch_sizes[k] += t.batch_sizes[k].load(std::memory_order_relaxed) ;
+        }
+    }
+
+    struct MetricsRegistry {
+        std::mutex mutex ;
+        std::vector<ThreadMetrics*> live ;
+        SketchMetrics retired ; // totals of threads that have exited
+    };
+
+    MetricsRegistry& registry(){
+        // Never destroyed so that threads exiting during static destruction can still retire their metrics.
+        static MetricsRegistry *r = new MetricsRegistry ;
+        return *r ;
+    }
+
+    struct ThreadMetricsHandle {
+        ThreadMetrics *metrics ;
+
+        ThreadMetricsHandle() : metrics(new ThreadMetrics){
+            MetricsRegistry &r = registry() ;
+            std::lock_guard<std::mutex> lock(r.mutex) ;
+            r.live.push_back(metrics) ;
+        }
+
+        ~ThreadMetricsHandle(){
+            MetricsRegistry &r = registry() ;
+            {
+                std::lock_guard<std::mutex> lock(r.mutex) ;
+                add_thread_metrics(*metrics, r.retired) ;
+                r.live.erase(std::find(r.live.begin(), r.live.end(), metrics)) ;
+            }
+            delete metrics ;
+        }
+    };
+
+    ThreadMetrics& local_metrics(){
+        thread_local ThreadMetricsHandle handle ;
+        return *handle.metrics ;
+    }
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t value){
+    if(value < (uint64_t(2) << sub_bucket_bits)){
+        return value ;
+    }
+    uint64_t exponent = 63 - __builtin_clzll(value) ;
+    uint64_t shift = exponent - sub_bucket_bits ;
+    return ((exponent - sub_bucket_bits + 1) << sub_bucket_bits) + ((value >> shift) - (uint64_t(1) << sub_bucket_bits)) ;
+}
+
+uint64_t LatencyHistogram::bucket_upper(size_t bucket){
+    if(bucket < (size_t(2) << sub_bucket_bits)){
+        return bucket ;
+    }
+    uint64_t shift = (bucket >> sub_bucket_bits) - 1 ;
+    uint64_t low = ((bucket & ((size_t(1) << sub_bucket_bits) - 1)) + (uint64_t(1) << sub_bucket_bits)) << shift ;
+    return low + ((uint64_t(1) << shift) - 1) ;
+}
+
+void LatencyHistogram::add(const LatencyHistogram &other){
+    for(size_t b=0; b < num_buckets; b++){
+        counts[b] += other.counts[b] ;
+    }
+}
+
+uint64_t LatencyHistogram::get_count() const {
+    uint64_t total = 0 ;
+    for(uint64_t c : counts){
+        total += c ;
+    }
+    return total ;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    uint64_t total = get_count() ;
+    if(total == 0){
+        return 0 ;
+    }
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(q * double(total)))) ;
+    uint64_t seen = 0 ;
+    for(size_t b=0; b < num_buckets; b++){
+        seen += counts[b] ;
+        if(seen >= rank){
+            return bucket_upper(b) ;
+        }
+    }
+    return bucket_upper(num_buckets - 1) ;
+}
+
+SketchMetrics scrape_metrics(){
+    MetricsRegistry &r = registry() ;
+    std::lock_guard<std::mutex> lock(r.mutex) ;
+    SketchMetrics metrics = r.retired ;
+    for(const ThreadMetrics *t : r.live){
+        add_thread_metrics(*t, metrics) ;
+    }
+#ifdef LINEARSKETCHES_METRICS
+    metrics.enabled = true ;
+#endif
+    return metrics ;
+}
+
+std::string format_metrics(const SketchMetrics &metrics){
+    std::ostringstream out ;
+    out << "# TYPE linearsketches_metrics_enabled gauge\n" ;
+    out << "linearsketches_metrics_enabled " << (metrics.enabled ? 1 : 0) << "\n" ;
+    out << "# TYPE linearsketches_operations_total counter\n" ;
+    for(size_t op=0; op < num_metric_ops; op++){
+        out << "linearsketches_operations_total{op=\"" << op_names[op] << "\"} " << metrics.operations[op] << "\n" ;
+    }
+    out << "# TYPE linearsketches_calls_total counter\n" ;
+    for(size_t op=0; op < num_metric_ops; op++){
+        out << "linearsketches_calls_total{op=\"" << op_names[op] << "\"} " << metrics.calls[op] << "\n" ;
+    }
+    out << "# TYPE linearsketches_batch_size histogram\n" ;
+    uint64_t cumulative = 0 ;
+    for(size_t k=0; k < metrics.batch_sizes.size() && cumulative < metrics.calls[METRIC_UPDATE] + metrics.calls[METRIC_QUERY]; k++){
+        cumulative += metrics.batch_sizes[k] ;
+        out << "linearsketches_batch_size_bucket{le=\"" << ((uint64_t(2) << k) - 1) << "\"} " << cumulative << "\n" ;
+    }
+    out << "linearsketches_batch_size_bucket{le=\"+Inf\"} " << cumulative << "\n" ;
+    out << "linearsketches_batch_size_count " << cumulative << "\n" ;
+    out << "# TYPE linearsketches_latency_ns summary\n" ;
+    for(size_t op=0; op < num_metric_ops; op++){
+        for(double q : reported_quantiles){
+            out << "linearsketches_latency_ns{op=\"" << op_names[op] << "\",quantile=\"" << q << "\"} "
+                << metrics.latency[op].percentile(q) << "\n" ;
+        }
+        out << "linearsketches_latency_ns_count{op=\"" << op_names[op] << "\"} " << metrics.latency[op].get_count() << "\n" ;
+    }
+    return out.str() ;
+}
+
+template <class Counter>
+TableOccupancy measure_occupancy(const Counter *counters, size_t n){
+    TableOccupancy occupancy ;
+    occupancy.counters = n ;
+    for(size_t k=0; k < n; k++){
+        occupancy.nonzero += (counters[k] != 0) ;
+        occupancy.saturated += (counters[k] == std::numeric_limits<Counter>::max()) ;
+    }
+    return occupancy ;
+}
+
+std::string format_occupancy(const std::string &sketch_name, const TableOccupancy &occupancy){
+    std::ostringstream out ;
+    out << "linearsketches_table_counters{sketch=\"" << sketch_name << "\"} " << occupancy.counters << "\n" ;
+    out << "linearsketches_table_fill_ratio{sketch=\"" << sketch_name << "\"} " << occupancy.fill_ratio() << "\n" ;
+    out << "linearsketches_table_saturated_counters{sketch=\"" << sketch_name << "\"} " << occupancy.saturated << "\n" ;
+    return out.str() ;
+}
+
+MetricsScope::MetricsScope(MetricOp op, uint64_t n) : op(op), n(n), sampled(false){
+    /*
+     * Merges are rare and expensive so every one is timed; other calls are timed one in metrics_sample_period.
+     */
+    ThreadMetrics &t = local_metrics() ;
+    bump(t.operations[op], n) ;
+    bump(t.calls[op], 1) ;
+    if(op != METRIC_MERGE){
+        bump(t.batch_sizes[(n == 0) ? 0 : 63 - __builtin_clzll(n)], 1) ;
+    }
+    if(op == METRIC_MERGE || --t.sample_countdown == 0){
+        if(op != METRIC_MERGE){
+            t.sample_countdown = metrics_sample_period ;
+        }
+        sampled = true ;
+        start = std::chrono::steady_clock::now() ;
+    }
+}
+
+MetricsScope::~MetricsScope(){
+    if(sampled){
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() ;
+        bump(local_metrics().latency[op][LatencyHistogram::bucket_of(elapsed / std::max<uint64_t>(n, 1))], 1) ;
+    }
+}
+
+template TableOccupancy measure_occupancy<int64_t>(const int64_t*, size_t) ;
+template TableOccupancy measure_occupancy<uint8_t>(const uint8_t*, size_t) ;
+template TableOccupancy measure_occupancy<uint16_t>(const uint16_t*, size_t) ;
+template TableOccupancy measure_occupancy<uint32_t>(const uint32_t*, size_t) ;
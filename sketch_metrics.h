@@ -0,0 +1,100 @@
+//
+// Optional hot-path metrics for the sketches.
+// When built with LINEARSKETCHES_METRICS (cmake -DLINEARSKETCHES_METRICS=ON) every update, query and merge of a
+// BasicCountMinSketch is counted in a per-thread block that only its own thread writes, so recording never
+// contends. One call in metrics_sample_period (and every merge) is also timed into a log-linear latency
+// histogram in the style of HdrHistogram. scrape_metrics sums every thread's block and format_metrics renders
+// the result in the Prometheus text format. Without the flag SKETCH_METRICS_SCOPE expands to nothing and the
+// sketches contain no metrics code at all; scrape_metrics then reports enabled == false.
+// Table occupancy (fill ratio and saturated counters) is measured on demand from the table itself.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_METRICS_H
+#define LINEARSKETCHES_SKETCH_METRICS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum MetricOp {
+    METRIC_UPDATE = 0, // counts items inserted
+    METRIC_QUERY = 1, // counts items estimated
+    METRIC_MERGE = 2 // counts sketches merged in
+};
+const size_t num_metric_ops = 3 ;
+const uint64_t metrics_sample_period = 64 ;
+
+class LatencyHistogram {
+    /*
+     * Log-linear buckets: values below 32 are exact and every power-of-two range above is split into 16
+     * buckets, so any recorded value is known to within 1/16 of itself across the full 64-bit range.
+     */
+public:
+    static const size_t sub_bucket_bits = 4 ;
+    static const size_t num_buckets = (64 - sub_bucket_bits + 1) << sub_bucket_bits ;
+
+    LatencyHistogram() : counts(num_buckets, 0) {}
+    static size_t bucket_of(uint64_t value) ;
+    static uint64_t bucket_upper(size_t bucket) ; // largest value that lands in bucket
+
+    void record(uint64_t value, uint64_t count=1) { counts[bucket_of(value)] += count ; }
+    void add(const LatencyHistogram &other) ;
+    uint64_t get_count() const ;
+    uint64_t percentile(double q) const ; // upper edge of the bucket holding the q-quantile, 0 if empty
+    const std::vector<uint64_t>& get_counts() const { return counts ; }
+    std::vector<uint64_t>& get_counts() { return counts ; }
+
+private:
+    std::vector<uint64_t> counts ;
+};
+
+struct SketchMetrics {
+    bool enabled = false ;
+    uint64_t operations[num_metric_ops] = {} ; // items updated or queried, sketches merged
+    uint64_t calls[num_metric_ops] = {} ;
+    std::vector<uint64_t> batch_sizes = std::vector<uint64_t>(64, 0) ; // batch_sizes[k] counts calls with 2^k <= n < 2^(k+1) items
+    LatencyHistogram latency[num_metric_ops] ; // sampled nanoseconds per item
+};
+
+SketchMetrics scrape_metrics() ; // totals over every thread, including threads that have exited
+std::string format_metrics(const SketchMetrics &metrics) ;
+
+struct TableOccupancy {
+    uint64_t counters = 0 ;
+    uint64_t nonzero = 0 ;
+    uint64_t saturated = 0 ; // counters pinned at the largest value their type holds
+    double fill_ratio() const { return counters == 0 ? 0.0 : double(nonzero) / double(counters) ; }
+    double saturation_ratio() const { return counters == 0 ? 0.0 : double(saturated) / double(counters) ; }
+};
+
+template <class Counter>
+TableOccupancy measure_occupancy(const Counter *counters, size_t n) ;
+std::string format_occupancy(const std::string &sketch_name, const TableOccupancy &occupancy) ;
+
+class MetricsScope {
+    /*
+     * Counts one call of n items on construction and, if the call is sampled, records its latency per
+     * item on destruction. Use through SKETCH_METRICS_SCOPE so it disappears when metrics are off.
+     */
+public:
+    MetricsScope(MetricOp op, uint64_t n) ;
+    ~MetricsScope() ;
+    MetricsScope(const MetricsScope&) = delete ;
+    MetricsScope& operator=(const MetricsScope&) = delete ;
+
+private:
+    MetricOp op ;
+    uint64_t n ;
+    bool sampled ;
+    std::chrono::steady_clock::time_point start ;
+};
+
+#ifdef LINEARSKETCHES_METRICS
+#define SKETCH_METRICS_SCOPE(op, n) MetricsScope sketch_metrics_scope((op), (n))
+#else
+#define SKETCH_METRICS_SCOPE(op, n) ((void)0)
+#endif
+
+#endif //LINEARSKETCHES_SKETCH_METRICS_H
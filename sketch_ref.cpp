@@ -0,0 +1,41 @@
+//
+// Type-erased reference to a sketch.
+//
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "sketch_ref.h"
+
+template <class Sketch>
+class SketchRef::Model : public SketchRef::Concept {
+    /*
+     * Forwards every call to the sketch, where it is statically dispatched.
+     */
+public:
+    explicit Model(Sketch &sketch) : sketch(sketch) {}
+
+    void update(uint64_t item, int64_t weight) override { sketch.update(item, weight) ; }
+    void update_batch(const uint64_t *items, const int64_t *weights, size_t n) override { sketch.update_batch(items, weights, n) ; }
+    int64_t get_estimate(uint64_t item) override { return sketch.get_estimate(item) ; }
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) override { sketch.get_estimates(items, n, estimates) ; }
+    int64_t get_upper_bound(uint64_t item) override { return sketch.get_upper_bound(item) ; }
+    int64_t get_lower_bound(uint64_t item) override { return sketch.get_lower_bound(item) ; }
+    int64_t get_total_weight() const override { return sketch.get_total_weight() ; }
+    float get_epsilon() const override { return sketch.get_epsilon() ; }
+    uint64_t get_memory_bytes() const override { return sketch.get_memory_bytes() ; }
+    std::vector<uint64_t> get_config() const override { return sketch.get_config() ; }
+    void reset() override { sketch.reset() ; }
+
+private:
+    Sketch &sketch ;
+};
+
+template <class Sketch, class>
+SketchRef::SketchRef(Sketch &sketch) : impl(std::make_shared<Model<Sketch> >(sketch)) {}
+
+template SketchRef::SketchRef(CountMinSketch&) ;
+template SketchRef::SketchRef(MultiplyShiftCountMinSketch&) ;
+template SketchRef::SketchRef(TabulationCountMinSketch&) ;
+template SketchRef::SketchRef(DoubleHashCountMinSketch&) ;
+template SketchRef::SketchRef(BlockedCountMinSketch8&) ;
+template SketchRef::SketchRef(BlockedCountMinSketch16&) ;
+template SketchRef::SketchRef(BlockedCountMinSketch32&) ;
@@ -0,0 +1,66 @@
+//
+// Type-erased reference to a sketch, for callers that choose the sketch at run time (from a config file, a
+// command line flag, ...) rather than at compile time.
+// The sketches themselves have no virtual functions: each one offers the same statically dispatched interface
+//     update(item, weight)                      update_batch(items, weights, n)
+//     get_estimate(item)                        get_estimates(items, n, estimates)
+//     get_upper_bound(item)                     get_lower_bound(item)
+//     get_total_weight()  get_epsilon()  get_memory_bytes()  get_config()  reset()
+// and the templates in this library (SampledSketch, IngestQueue, AsyncQueryService, ...) are instantiated on
+// it directly. SketchRef forwards the same calls through one indirect call each, so prefer the batched forms
+// when going through it.
+//
+// A SketchRef does not own its sketch, which must outlive it.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_REF_H
+#define LINEARSKETCHES_SKETCH_REF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+class SketchRef {
+public:
+    // Instantiated for the CountMin and blocked CountMin sketches. Not a candidate for copying a SketchRef.
+    template <class Sketch, class = typename std::enable_if<!std::is_same<Sketch, SketchRef>::value>::type>
+    SketchRef(Sketch &sketch) ;
+
+    void update(uint64_t item, int64_t weight=1) { impl->update(item, weight) ; }
+    void update_batch(const uint64_t *items, const int64_t *weights, size_t n) { impl->update_batch(items, weights, n) ; }
+    int64_t get_estimate(uint64_t item) const { return impl->get_estimate(item) ; }
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const { impl->get_estimates(items, n, estimates) ; }
+    int64_t get_upper_bound(uint64_t item) const { return impl->get_upper_bound(item) ; }
+    int64_t get_lower_bound(uint64_t item) const { return impl->get_lower_bound(item) ; }
+    int64_t get_total_weight() const { return impl->get_total_weight() ; }
+    float get_epsilon() const { return impl->get_epsilon() ; }
+    uint64_t get_memory_bytes() const { return impl->get_memory_bytes() ; }
+    std::vector<uint64_t> get_config() const { return impl->get_config() ; }
+    void reset() { impl->reset() ; }
+
+private:
+    class Concept {
+    public:
+        virtual ~Concept() {}
+        virtual void update(uint64_t item, int64_t weight) = 0 ;
+        virtual void update_batch(const uint64_t *items, const int64_t *weights, size_t n) = 0 ;
+        virtual int64_t get_estimate(uint64_t item) = 0 ;
+        virtual void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) = 0 ;
+        virtual int64_t get_upper_bound(uint64_t item) = 0 ;
+        virtual int64_t get_lower_bound(uint64_t item) = 0 ;
+        virtual int64_t get_total_weight() const = 0 ;
+        virtual float get_epsilon() const = 0 ;
+        virtual uint64_t get_memory_bytes() const = 0 ;
+        virtual std::vector<uint64_t> get_config() const = 0 ;
+        virtual void reset() = 0 ;
+    };
+
+    template <class Sketch>
+    class Model ;
+
+    std::shared_ptr<Concept> impl ; // shared so that copies of a SketchRef refer to the same sketch
+};
+
+#endif //LINEARSKETCHES_SKETCH_REF_H
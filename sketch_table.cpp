@@ -0,0 +1,202 @@
+//
+// Storage for sketch tables.
+//
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <sys/mman.h>
+#include "sketch_table.h"
+#include "numa_placement.h"
+
+const size_t ZeroedBuffer::mapping_threshold ;
+const size_t ZeroedBuffer::release_threshold ;
+
+namespace {
+    const size_t cache_line_bytes = 64 ;
+}
+
+ZeroedBuffer::ZeroedBuffer(size_t num_bytes){
+    allocate(num_bytes) ;
+}
+
+ZeroedBuffer::ZeroedBuffer(const ZeroedBuffer &other){
+    allocate(other.num_bytes) ;
+    if(num_bytes > 0){
+        std::memcpy(ptr, other.ptr, num_bytes) ;
+    }
+}
+
+ZeroedBuffer::ZeroedBuffer(ZeroedBuffer &&other) noexcept :
+    ptr(other.ptr), num_bytes(other.num_bytes), mapped(other.mapped){
+    other.ptr = nullptr ;
+    other.num_bytes = 0 ;
+    other.mapped = false ;
+}
+
+ZeroedBuffer& ZeroedBuffer::operator=(const ZeroedBuffer &other){
+    if(this != &other){
+        ZeroedBuffer copy(other) ;
+        *this = std::move(copy) ;
+    }
+    return *this ;
+}
+
+ZeroedBuffer& ZeroedBuffer::operator=(ZeroedBuffer &&other) noexcept {
+    if(this != &other){
+        release() ;
+        ptr = other.ptr ;
+        num_bytes = other.num_bytes ;
+        mapped = other.mapped ;
+        other.ptr = nullptr ;
+        other.num_bytes = 0 ;
+        other.mapped = false ;
+    }
+    return *this ;
+}
+
+ZeroedBuffer::~ZeroedBuffer(){
+    release() ;
+}
+
+void ZeroedBuffer::allocate(size_t bytes){
+    /*
+     * Anonymous private mappings are backed by the shared zero page until written, so large buffers
+     * cost no page faults or memory at construction. Small buffers use the heap and are zeroed directly.
+     */
+    num_bytes = bytes ;
+    mapped = bytes >= mapping_threshold ;
+    if(bytes == 0){
+        ptr = nullptr ;
+        return ;
+    }
+    if(mapped){
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) ;
+        if(ptr == MAP_FAILED){
+            ptr = nullptr ;
+            throw std::bad_alloc() ;
+        }
+    } else {
+        if(posix_memalign(&ptr, cache_line_bytes, bytes) != 0){
+            ptr = nullptr ;
+            throw std::bad_alloc() ;
+        }
+        std::memset(ptr, 0, bytes) ;
+    }
+}
+
+void ZeroedBuffer::release(){
+    if(ptr == nullptr){
+        return ;
+    }
+    if(mapped){
+        munmap(ptr, num_bytes) ;
+    } else {
+        free(ptr) ;
+    }
+    ptr = nullptr ;
+}
+
+void ZeroedBuffer::zero(){
+    /*
+     * Very large mappings are zeroed by dropping their pages: MADV_DONTNEED on a private anonymous mapping
+     * makes the next access fault in a fresh zero page, so the cost moves to the pages that are used again.
+     * Everything else is cleared with a bulk memset.
+     */
+    if(ptr == nullptr){
+        return ;
+    }
+    if(mapped && num_bytes >= release_threshold && madvise(ptr, num_bytes, MADV_DONTNEED) == 0){
+        return ;
+    }
+    std::memset(ptr, 0, num_bytes) ;
+}
+
+bool ZeroedBuffer::advise_huge_pages(){
+#ifdef MADV_HUGEPAGE
+    if(mapped && ptr != nullptr){
+        return madvise(ptr, num_bytes, MADV_HUGEPAGE) == 0 ;
+    }
+#endif
+    return false ;
+}
+
+bool ZeroedBuffer::interleave_across_nodes(){
+    /*
+     * Heap buffers may share pages with unrelated allocations so only mappings are placed.
+     */
+    return mapped && interleave_pages_across_nodes(ptr, num_bytes) ;
+}
+
+bool ZeroedBuffer::bind_to_node(unsigned node){
+    return mapped && bind_pages_to_node(ptr, num_bytes, node) ;
+}
+
+const uint64_t SketchTable::clear_block_shift ;
+const uint64_t SketchTable::clear_block_counters ;
+
+void SketchTable::zero(){
+    buffer.zero() ;
+    std::fill(block_epoch.begin(), block_epoch.end(), epoch) ;
+}
+
+void SketchTable::enable_lazy_clear(){
+    /*
+     * The current contents count as cleared in the current epoch.
+     */
+    if(!lazy_clear){
+        lazy_clear = true ;
+        block_epoch.assign((size() + clear_block_counters - 1) >> clear_block_shift, epoch) ;
+    }
+}
+
+void SketchTable::clear_lazily(){
+    /*
+     * When the 32-bit epoch wraps, old tags would look current again, so the table is zeroed for real once.
+     */
+    if(!lazy_clear){
+        zero() ;
+        return ;
+    }
+    if(++epoch == 0){
+        zero() ;
+    }
+}
+
+void SketchTable::clear_block(uint64_t block){
+    uint64_t start = block << clear_block_shift ;
+    uint64_t len = std::min<uint64_t>(clear_block_counters, size() - start) ;
+    std::fill(data() + start, data() + start + len, int64_t(0)) ;
+    block_epoch[block] = epoch ;
+}
+
+void SketchTable::read_range(uint64_t begin, uint64_t end, int64_t *out) const {
+    /*
+     * Block at a time, copying live blocks and writing zeros for stale ones.
+     */
+    if(!lazy_clear){
+        std::copy(data() + begin, data() + end, out) ;
+        return ;
+    }
+    for(uint64_t k=begin; k < end; ){
+        uint64_t block_end = std::min(end, ((k >> clear_block_shift) + 1) << clear_block_shift) ;
+        if(is_stale(k >> clear_block_shift)){
+            std::fill(out + (k - begin), out + (block_end - begin), int64_t(0)) ;
+        } else {
+            std::copy(data() + k, data() + block_end, out + (k - begin)) ;
+        }
+        k = block_end ;
+    }
+}
+
+void SketchTable::prepare_range(uint64_t begin, uint64_t end){
+    if(!lazy_clear || begin >= end){
+        return ;
+    }
+    for(uint64_t block = begin >> clear_block_shift; block <= (end - 1) >> clear_block_shift; block++){
+        if(block_epoch[block] != epoch){
+            clear_block(block) ;
+        }
+    }
+}
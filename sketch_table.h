@@ -0,0 +1,102 @@
+//
+// Storage for sketch tables.
+// ZeroedBuffer is a zero-initialised, cache-line-aligned allocation. Large buffers come from anonymous
+// mappings which the kernel zeroes lazily on first touch, so constructing a multi-GB sketch does not touch
+// every page up front, and resetting one can hand the pages back to the OS instead of writing zeros.
+// SketchTable lays a num_rows x num_cols table of int64_t counters out row-major in one ZeroedBuffer.
+// With lazy clearing enabled the table is also split into blocks of clear_block_counters counters, each tagged
+// with the epoch in which it was last cleared. clear_lazily just starts a new epoch, making every block stale,
+// and a stale block is zeroed and retagged by prepare the first time it is written, so a reset costs O(1) and the
+// zeroing is spread over the updates that follow. Callers must prepare every counter (or range) before writing it
+// through data() or operator[], and read through read or read_range, which see stale blocks as zero without
+// clearing them, so that readers never write and concurrent queries stay safe.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_TABLE_H
+#define LINEARSKETCHES_SKETCH_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ZeroedBuffer {
+public:
+    static const size_t mapping_threshold = size_t(1) << 20 ; // buffers at least this large are mmap'd
+    static const size_t release_threshold = size_t(1) << 25 ; // mapped buffers at least this large are reset by releasing pages
+
+    explicit ZeroedBuffer(size_t num_bytes=0) ;
+    ZeroedBuffer(const ZeroedBuffer &other) ;
+    ZeroedBuffer(ZeroedBuffer &&other) noexcept ;
+    ZeroedBuffer& operator=(const ZeroedBuffer &other) ;
+    ZeroedBuffer& operator=(ZeroedBuffer &&other) noexcept ;
+    ~ZeroedBuffer() ;
+
+    void* data() { return ptr ; }
+    const void* data() const { return ptr ; }
+    size_t size() const { return num_bytes ; }
+    bool is_mapped() const { return mapped ; }
+
+    void zero() ; // sets every byte to zero
+    bool advise_huge_pages() ; // asks for transparent huge pages, returns false if the buffer is not mapped or the kernel refuses
+    bool interleave_across_nodes() ; // spreads the pages round robin over the NUMA nodes (mapped buffers only)
+    bool bind_to_node(unsigned node) ; // places every page on one NUMA node (mapped buffers only)
+
+private:
+    void *ptr = nullptr ;
+    size_t num_bytes = 0 ;
+    bool mapped = false ;
+
+    void allocate(size_t bytes) ;
+    void release() ;
+};
+
+class SketchTable {
+public:
+    static const uint64_t clear_block_shift = 6 ;
+    static const uint64_t clear_block_counters = uint64_t(1) << clear_block_shift ; // 512 bytes
+
+    SketchTable(uint64_t num_rows, uint64_t num_cols):
+        buffer(num_rows * num_cols * sizeof(int64_t)), num_rows(num_rows), num_cols(num_cols) {}
+
+    // table[i][j] is the counter in row i and column j.
+    int64_t* operator[](uint64_t row) { return data() + row * num_cols ; }
+    const int64_t* operator[](uint64_t row) const { return data() + row * num_cols ; }
+
+    int64_t* data() { return static_cast<int64_t*>(buffer.data()) ; }
+    const int64_t* data() const { return static_cast<const int64_t*>(buffer.data()) ; }
+    uint64_t size() const { return num_rows * num_cols ; }
+    uint64_t get_num_rows() const { return num_rows ; }
+    uint64_t get_num_cols() const { return num_cols ; }
+    size_t get_memory_bytes() const { return buffer.size() ; }
+
+    void zero() ;
+
+    // Lazy clearing, see above.
+    void enable_lazy_clear() ;
+    bool is_lazy_clear() const { return lazy_clear ; }
+    void clear_lazily() ; // O(1) zero() when lazy clearing is enabled, zero() otherwise
+    void prepare(uint64_t index){
+        if(lazy_clear && block_epoch[index >> clear_block_shift] != epoch){
+            clear_block(index >> clear_block_shift) ;
+        }
+    }
+    void prepare_range(uint64_t begin, uint64_t end) ; // prepares counters [begin, end)
+    void prepare_all() { prepare_range(0, size()) ; }
+    bool is_stale(uint64_t block) const { return lazy_clear && block_epoch[block] != epoch ; }
+    int64_t read(uint64_t index) const { return is_stale(index >> clear_block_shift) ? 0 : data()[index] ; }
+    void read_range(uint64_t begin, uint64_t end, int64_t *out) const ; // copies counters [begin, end) to out
+    bool advise_huge_pages() { return buffer.advise_huge_pages() ; }
+    bool interleave_across_nodes() { return buffer.interleave_across_nodes() ; }
+    bool bind_to_node(unsigned node) { return buffer.bind_to_node(node) ; }
+
+private:
+    ZeroedBuffer buffer ;
+    uint64_t num_rows, num_cols ;
+    bool lazy_clear = false ;
+    uint32_t epoch = 0 ;
+    std::vector<uint32_t> block_epoch ; // epoch each block was last cleared in, when lazy_clear
+
+    void clear_block(uint64_t block) ;
+};
+
+#endif //LINEARSKETCHES_SKETCH_TABLE_H
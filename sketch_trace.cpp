@@ -0,0 +1,258 @@
+//
+// Binary stream traces and their replay into sketches.
+//
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "blocked_count_min_sketch.h"
+#include "count_min_sketch.h"
+#include "sketch_trace.h"
+
+namespace {
+    const char trace_magic[4] = {'L', 'S', 'T', 'R'} ;
+    const uint32_t trace_format_version = 1 ;
+    const size_t trace_header_bytes = 32 ;
+
+    typedef std::chrono::steady_clock Clock ;
+
+    struct TraceHeader {
+        char magic[4] ;
+        uint32_t version ;
+        uint32_t flags ;
+        uint32_t record_bytes ;
+        uint64_t num_records ;
+        uint64_t reserved ;
+    };
+    static_assert(sizeof(TraceHeader) == trace_header_bytes, "trace header must be packed") ;
+
+    struct ReplayProgress {
+        int64_t total_weight = 0 ;
+        double max_lag = 0.0 ;
+    };
+
+    template <class Sketch>
+    void replay_records(const MappedTrace &trace, Sketch &sketch, const ReplayOptions &options,
+                        uint64_t first, uint64_t last, uint64_t stride_batches, uint64_t first_batch,
+                        Clock::time_point start, ReplayProgress &progress){
+        /*
+         * Replays batches first_batch, first_batch + stride_batches, ... of the records in [first, last).
+         * Records are gathered into item and weight arrays so each batch is one update_batch call.
+         * Windows behind a thread are only released when it is the sole reader of its range.
+         */
+        const size_t batch = std::max<size_t>(options.batch, 1) ;
+        const uint64_t window = std::max<uint64_t>(options.window_bytes / (trace.has_timestamps() ? 24 : 16), batch) ;
+        const uint64_t origin = trace.has_timestamps() && trace.get_num_records() > 0 ? trace.get_timestamp(0) : 0 ;
+        std::vector<uint64_t> items(batch) ;
+        std::vector<int64_t> weights(batch) ;
+        uint64_t window_end = first + window ;
+        trace.will_need(first, 2 * window) ;
+        for(uint64_t b = first_batch; first + b * batch < last; b += stride_batches){
+            uint64_t begin = first + b * batch ;
+            uint64_t len = std::min<uint64_t>(batch, last - begin) ;
+            while(begin >= window_end){
+                // Entering the next window: release the one just finished and read the one after ahead.
+                if(stride_batches == 1){
+                    trace.done_with(window_end - window, window) ;
+                }
+                window_end += window ;
+                trace.will_need(window_end, window) ;
+            }
+            if(options.paced){
+                double due = double(trace.get_timestamp(begin) - origin) * 1e-9 / options.speed ;
+                Clock::time_point due_time = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(due)) ;
+                Clock::time_point now = Clock::now() ;
+                if(now < due_time){
+                    std::this_thread::sleep_until(due_time) ;
+                } else {
+                    progress.max_lag = std::max(progress.max_lag, std::chrono::duration<double>(now - due_time).count()) ;
+                }
+            }
+            if(batch == 1){
+                sketch.update(trace.get_item(begin), trace.get_weight(begin)) ;
+                progress.total_weight += trace.get_weight(begin) ;
+                continue ;
+            }
+            for(uint64_t k=0; k < len; k++){
+                items[k] = trace.get_item(begin + k) ;
+                weights[k] = trace.get_weight(begin + k) ;
+                progress.total_weight += weights[k] ;
+            }
+            sketch.update_batch(items.data(), weights.data(), len) ;
+        }
+    }
+}
+
+TraceWriter::TraceWriter(const std::string &path, bool with_timestamps) :
+    out(path, std::ios::binary | std::ios::trunc), with_timestamps(with_timestamps){
+    if(!out){
+        throw std::runtime_error( "Cannot create trace " + path );
+    }
+    TraceHeader header = {} ;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header)) ; // filled in by close
+}
+
+TraceWriter::~TraceWriter(){
+    try {
+        close() ;
+    } catch(const std::exception&){
+    }
+}
+
+void TraceWriter::append(uint64_t item, int64_t weight, uint64_t timestamp_ns){
+    out.write(reinterpret_cast<const char*>(&item), sizeof(item)) ;
+    out.write(reinterpret_cast<const char*>(&weight), sizeof(weight)) ;
+    if(with_timestamps){
+        out.write(reinterpret_cast<const char*>(&timestamp_ns), sizeof(timestamp_ns)) ;
+    }
+    num_records++ ;
+}
+
+void TraceWriter::close(){
+    if(!out.is_open()){
+        return ;
+    }
+    TraceHeader header = {} ;
+    std::memcpy(header.magic, trace_magic, sizeof(trace_magic)) ;
+    header.version = trace_format_version ;
+    header.flags = with_timestamps ? trace_has_timestamps : 0 ;
+    header.record_bytes = with_timestamps ? 24 : 16 ;
+    header.num_records = num_records ;
+    out.seekp(0) ;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header)) ;
+    out.close() ;
+    if(!out){
+        throw std::runtime_error( "Failed to write trace." );
+    }
+}
+
+MappedTrace::MappedTrace(const std::string &path){
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC) ;
+    struct stat st ;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        if(fd >= 0){
+            ::close(fd) ;
+        }
+        throw std::runtime_error( "Cannot open trace " + path );
+    }
+    length = size_t(st.st_size) ;
+    TraceHeader header = {} ;
+    if(length < sizeof(header) || pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))
+       || std::memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0 || header.version != trace_format_version
+       || header.record_bytes != ((header.flags & trace_has_timestamps) ? 24u : 16u)
+       || header.num_records > (length - sizeof(header)) / header.record_bytes){
+        ::close(fd) ;
+        throw std::invalid_argument( "Not a complete trace: " + path );
+    }
+    flags = header.flags ;
+    record_bytes = header.record_bytes ;
+    num_records = header.num_records ;
+    void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) ;
+    if(p == MAP_FAILED){
+        ::close(fd) ;
+        throw std::runtime_error( "Cannot map trace " + path );
+    }
+    base = static_cast<const uint8_t*>(p) ;
+    madvise(const_cast<uint8_t*>(base), length, MADV_SEQUENTIAL) ;
+}
+
+MappedTrace::~MappedTrace(){
+    munmap(const_cast<uint8_t*>(base), length) ;
+    ::close(fd) ;
+}
+
+uint64_t MappedTrace::field(uint64_t record, size_t k) const {
+    uint64_t value ;
+    std::memcpy(&value, base + trace_header_bytes + record * record_bytes + k * sizeof(uint64_t), sizeof(value)) ;
+    return value ;
+}
+
+void MappedTrace::advise(uint64_t first_record, uint64_t count, int advice, bool round_outward) const {
+    /*
+     * Readahead may round out to whole pages; releasing rounds in so a page still partly needed is kept.
+     */
+    if(first_record >= num_records || count == 0){
+        return ;
+    }
+    count = std::min(count, num_records - first_record) ;
+    const size_t page = size_t(sysconf(_SC_PAGESIZE)) ;
+    size_t begin = trace_header_bytes + first_record * record_bytes ;
+    size_t end = begin + count * record_bytes ;
+    begin = round_outward ? begin / page * page : (begin + page - 1) / page * page ;
+    end = round_outward ? std::min(length, (end + page - 1) / page * page) : end / page * page ;
+    if(begin < end){
+        madvise(const_cast<uint8_t*>(base) + begin, end - begin, advice) ;
+    }
+}
+
+void MappedTrace::will_need(uint64_t first_record, uint64_t count) const {
+    advise(first_record, count, MADV_WILLNEED, true) ;
+}
+
+void MappedTrace::done_with(uint64_t first_record, uint64_t count) const {
+    advise(first_record, count, MADV_DONTNEED, false) ;
+}
+
+template <class Sketch>
+ReplayStats replay_trace(const MappedTrace &trace, Sketch &sketch, const ReplayOptions &options){
+    /*
+     * Flat-out replay gives each thread a contiguous range so it streams through its part of the file.
+     * Paced replay deals batches out round-robin instead so every thread stays busy at every point in time.
+     * Each thread updates its own empty sketch with the same config, merged into sketch once all threads finish.
+     */
+    if(options.speed <= 0.0 || (options.paced && !trace.has_timestamps())){
+        throw std::invalid_argument( "Paced replay needs a trace with timestamps and a positive speed." );
+    }
+    ReplayStats stats ;
+    const uint64_t n = trace.get_num_records() ;
+    const unsigned threads = std::max(1u, options.threads) ;
+    Clock::time_point start = Clock::now() ;
+    std::vector<ReplayProgress> progress(threads) ;
+    if(threads == 1){
+        replay_records(trace, sketch, options, 0, n, 1, 0, start, progress[0]) ;
+    } else {
+        std::vector<std::unique_ptr<Sketch> > shards ;
+        std::vector<std::thread> workers ;
+        for(unsigned t=0; t < threads; t++){
+            shards.push_back(sketch.make_empty()) ;
+        }
+        for(unsigned t=0; t < threads; t++){
+            workers.emplace_back([&, t](){
+                if(options.paced){
+                    replay_records(trace, *shards[t], options, 0, n, threads, t, start, progress[t]) ;
+                } else {
+                    replay_records(trace, *shards[t], options, n * t / threads, n * (t + 1) / threads, 1, 0, start, progress[t]) ;
+                }
+            }) ;
+        }
+        for(std::thread &worker : workers){
+            worker.join() ;
+        }
+        for(unsigned t=0; t < threads; t++){
+            sketch.merge(*shards[t]) ;
+        }
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count() ;
+    stats.records = n ;
+    for(const ReplayProgress &p : progress){
+        stats.total_weight += p.total_weight ;
+        stats.max_lag_seconds = std::max(stats.max_lag_seconds, p.max_lag) ;
+    }
+    stats.records_per_second = (stats.seconds > 0.0) ? double(n) / stats.seconds : 0.0 ;
+    return stats ;
+}
+
+template ReplayStats replay_trace(const MappedTrace&, CountMinSketch&, const ReplayOptions&) ;
+template ReplayStats replay_trace(const MappedTrace&, MultiplyShiftCountMinSketch&, const ReplayOptions&) ;
+template ReplayStats replay_trace(const MappedTrace&, TabulationCountMinSketch&, const ReplayOptions&) ;
+template ReplayStats replay_trace(const MappedTrace&, DoubleHashCountMinSketch&, const ReplayOptions&) ;
+template ReplayStats replay_trace(const MappedTrace&, BlockedCountMinSketch8&, const ReplayOptions&) ;
+template ReplayStats replay_trace(const MappedTrace&, BlockedCountMinSketch16&, const ReplayOptions&) ;
+template ReplayStats replay_trace(const MappedTrace&, BlockedCountMinSketch32&, const ReplayOptions&) ;
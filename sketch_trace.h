@@ -0,0 +1,84 @@
+//
+// Binary stream traces and their replay into sketches.
+// A trace file is a 32 byte header followed by packed little-endian records:
+//     header:  magic "LSTR", u32 version, u32 flags, u32 record_bytes, u64 num_records, u64 reserved
+//     record:  u64 item, i64 weight[, u64 timestamp in nanoseconds]   (timestamps present when flags & 1)
+// TraceWriter appends records through a buffered stream. MappedTrace maps a trace read-only and replay_trace
+// walks the mapping sequentially in windows, asking the kernel to read the next window ahead and dropping
+// windows already consumed, so traces larger than RAM stream through at disk speed.
+// Replay can run flat out or paced to the recorded timestamps (scaled by a speed factor), on one thread or
+// partitioned across several, each feeding a private copy of the sketch that is merged in at the end.
+//
+
+#ifndef LINEARSKETCHES_SKETCH_TRACE_H
+#define LINEARSKETCHES_SKETCH_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+const uint32_t trace_has_timestamps = 1 ;
+
+class TraceWriter {
+public:
+    TraceWriter(const std::string &path, bool with_timestamps) ;
+    ~TraceWriter() ; // calls close, ignoring errors
+    void append(uint64_t item, int64_t weight, uint64_t timestamp_ns=0) ;
+    void close() ; // writes the record count into the header, throws on I/O failure
+    uint64_t get_num_records() const { return num_records ; }
+
+private:
+    std::ofstream out ;
+    bool with_timestamps ;
+    uint64_t num_records = 0 ;
+};
+
+class MappedTrace {
+public:
+    explicit MappedTrace(const std::string &path) ; // throws if the file is not a complete trace
+    ~MappedTrace() ;
+    MappedTrace(const MappedTrace&) = delete ;
+    MappedTrace& operator=(const MappedTrace&) = delete ;
+
+    uint64_t get_num_records() const { return num_records ; }
+    bool has_timestamps() const { return (flags & trace_has_timestamps) != 0 ; }
+    uint64_t get_item(uint64_t record) const { return field(record, 0) ; }
+    int64_t get_weight(uint64_t record) const { return int64_t(field(record, 1)) ; }
+    uint64_t get_timestamp(uint64_t record) const { return has_timestamps() ? field(record, 2) : 0 ; }
+
+    void will_need(uint64_t first_record, uint64_t count) const ; // readahead hint
+    void done_with(uint64_t first_record, uint64_t count) const ; // lets the kernel drop the pages from the mapping
+
+private:
+    int fd = -1 ;
+    const uint8_t *base = nullptr ;
+    size_t length = 0 ;
+    uint32_t flags = 0 ;
+    uint32_t record_bytes = 0 ;
+    uint64_t num_records = 0 ;
+
+    uint64_t field(uint64_t record, size_t k) const ;
+    void advise(uint64_t first_record, uint64_t count, int advice, bool round_outward) const ;
+};
+
+struct ReplayOptions {
+    size_t batch = 4096 ; // records per update_batch call; 1 replays through update
+    unsigned threads = 1 ;
+    bool paced = false ; // follow the recorded timestamps instead of replaying flat out
+    double speed = 1.0 ; // pacing speed-up factor
+    size_t window_bytes = size_t(64) << 20 ; // granularity of readahead and release
+};
+
+struct ReplayStats {
+    uint64_t records = 0 ;
+    int64_t total_weight = 0 ;
+    double seconds = 0.0 ;
+    double records_per_second = 0.0 ;
+    double max_lag_seconds = 0.0 ; // paced replay only: furthest any batch fell behind its schedule
+};
+
+template <class Sketch>
+ReplayStats replay_trace(const MappedTrace &trace, Sketch &sketch, const ReplayOptions &options) ;
+
+#endif //LINEARSKETCHES_SKETCH_TRACE_H
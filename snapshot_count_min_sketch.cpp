@@ -0,0 +1,221 @@
+//
+// CountMin sketch with consistent point-in-time snapshots.
+//
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "snapshot_count_min_sketch.h"
+#include "sketch_io.h"
+#include "table_codec.h"
+
+const uint64_t CounterPage::page_shift ;
+const uint64_t CounterPage::num_counters ;
+
+namespace {
+    const size_t batch_chunk = 64 ;
+
+    std::shared_ptr<CounterPage> shared_zero_page(){
+        /*
+         * Every page of a new sketch points here until it is first written, so construction allocates nothing
+         * per page. The extra reference held by this function means the page is never treated as private.
+         */
+        static const std::shared_ptr<CounterPage> zero_page = std::make_shared<CounterPage>() ;
+        return zero_page ;
+    }
+}
+
+template <class HashFamily>
+CountMinSnapshot<HashFamily>::CountMinSnapshot(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed, float epsilon,
+                                               std::shared_ptr<const HashFamily> hashes,
+                                               std::vector<std::shared_ptr<const CounterPage> > pages,
+                                               int64_t total_weight, uint64_t epoch):
+    num_hashes(num_hashes), num_buckets(num_buckets), seed(seed), epsilon(epsilon), hashes(std::move(hashes)),
+    pages(std::move(pages)), total_weight(total_weight), epoch(epoch){
+}
+
+template <class HashFamily>
+std::vector<uint64_t> CountMinSnapshot<HashFamily>::get_config() const {
+    return {num_hashes, num_buckets, seed, HashFamily::family_id()} ;
+}
+
+template <class HashFamily>
+std::vector<std::vector<int64_t>> CountMinSnapshot<HashFamily>::get_table() const {
+    std::vector<std::vector<int64_t>> table(num_hashes, std::vector<int64_t>(num_buckets)) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        for(uint64_t j=0; j < num_buckets; j++){
+            table[i][j] = counter(i, j) ;
+        }
+    }
+    return table ;
+}
+
+template <class HashFamily>
+int64_t CountMinSnapshot<HashFamily>::get_estimate(uint64_t item) const {
+    int64_t estimate = std::numeric_limits<int64_t>::max() ;
+    RowBuckets buckets(num_hashes) ;
+    hashes->buckets(item, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        estimate = std::min(estimate, counter(i, buckets[i])) ;
+    }
+    return estimate ;
+}
+
+template <class HashFamily>
+void CountMinSnapshot<HashFamily>::get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const {
+    std::vector<uint64_t> buckets(num_hashes * batch_chunk) ;
+    for(size_t start=0; start < n; start += batch_chunk){
+        size_t len = std::min(batch_chunk, n - start) ;
+        hashes->buckets(items + start, len, buckets.data()) ;
+        for(size_t k=0; k < len; k++){
+            estimates[start + k] = std::numeric_limits<int64_t>::max() ;
+        }
+        for(uint64_t i=0; i < num_hashes; i++){
+            const uint64_t *row_buckets = buckets.data() + i * len ;
+            for(size_t k=0; k < len; k++){
+                estimates[start + k] = std::min(estimates[start + k], counter(i, row_buckets[k])) ;
+            }
+        }
+    }
+}
+
+template <class HashFamily>
+int64_t CountMinSnapshot<HashFamily>::get_upper_bound(uint64_t item) const {
+    return get_estimate(item) ;
+}
+
+template <class HashFamily>
+int64_t CountMinSnapshot<HashFamily>::get_lower_bound(uint64_t item) const {
+    /*
+     * Uses the total weight captured with the snapshot so the bound is consistent with its table.
+     */
+    return get_estimate(item) - epsilon*total_weight ;
+}
+
+template <class HashFamily>
+void CountMinSnapshot<HashFamily>::serialize(std::ostream &os) const {
+    /*
+     * Pages are a whole number of codec blocks so they can be encoded one at a time.
+     */
+    write_sketch_header(os, get_config(), total_weight) ;
+    std::vector<uint8_t> encoded ;
+    uint64_t remaining = num_hashes * num_buckets ;
+    for(const std::shared_ptr<const CounterPage> &page : pages){
+        uint64_t len = std::min(remaining, CounterPage::num_counters) ;
+        encode_counters(page->counters, len, encoded) ;
+        remaining -= len ;
+    }
+    write_encoded_counters(os, encoded) ;
+}
+
+template <class HashFamily>
+BasicSnapshotCountMinSketch<HashFamily>::BasicSnapshotCountMinSketch(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed):
+    num_hashes(num_hashes), num_buckets(num_buckets), seed(seed),
+    hashes(std::make_shared<const HashFamily>(num_hashes, num_buckets, seed)),
+    snapshot_requested(false){
+    /*
+     * Same parameters and hashing as BasicCountMinSketch<HashFamily> with the same config, so snapshots
+     * can be loaded as, and merged with, ordinary sketches.
+     */
+    uint64_t num_pages = (num_hashes * num_buckets + CounterPage::num_counters - 1) / CounterPage::num_counters ;
+    pages.assign(num_pages, shared_zero_page()) ;
+    page_epoch.assign(num_pages, 0) ;
+    epsilon = exp(1.0) / float(num_buckets) ;
+    delta = 1.0 / exp(float(num_hashes)) ;
+    confidence = 1.0 - delta ;
+    snapshot() ;
+}
+
+template <class HashFamily>
+std::vector<uint64_t> BasicSnapshotCountMinSketch<HashFamily>::get_config() const {
+    return {num_hashes, num_buckets, seed, HashFamily::family_id()} ;
+}
+
+template <class HashFamily>
+void BasicSnapshotCountMinSketch<HashFamily>::own_page(uint64_t page){
+    /*
+     * Copy-on-write: a page still referenced by a snapshot (or the shared zero page) is copied before the
+     * writer modifies it. A page nobody else holds is simply claimed for the current epoch.
+     */
+    if(pages[page].use_count() > 1){
+        std::shared_ptr<CounterPage> copy = std::make_shared<CounterPage>() ;
+        std::memcpy(copy->counters, pages[page]->counters, sizeof(copy->counters)) ;
+        pages[page] = std::move(copy) ;
+    } else {
+        // Pairs with the release in the last reader's reference drop so its reads finish before our writes.
+        std::atomic_thread_fence(std::memory_order_acquire) ;
+    }
+    page_epoch[page] = epoch ;
+}
+
+template <class HashFamily>
+void BasicSnapshotCountMinSketch<HashFamily>::update(uint64_t item, int64_t weight){
+    publish_if_requested() ;
+    RowBuckets buckets(num_hashes) ;
+    hashes->buckets(item, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        add(i, buckets[i], weight) ;
+    }
+    total_weight += weight ;
+}
+
+template <class HashFamily>
+void BasicSnapshotCountMinSketch<HashFamily>::update_batch(const uint64_t *items, const int64_t *weights, size_t n){
+    publish_if_requested() ;
+    std::vector<uint64_t> buckets(num_hashes * batch_chunk) ;
+    for(size_t start=0; start < n; start += batch_chunk){
+        size_t len = std::min(batch_chunk, n - start) ;
+        hashes->buckets(items + start, len, buckets.data()) ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            const uint64_t *row_buckets = buckets.data() + i * len ;
+            for(size_t k=0; k < len; k++){
+                add(i, row_buckets[k], (weights == nullptr) ? 1 : weights[start + k]) ;
+            }
+        }
+        for(size_t k=0; k < len; k++){
+            total_weight += (weights == nullptr) ? 1 : weights[start + k] ;
+        }
+    }
+}
+
+template <class HashFamily>
+int64_t BasicSnapshotCountMinSketch<HashFamily>::get_estimate(uint64_t item) const {
+    int64_t estimate = std::numeric_limits<int64_t>::max() ;
+    RowBuckets buckets(num_hashes) ;
+    hashes->buckets(item, buckets.get()) ;
+    for(uint64_t i=0; i < num_hashes; i++){
+        uint64_t idx = i * num_buckets + buckets[i] ;
+        estimate = std::min(estimate, pages[idx >> CounterPage::page_shift]->counters[idx & (CounterPage::num_counters - 1)]) ;
+    }
+    return estimate ;
+}
+
+template <class HashFamily>
+std::shared_ptr<const CountMinSnapshot<HashFamily> > BasicSnapshotCountMinSketch<HashFamily>::snapshot(){
+    /*
+     * Shares every page with the new snapshot and starts a new epoch so the next write to any page goes
+     * through own_page. Costs one pointer copy per 4KB of table.
+     */
+    std::vector<std::shared_ptr<const CounterPage> > shared(pages.begin(), pages.end()) ;
+    std::shared_ptr<const snapshot_type> s = std::make_shared<const snapshot_type>(
+            num_hashes, num_buckets, seed, epsilon, hashes, std::move(shared), total_weight, epoch) ;
+    epoch++ ;
+    snapshot_requested.store(false, std::memory_order_relaxed) ;
+    std::atomic_store(&published, s) ;
+    return s ;
+}
+
+template <class HashFamily>
+std::shared_ptr<const CountMinSnapshot<HashFamily> > BasicSnapshotCountMinSketch<HashFamily>::latest_snapshot() const {
+    return std::atomic_load(&published) ;
+}
+
+template class CountMinSnapshot<MultiplyShiftHash> ;
+template class CountMinSnapshot<MersennePrimeHash> ;
+template class CountMinSnapshot<TabulationHash> ;
+template class CountMinSnapshot<DoubleHash> ;
+template class BasicSnapshotCountMinSketch<MultiplyShiftHash> ;
+template class BasicSnapshotCountMinSketch<MersennePrimeHash> ;
+template class BasicSnapshotCountMinSketch<TabulationHash> ;
+template class BasicSnapshotCountMinSketch<DoubleHash> ;
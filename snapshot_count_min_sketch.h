@@ -0,0 +1,129 @@
+//
+// CountMin sketch with consistent point-in-time snapshots for serving queries during ingest.
+// The table is split into 4KB pages that are shared copy-on-write between the live sketch and its snapshots:
+// taking a snapshot only copies the page pointers and bumps the epoch, and the writer copies a page the
+// first time it writes to it in a new epoch if a snapshot still holds it. Snapshots are immutable so any
+// number of reader threads can query them, and they are reclaimed by reference counting once the last
+// reader lets go.
+//
+// There is a single writer thread which calls update, update_batch and snapshot. Other threads read through
+// latest_snapshot and can ask the writer for a fresher one with request_snapshot; neither ever blocks the writer.
+//
+
+#ifndef LINEARSKETCHES_SNAPSHOT_COUNT_MIN_SKETCH_H
+#define LINEARSKETCHES_SNAPSHOT_COUNT_MIN_SKETCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "hash_families.h"
+
+struct CounterPage {
+    static const uint64_t page_shift = 9 ;
+    static const uint64_t num_counters = uint64_t(1) << page_shift ; // 4KB of int64_t counters
+    int64_t counters[num_counters] ;
+};
+
+template <class HashFamily>
+class CountMinSnapshot {
+public:
+    CountMinSnapshot(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed, float epsilon,
+                     std::shared_ptr<const HashFamily> hashes, std::vector<std::shared_ptr<const CounterPage> > pages,
+                     int64_t total_weight, uint64_t epoch) ;
+
+    // Getters
+    uint64_t get_num_hashes() const { return num_hashes ; }
+    uint64_t get_num_buckets() const { return num_buckets ; }
+    uint64_t get_seed() const { return seed ; }
+    uint64_t get_epoch() const { return epoch ; }
+    int64_t get_total_weight() const { return total_weight ; }
+    float get_epsilon() const { return epsilon ; }
+    std::vector<uint64_t> get_config() const ;
+    std::vector<std::vector<int64_t>> get_table() const ;
+    int64_t get_estimate(uint64_t item) const ;
+    void get_estimates(const uint64_t *items, size_t n, int64_t *estimates) const ;
+    int64_t get_upper_bound(uint64_t item) const ;
+    int64_t get_lower_bound(uint64_t item) const ;
+
+    // Writes the snapshot in the same format as BasicCountMinSketch::serialize so it loads with deserialize.
+    void serialize(std::ostream &os) const ;
+
+private:
+    uint64_t num_hashes, num_buckets, seed ;
+    float epsilon ;
+    std::shared_ptr<const HashFamily> hashes ;
+    std::vector<std::shared_ptr<const CounterPage> > pages ;
+    int64_t total_weight ;
+    uint64_t epoch ;
+
+    int64_t counter(uint64_t row, uint64_t bucket) const {
+        uint64_t idx = row * num_buckets + bucket ;
+        return pages[idx >> CounterPage::page_shift]->counters[idx & (CounterPage::num_counters - 1)] ;
+    }
+};
+
+template <class HashFamily>
+class BasicSnapshotCountMinSketch {
+public:
+    typedef CountMinSnapshot<HashFamily> snapshot_type ;
+
+    BasicSnapshotCountMinSketch(uint64_t num_hashes, uint64_t num_buckets, uint64_t seed) ;
+
+    // Writer thread only.
+    void update(uint64_t item, int64_t weight=1) ;
+    void update_batch(const uint64_t *items, const int64_t *weights, size_t n) ; // weights may be nullptr for unit weights
+    int64_t get_estimate(uint64_t item) const ; // reads the live table
+    std::shared_ptr<const snapshot_type> snapshot() ; // takes and publishes a snapshot of the current state
+
+    // Any thread.
+    std::shared_ptr<const snapshot_type> latest_snapshot() const ;
+    void request_snapshot() { snapshot_requested.store(true, std::memory_order_relaxed) ; } // published on the writer's next update
+
+    // Getters
+    uint64_t get_num_hashes() const { return num_hashes ; }
+    uint64_t get_num_buckets() const { return num_buckets ; }
+    uint64_t get_seed() const { return seed ; }
+    uint64_t get_epoch() const { return epoch ; }
+    int64_t get_total_weight() const { return total_weight ; }
+    float get_epsilon() const { return epsilon ; }
+    float get_delta() const { return delta ; }
+    float get_confidence() const { return confidence ; }
+    std::vector<uint64_t> get_config() const ;
+    uint64_t get_num_pages() const { return pages.size() ; }
+
+private:
+    uint64_t num_hashes, num_buckets, seed ;
+    std::shared_ptr<const HashFamily> hashes ;
+    std::vector<std::shared_ptr<CounterPage> > pages ;
+    std::vector<uint64_t> page_epoch ; // epoch in which the writer last made each page private
+    uint64_t epoch = 1 ;
+    int64_t total_weight = 0 ;
+    std::shared_ptr<const snapshot_type> published ; // only accessed through std::atomic_load / std::atomic_store
+    std::atomic<bool> snapshot_requested ;
+
+    // Parameters
+    float epsilon ; // Error parameter
+    float delta ; // failure probability parameter
+    float confidence ;
+
+    void own_page(uint64_t page) ;
+    void add(uint64_t row, uint64_t bucket, int64_t weight){
+        uint64_t idx = row * num_buckets + bucket ;
+        uint64_t page = idx >> CounterPage::page_shift ;
+        if(page_epoch[page] != epoch){
+            own_page(page) ;
+        }
+        pages[page]->counters[idx & (CounterPage::num_counters - 1)] += weight ;
+    }
+    void publish_if_requested(){
+        if(snapshot_requested.load(std::memory_order_relaxed)){
+            snapshot() ;
+        }
+    }
+};
+
+typedef BasicSnapshotCountMinSketch<MersennePrimeHash> SnapshotCountMinSketch ;
+
+#endif //LINEARSKETCHES_SNAPSHOT_COUNT_MIN_SKETCH_H
@@ -0,0 +1,150 @@
+//
+// Synthetic workload generators for tests and benchmarks.
+//
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "hash_families.h"
+#include "stream_generators.h"
+
+UniformGenerator::UniformGenerator(uint64_t universe, uint64_t seed) : universe(universe), rng(seed){
+    if(universe == 0){
+        throw std::invalid_argument( "Universe must be nonempty." );
+    }
+}
+
+uint64_t UniformGenerator::next(){
+    return reduce_to_range(rng.next(), universe) ;
+}
+
+void UniformGenerator::fill(uint64_t *items, size_t n){
+    for(size_t k=0; k < n; k++){
+        items[k] = reduce_to_range(rng.next(), universe) ;
+    }
+}
+
+ZipfGenerator::ZipfGenerator(uint64_t universe, double skew, uint64_t seed) :
+    universe(universe), normalizer(0.0), skew(skew), rng(seed), accept(universe), alias(universe){
+    /*
+     * Vose's alias method: every column holds at most two items, so a draw is one column choice and one coin.
+     * Columns are scaled so that an average column has weight 1.
+     */
+    if(universe == 0 || universe > (uint64_t(1) << 32) || skew < 0.0){
+        throw std::invalid_argument( "Zipf needs 0 < universe <= 2^32 and a nonnegative skew." );
+    }
+    std::vector<double> scaled(universe) ;
+    for(uint64_t k=0; k < universe; k++){
+        scaled[k] = std::pow(double(k + 1), -skew) ;
+        normalizer += scaled[k] ;
+    }
+    std::vector<uint32_t> small, large ;
+    for(uint64_t k=0; k < universe; k++){
+        scaled[k] *= double(universe) / normalizer ;
+        (scaled[k] < 1.0 ? small : large).push_back(uint32_t(k)) ;
+    }
+    while(!small.empty() && !large.empty()){
+        uint32_t s = small.back() ;
+        uint32_t l = large.back() ;
+        small.pop_back() ;
+        accept[s] = uint32_t(std::min(scaled[s] * 4294967296.0, 4294967295.0)) ;
+        alias[s] = l ;
+        scaled[l] -= 1.0 - scaled[s] ;
+        if(scaled[l] < 1.0){
+            large.pop_back() ;
+            small.push_back(l) ;
+        }
+    }
+    // Whatever is left has weight 1 up to rounding and always keeps its own item.
+    for(uint32_t k : small){
+        accept[k] = UINT32_MAX ;
+        alias[k] = k ;
+    }
+    for(uint32_t k : large){
+        accept[k] = UINT32_MAX ;
+        alias[k] = k ;
+    }
+}
+
+uint64_t ZipfGenerator::next(){
+    /*
+     * The high 32 bits pick the column and the low 32 bits are the coin.
+     */
+    uint64_t r = rng.next() ;
+    uint64_t column = ((r >> 32) * universe) >> 32 ;
+    return (uint32_t(r) < accept[column]) ? column : alias[column] ;
+}
+
+void ZipfGenerator::fill(uint64_t *items, size_t n){
+    for(size_t k=0; k < n; k++){
+        items[k] = next() ;
+    }
+}
+
+double ZipfGenerator::probability(uint64_t item) const {
+    return (item < universe) ? std::pow(double(item + 1), -skew) / normalizer : 0.0 ;
+}
+
+ParetoWeightGenerator::ParetoWeightGenerator(double alpha, int64_t min_weight, int64_t max_weight, uint64_t seed) :
+    neg_inv_alpha(-1.0 / alpha), min_weight(min_weight), max_weight(max_weight), rng(seed){
+    if(alpha <= 0.0 || min_weight < 1 || max_weight < min_weight){
+        throw std::invalid_argument( "Pareto weights need alpha > 0 and 1 <= min_weight <= max_weight." );
+    }
+}
+
+int64_t ParetoWeightGenerator::next(){
+    double u = 1.0 - rng.next_unit() ; // in (0, 1]
+    double w = double(min_weight) * std::pow(u, neg_inv_alpha) ;
+    return (w >= double(max_weight)) ? max_weight : int64_t(w) ;
+}
+
+void ParetoWeightGenerator::fill(int64_t *weights, size_t n){
+    for(size_t k=0; k < n; k++){
+        weights[k] = next() ;
+    }
+}
+
+template <class HashFamily>
+CollisionGenerator::CollisionGenerator(const HashFamily &hashes, uint64_t num_hashes, uint64_t target,
+                                       size_t num_colliders, uint64_t min_rows, uint64_t seed){
+    /*
+     * A random item shares a given row's bucket with probability 1/num_buckets, so the search costs about
+     * num_colliders * num_buckets candidates for min_rows = 1 and grows by a factor num_buckets per extra row.
+     */
+    if(num_colliders == 0 || min_rows == 0 || min_rows > num_hashes){
+        throw std::invalid_argument( "Need at least one collider and 1 <= min_rows <= num_hashes." );
+    }
+    std::vector<uint64_t> target_buckets(num_hashes), candidate_buckets(num_hashes) ;
+    hashes.buckets(target, target_buckets.data()) ;
+    StreamRng rng(seed) ;
+    while(colliders.size() < num_colliders){
+        uint64_t candidate = rng.next() >> 1 ;
+        if(candidate == target){
+            continue ;
+        }
+        hashes.buckets(candidate, candidate_buckets.data()) ;
+        uint64_t shared = 0 ;
+        for(uint64_t i=0; i < num_hashes; i++){
+            shared += (candidate_buckets[i] == target_buckets[i]) ;
+        }
+        if(shared >= min_rows){
+            colliders.push_back(candidate) ;
+        }
+    }
+}
+
+uint64_t CollisionGenerator::next(){
+    uint64_t item = colliders[position] ;
+    position = (position + 1 == colliders.size()) ? 0 : position + 1 ;
+    return item ;
+}
+
+void CollisionGenerator::fill(uint64_t *items, size_t n){
+    for(size_t k=0; k < n; k++){
+        items[k] = next() ;
+    }
+}
+
+template CollisionGenerator::CollisionGenerator(const MultiplyShiftHash&, uint64_t, uint64_t, size_t, uint64_t, uint64_t) ;
+template CollisionGenerator::CollisionGenerator(const MersennePrimeHash&, uint64_t, uint64_t, size_t, uint64_t, uint64_t) ;
+template CollisionGenerator::CollisionGenerator(const TabulationHash&, uint64_t, uint64_t, size_t, uint64_t, uint64_t) ;
+template CollisionGenerator::CollisionGenerator(const DoubleHash&, uint64_t, uint64_t, size_t, uint64_t, uint64_t) ;
@@ -0,0 +1,93 @@
+//
+// Synthetic workload generators for tests and benchmarks.
+// Every generator is reproducible from its seed and writes straight into caller-provided buffers with fill, so
+// the cost per item is a few nanoseconds and benchmarks measure the sketch rather than the generator.
+//  * UniformGenerator: items uniform on [0, universe).
+//  * ZipfGenerator: item k in [0, universe) drawn with probability proportional to 1/(k+1)^skew, sampled in O(1)
+//    from a Walker/Vose alias table built once in O(universe) (so item 0 is the heaviest).
+//  * ParetoWeightGenerator: heavy-tailed integer weights min_weight * U^(-1/alpha), capped at max_weight.
+//  * CollisionGenerator: an adversarial stream of items that share a bucket with a target item in at least
+//    min_rows rows of a given hash family, which inflates the target's estimate as much as possible.
+//
+
+#ifndef LINEARSKETCHES_STREAM_GENERATORS_H
+#define LINEARSKETCHES_STREAM_GENERATORS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class StreamRng {
+    /*
+     * SplitMix64: one add and three multiply-xorshift steps per 64-bit output, which is plenty for workloads.
+     */
+public:
+    explicit StreamRng(uint64_t seed) : state(seed) {}
+    uint64_t next(){
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL) ;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL ;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL ;
+        return z ^ (z >> 31) ;
+    }
+    double next_unit(){ return double(next() >> 11) * (1.0 / 9007199254740992.0) ; } // uniform on [0, 1)
+
+private:
+    uint64_t state ;
+};
+
+class UniformGenerator {
+public:
+    UniformGenerator(uint64_t universe, uint64_t seed) ;
+    uint64_t next() ;
+    void fill(uint64_t *items, size_t n) ;
+
+private:
+    uint64_t universe ;
+    StreamRng rng ;
+};
+
+class ZipfGenerator {
+public:
+    ZipfGenerator(uint64_t universe, double skew, uint64_t seed) ; // universe at most 2^32
+    uint64_t next() ;
+    void fill(uint64_t *items, size_t n) ;
+    double probability(uint64_t item) const ; // exact probability of item, for computing expected frequencies
+    uint64_t get_universe() const { return universe ; }
+
+private:
+    uint64_t universe ;
+    double normalizer ; // sum over k of 1/(k+1)^skew
+    double skew ;
+    StreamRng rng ;
+    std::vector<uint32_t> accept ; // column k keeps k when the low 32 bits of the draw are below accept[k]
+    std::vector<uint32_t> alias ;
+};
+
+class ParetoWeightGenerator {
+public:
+    ParetoWeightGenerator(double alpha, int64_t min_weight, int64_t max_weight, uint64_t seed) ;
+    int64_t next() ;
+    void fill(int64_t *weights, size_t n) ;
+
+private:
+    double neg_inv_alpha ;
+    int64_t min_weight, max_weight ;
+    StreamRng rng ;
+};
+
+class CollisionGenerator {
+public:
+    // Searches random candidates for num_colliders items that collide with target in at least min_rows rows.
+    template <class HashFamily>
+    CollisionGenerator(const HashFamily &hashes, uint64_t num_hashes, uint64_t target, size_t num_colliders,
+                       uint64_t min_rows, uint64_t seed) ;
+    uint64_t next() ;
+    void fill(uint64_t *items, size_t n) ; // cycles through the colliders
+    const std::vector<uint64_t>& get_colliders() const { return colliders ; }
+
+private:
+    std::vector<uint64_t> colliders ;
+    size_t position = 0 ;
+};
+
+#endif //LINEARSKETCHES_STREAM_GENERATORS_H
@@ -0,0 +1,164 @@
+//
+// Compressed encoding for tables of int64_t counters.
+//
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include "table_codec.h"
+
+namespace {
+    // Unpackers load 8 (or 16 for widths above 56) bytes at a time so every block is decoded from a buffer
+    // with at least this much readable slack after it.
+    const size_t decode_slack = 16 ;
+
+    inline uint64_t zigzag(int64_t x){
+        return (uint64_t(x) << 1) ^ uint64_t(x >> 63) ;
+    }
+
+    inline int64_t unzigzag(uint64_t u){
+        return int64_t((u >> 1) ^ (~(u & 1) + 1)) ;
+    }
+
+    inline size_t packed_bytes(size_t len, unsigned width){
+        return (len * width + 7) / 8 ;
+    }
+
+    inline uint64_t extract(const uint8_t *in, size_t bit, unsigned width){
+        /*
+         * Reads the width-bit value starting at bit offset `bit`.
+         */
+        const uint64_t mask = (width == 64) ? ~uint64_t(0) : ((uint64_t(1) << width) - 1) ;
+        if(width <= 56){
+            uint64_t w ;
+            std::memcpy(&w, in + bit / 8, sizeof(w)) ;
+            return (w >> (bit % 8)) & mask ;
+        }
+        __uint128_t w ;
+        std::memcpy(&w, in + bit / 8, sizeof(w)) ;
+        return uint64_t(w >> (bit % 8)) & mask ;
+    }
+
+    template <unsigned Width, size_t J>
+    struct UnpackGroup {
+        static void run(const uint8_t *in, int64_t *out){
+            UnpackGroup<Width, J - 1>::run(in, out) ;
+            out[J - 1] = unzigzag(extract(in, (J - 1) * Width, Width)) ;
+        }
+    };
+
+    template <unsigned Width>
+    struct UnpackGroup<Width, 0> {
+        static void run(const uint8_t*, int64_t*){}
+    };
+
+    template <unsigned Width>
+    void unpack_block(const uint8_t *in, int64_t *out){
+        /*
+         * Eight counters of Width bits occupy exactly Width bytes, so the block is decoded as 16 groups of 8
+         * whose offsets, shifts and masks are all compile-time constants.
+         */
+        for(size_t g=0; g < codec_block_counters / 8; g++){
+            UnpackGroup<Width, 8>::run(in + g * Width, out + 8 * g) ;
+        }
+    }
+
+    template <>
+    void unpack_block<0>(const uint8_t*, int64_t *out){
+        std::memset(out, 0, codec_block_counters * sizeof(int64_t)) ;
+    }
+
+    typedef void (*Unpacker)(const uint8_t*, int64_t*) ;
+
+    template <size_t... Widths>
+    std::array<Unpacker, sizeof...(Widths)> make_unpackers(std::index_sequence<Widths...>){
+        return {{&unpack_block<Widths>...}} ;
+    }
+
+    const std::array<Unpacker, 65> unpackers = make_unpackers(std::make_index_sequence<65>()) ;
+
+    void unpack_partial(const uint8_t *in, unsigned width, int64_t *out, size_t len){
+        for(size_t k=0; k < len; k++){
+            out[k] = (width == 0) ? 0 : unzigzag(extract(in, k * width, width)) ;
+        }
+    }
+
+    void encode_block(const int64_t *counters, size_t len, std::vector<uint8_t> &out){
+        uint64_t z[codec_block_counters] ;
+        uint64_t all_bits = 0 ;
+        for(size_t k=0; k < len; k++){
+            z[k] = zigzag(counters[k]) ;
+            all_bits |= z[k] ;
+        }
+        unsigned width = (all_bits == 0) ? 0 : 64 - __builtin_clzll(all_bits) ;
+        out.push_back(uint8_t(width)) ;
+        if(width == 0){
+            return ;
+        }
+        size_t start = out.size() ;
+        out.resize(start + packed_bytes(len, width)) ;
+        uint8_t *dst = out.data() + start ;
+        __uint128_t acc = 0 ;
+        unsigned acc_bits = 0 ;
+        for(size_t k=0; k < len; k++){
+            acc |= __uint128_t(z[k]) << acc_bits ;
+            acc_bits += width ;
+            if(acc_bits >= 64){
+                uint64_t word = uint64_t(acc) ;
+                std::memcpy(dst, &word, sizeof(word)) ;
+                dst += sizeof(word) ;
+                acc >>= 64 ;
+                acc_bits -= 64 ;
+            }
+        }
+        uint64_t word = uint64_t(acc) ;
+        std::memcpy(dst, &word, (acc_bits + 7) / 8) ;
+    }
+}
+
+size_t max_encoded_bytes(size_t n){
+    return (n + codec_block_counters - 1) / codec_block_counters + n * sizeof(int64_t) ;
+}
+
+void encode_counters(const int64_t *counters, size_t n, std::vector<uint8_t> &out){
+    for(size_t start=0; start < n; start += codec_block_counters){
+        encode_block(counters + start, std::min(codec_block_counters, n - start), out) ;
+    }
+}
+
+size_t decode_counters(const uint8_t *in, size_t in_bytes, int64_t *counters, size_t n){
+    /*
+     * Blocks with enough slack behind them are decoded in place; the rest (normally only the tail of the
+     * buffer) are copied into a padded scratch buffer first.
+     */
+    uint8_t scratch[codec_block_counters * sizeof(int64_t) + decode_slack] ;
+    size_t pos = 0 ;
+    for(size_t start=0; start < n; start += codec_block_counters){
+        size_t len = std::min(codec_block_counters, n - start) ;
+        if(pos >= in_bytes){
+            throw std::invalid_argument( "Truncated counter encoding." );
+        }
+        unsigned width = in[pos++] ;
+        if(width > 64){
+            throw std::invalid_argument( "Corrupt counter encoding." );
+        }
+        size_t bytes = packed_bytes(len, width) ;
+        if(in_bytes - pos < bytes){
+            throw std::invalid_argument( "Truncated counter encoding." );
+        }
+        const uint8_t *src = in + pos ;
+        if(in_bytes - pos < bytes + decode_slack){
+            std::memset(scratch, 0, sizeof(scratch)) ;
+            std::memcpy(scratch, src, bytes) ;
+            src = scratch ;
+        }
+        if(len == codec_block_counters){
+            unpackers[width](src, counters + start) ;
+        } else {
+            unpack_partial(src, width, counters + start, len) ;
+        }
+        pos += bytes ;
+    }
+    return pos ;
+}
@@ -0,0 +1,28 @@
+//
+// Compressed encoding for tables of int64_t counters.
+// Counters are zigzag encoded (so small negative values, e.g. in deltas, stay small) and split into blocks
+// of codec_block_counters. Each block is stored as one byte holding the block-local bit width b followed by
+// the counters bit-packed at b bits each, so a block of zeros costs one byte and a block of small counters a
+// few bits per counter. Decoding a full block dispatches to an unpacker specialised for its width whose
+// shifts and masks are compile-time constants, which the compiler unrolls and vectorises.
+//
+
+#ifndef LINEARSKETCHES_TABLE_CODEC_H
+#define LINEARSKETCHES_TABLE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const size_t codec_block_counters = 128 ;
+
+size_t max_encoded_bytes(size_t n) ;
+
+// Appends the encoding of counters[0..n) to out. Consecutive calls produce the same bytes as a single call
+// as long as every call but the last encodes a multiple of codec_block_counters counters.
+void encode_counters(const int64_t *counters, size_t n, std::vector<uint8_t> &out) ;
+
+// Decodes n counters from in and returns the number of bytes consumed. Throws if in_bytes is too short.
+size_t decode_counters(const uint8_t *in, size_t in_bytes, int64_t *counters, size_t n) ;
+
+#endif //LINEARSKETCHES_TABLE_CODEC_H